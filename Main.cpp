@@ -4,15 +4,21 @@
 */
 #include <cctype>
 #include <cmath>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <queue>
 #include <stack>
 #include <string>
+#include <thread>
+#include <atomic>
 
 
 #include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <string.h>
 
 
@@ -109,6 +115,8 @@ std::vector<std::string> test_cases = {
 TEST_CASE("Testing mep ")
 {
    CHECK(doctest::Approx(1.3812).epsilon(0.001) == Test("sin(x) + cos(y)"));
+   CHECK(doctest::Approx(std::sin(3.0)) == Test("sin(1 + 2)"));
+   CHECK(doctest::Approx(2 * std::exp(-1.0)) == Test("2 * exp(-1*1)"));
    CHECK(   1 == Test("--1"));
    
    CHECK(1 == Test("- + -1"));
@@ -157,6 +165,943 @@ TEST_CASE("Testing mep ")
 
 }
 
+TEST_CASE("Testing n-ary flattening")
+{
+   using namespace mep;
+   Parser parser;
+   AST* ast = flatten(parser.parse("1 + 2 + 3 + 4 - 5 * 6 * 7"));
+   NaryNode* sum = dynamic_cast<NaryNode*>(dynamic_cast<BinaryNode*>(ast)->m_left);
+   REQUIRE(sum != nullptr);
+   CHECK(4 == sum->m_children.size());
+
+   BeautifingVisitor printer;
+   CHECK("((1.00 + 2.00 + 3.00 + 4.00) - (5.00 * 6.00 * 7.00))" == printer.collect(ast));
+
+   EvaluteVisitor evaluator;
+   CHECK(-200 == evaluator.collect(ast));
+   evaluator.pairwise(true);
+   CHECK(-200 == evaluator.collect(ast));
+   delete ast;
+
+   // past 8 operands, pairwise reduction splits in halves, each reduced in order :
+   // 1e16 + 1 + ... rounds back to 1e16 when the ones come one at a time
+   for (bool is_sum : { true, false }) {
+      std::vector<number_t> values(16);
+      std::string source;
+      EvaluteVisitor reducer;
+      for (size_t i = 0; i < values.size(); ++i) {
+         values[i] = is_sum ? (i ? 1.0 : 1e16) : 1 + 0.1 * double(i + 1);
+         std::string name = "x" + std::to_string(i);
+         reducer.set(name, values[i]);
+         source += (i ? (is_sum ? " + " : " * ") : "") + name;
+      }
+      number_t sequential = values[0], left = values[0], right = values[8];
+      for (size_t i = 1; i < 16; ++i) {
+         sequential = is_sum ? sequential + values[i] : sequential * values[i];
+         if (i < 8) left = is_sum ? left + values[i] : left * values[i];
+         if (i > 8) right = is_sum ? right + values[i] : right * values[i];
+      }
+      const number_t pairwise = is_sum ? left + right : left * right;
+      REQUIRE(sequential != pairwise);
+
+      ast = flatten(parser.parse(source));
+      REQUIRE(dynamic_cast<NaryNode*>(ast) != nullptr);
+      CHECK(sequential == reducer.collect(ast));
+      reducer.pairwise(true);
+      CHECK(pairwise == reducer.collect(ast));
+      delete ast;
+   }
+
+   // right grouping is kept binary
+   ast = flatten(parser.parse("1 + (2 + 3)"));
+   CHECK(dynamic_cast<BinaryNode*>(ast) != nullptr);
+   delete ast;
+}
+
+TEST_CASE("Testing compiled and incremental evaluation")
+{
+   using namespace mep;
+   Parser parser;
+   AST* ast = flatten(parser.parse("x*y + sin(z) - a + b + c + 2^w"));
+   EvaluteVisitor visitor;
+   visitor.set("x", 3);
+   visitor.set("y", 4);
+   visitor.set("z", 0.5);
+   visitor.set("w", 3);
+
+   Program prog = compile(ast);
+   CHECK(7 == prog.nb_variables());
+   CHECK(visitor.collect(ast) == prog.evaluate({ {"x", 3}, {"y", 4}, {"z", 0.5}, {"w", 3} }));
+
+   IncrementalEvaluator incr(prog);
+   incr.set("x", 3);
+   incr.set("y", 4);
+   incr.set("z", 0.5);
+   incr.set("w", 3);
+   CHECK(visitor.collect(ast) == incr.evaluate());
+   CHECK(prog.size() == incr.nb_recomputed());
+
+   // only the path from y to the root : y, x*y, x*y + sin(z), - a, sum
+   incr.set("y", 10);
+   visitor.set("y", 10);
+   CHECK(visitor.collect(ast) == incr.evaluate());
+   CHECK(5 == incr.nb_recomputed());
+
+   incr.set("y", 10); // unchanged
+   CHECK(visitor.collect(ast) == incr.evaluate());
+   CHECK(0 == incr.nb_recomputed());
+   delete ast;
+
+   // wide formulas : slots in order of first use, each name once
+   std::string wide = "x0";
+   for (int i = 1; i < 5000; ++i) wide += " + x" + std::to_string(i) + " * x" + std::to_string(i / 2);
+   ast = parser.parse(wide);
+   prog = compile(ast);
+   CHECK(5000 == prog.nb_variables());
+   CHECK(4999 == prog.slot("x4999"));
+   CHECK(-1 == prog.slot("y"));
+   delete ast;
+}
+
+TEST_CASE("Testing workbook")
+{
+   using namespace mep;
+   Workbook book(4);
+   book.define("rate = base + spread");
+   book.define("price = notional * rate");
+   book.define("fee", "2 * price");
+   book.set("base", 2);
+   book.set("spread", 1);
+   book.set("notional", 10);
+   CHECK(3 == book.recalculate());
+   CHECK(60 == book.value("fee"));
+
+   // only notional dependents are recomputed
+   book.set("notional", 100);
+   CHECK(2 == book.recalculate());
+   CHECK(600 == book.value("fee"));
+
+   CHECK_THROWS_AS(book.define("base = fee + 1"), WorkbookException);
+   CHECK_THROWS_AS(book.define("x = x + 1"), WorkbookException);
+   CHECK_THROWS_AS(book.set("price", 1), WorkbookException);
+
+   // wide waves go through the thread pool
+   book.parallel_threshold(1);
+   for (int i = 0; i < 200; ++i) {
+      book.define("c" + std::to_string(i) + " = fee + " + std::to_string(i));
+   }
+   book.define("rate = base - spread");
+   CHECK(203 == book.recalculate());
+   CHECK(200 + 199 == book.value("c199"));
+}
+
+TEST_CASE("Testing batch evaluation with invariants")
+{
+   using namespace mep;
+   Parser parser;
+   AST* ast = parser.parse("x * exp(-k*t) + y");
+   BatchEvaluator batch(compile(ast));
+   delete ast;
+
+   std::vector<number_t> xs(1000), out(1000);
+   for (size_t i = 0; i < xs.size(); ++i) xs[i] = static_cast<number_t>(i);
+   batch.bind_column("x", xs.data());
+   batch.bind_param("k", 0.5);
+   batch.bind_param("t", 2);
+   batch.bind_param("y", 3);
+   batch.evaluate(xs.size(), out.data());
+   // k, t, k*t, -k*t, exp(...), y are hoisted
+   CHECK(6 == batch.nb_hoisted());
+   CHECK(3 == batch.nb_per_row());
+   double max_error = 0;
+   for (size_t i = 0; i < xs.size(); ++i) {
+      max_error = std::max(max_error, std::abs(xs[i] * std::exp(-1.0) + 3 - out[i]));
+   }
+   CHECK(max_error < 1e-9);
+
+   // switching y to a column changes the plan
+   std::vector<number_t> ys(1000, 1);
+   batch.bind_column("y", ys.data());
+   ThreadPool pool(4);
+   batch.evaluate(xs.size(), out.data(), &pool);
+   CHECK(4 == batch.nb_per_row());
+   CHECK(999 * std::exp(-1.0) + 1 == doctest::Approx(out[999]));
+}
+
+TEST_CASE("Testing specialization")
+{
+   using namespace mep;
+   Parser parser;
+   AST* ast = flatten(parser.parse("x * exp(-k*t) + 0*y + z^p - -w"));
+   Program full = compile(ast);
+   Program residual = specialize(ast, { {"k", 0.5}, {"t", 2}, {"p", 1}, {"y", 0} });
+   delete ast;
+
+   // x * <const> + z - -w : 0*y folds to 0 and is dropped from the sum
+   CHECK(std::vector<std::string>{ "x", "z", "w" } == residual.m_variables);
+   CHECK(8 == residual.size());
+   std::map<std::string, number_t> vars = { {"x", 3}, {"k", 0.5}, {"t", 2}, {"p", 1}, {"y", 0}, {"z", 7}, {"w", 2} };
+   CHECK(full.evaluate(vars) == residual.evaluate({ {"x", 3}, {"z", 7}, {"w", 2} }));
+
+   // fully fixed expressions fold to a single constant
+   Program constant = specialize(full, vars);
+   CHECK(1 == constant.size());
+   CHECK(full.evaluate(vars) == constant.evaluate(std::vector<number_t>{}));
+}
+
+TEST_CASE("Testing expression cache")
+{
+   using namespace mep;
+   ExpressionCache::Limits limits;
+   limits.max_entries = 2;
+   limits.nb_shards = 1;
+   ExpressionCache cache(limits);
+
+   CompiledExpression a = cache.get("x + y");
+   CHECK(a == cache.get("  x+y "));
+   CHECK(a == cache.find("x+ y"));
+   CHECK(nullptr == cache.find("x + z"));
+   CHECK_THROWS_AS(cache.get("x y"), ParserException); // not "xy"
+
+   cache.get("x * 2");
+   cache.get("x * 3"); // evicts "x + y"
+   CHECK(nullptr == cache.find("x + y"));
+   CHECK(3 == a->evaluate({ {"x", 1}, {"y", 2} })); // still usable after eviction
+
+   ExpressionCache::Stats stats = cache.stats();
+   CHECK(2 == stats.hits);
+   CHECK(6 == stats.misses);
+   CHECK(1 == stats.evictions);
+   CHECK(2 == stats.entries);
+}
+
+TEST_CASE("Testing canonical form")
+{
+   using namespace mep;
+   auto canonical = [](const char* text) {
+      Parser parser;
+      return canonicalize(parser.parse(text));
+   };
+   auto same = [&](const char* t1, const char* t2) {
+      AST* a = canonical(t1);
+      AST* b = canonical(t2);
+      bool equal = structural_hash(a) == structural_hash(b);
+      CHECK(equal == structurally_equal(a, b));
+      delete a;
+      delete b;
+      return equal;
+   };
+   CHECK(same("x+y", "y + x"));
+   CHECK(same("(a*b)", "a*b"));
+   CHECK(same("a*b*c + d", "d + c*(b*a)"));
+   CHECK(same("+x - --y", "x - y"));
+   CHECK(same("007 * sin(x + 1)", "sin(1 + x) * 7"));
+   CHECK_FALSE(same("x-y", "y-x"));
+   CHECK_FALSE(same("x/y", "y/x"));
+   CHECK_FALSE(same("sin(x)", "cos(x)"));
+   CHECK_FALSE(same("a*b+c", "a*(b+c)"));
+
+   // the canonical form is a fixed point
+   AST* once = canonical("sin(x + y) + 2 + (a + b)*c");
+   AST* twice = canonicalize(canonical("c*(b + a) + sin(y + x) + 2"));
+   CHECK(structurally_equal(once, twice));
+   delete twice;
+   delete once;
+
+   AST* ast = canonical("2 * (y + x) * 3");
+   EvaluteVisitor evaluator;
+   CHECK(12 == evaluator.collect(ast));
+   delete ast;
+}
+
+TEST_CASE("Testing persistent program store")
+{
+   using namespace mep;
+   const std::string path = "mep_test_store.bin";
+   std::vector<std::string> sources = { "x * exp(-k*t) + 1", "a + b + c + d", "sin(x) / 2" };
+   ProgramStoreWriter writer;
+   Parser parser;
+   for (const std::string& source : sources) {
+      AST* ast = flatten(parser.parse(source));
+      writer.add(source, compile(ast));
+      delete ast;
+   }
+   writer.write(path);
+
+   ProgramStore store;
+   REQUIRE(ProgramStore::Ok == store.open(path));
+   CHECK(3 == store.size());
+   StoredProgram stored;
+   REQUIRE(store.find("x*exp(-k*t)+1", stored)); // whitespace does not matter
+   CHECK("k" == stored.variable(1));
+   CHECK(2 == stored.slot("t"));
+   std::vector<number_t> vars = { 3, 0.5, 2 }, regs(stored.view().size());
+   CHECK(doctest::Approx(3 * std::exp(-1.0) + 1) == stored.evaluate(vars.data(), regs.data()));
+   CHECK(stored.to_program().evaluate(vars) == stored.evaluate(vars.data(), regs.data()));
+   CHECK_FALSE(store.find("x * exp(-k*t) + 2", stored)); // changed source
+   store.close();
+
+   // same (normalized) source : replaced ; unknown function with a valid checksum : rejected
+   AST* ast = parser.parse("sin(x)");
+   Program crafted = compile(ast);
+   delete ast;
+   writer.add(" a+b +c+ d ", crafted);
+   CHECK(3 == writer.size());
+   crafted.m_code.back().func = 200;
+   writer.add("sin(x)", crafted);
+   writer.write(path);
+   REQUIRE(ProgramStore::Ok == store.open(path));
+   CHECK(store.find("a + b + c + d", stored));
+   CHECK(1 == stored.nb_variables()); // the replacing program
+   CHECK_FALSE(store.find("sin(x)", stored));
+   CHECK_THROWS_AS(call_math_function(FunctionId(200), 1), EvaluatorException);
+
+   // corrupted entry : detected on access
+   store.close();
+   writer = ProgramStoreWriter();
+   for (const std::string& source : sources) {
+      ast = flatten(parser.parse(source));
+      writer.add(source, compile(ast));
+      delete ast;
+   }
+   writer.write(path);
+   {
+      std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(-12, std::ios::end);
+      file.put('#');
+   }
+   REQUIRE(ProgramStore::Ok == store.open(path));
+   size_t nb_found = 0;
+   for (const std::string& source : sources) nb_found += store.find(source, stored);
+   CHECK(2 == nb_found);
+   store.close();
+   std::remove(path.c_str());
+   CHECK(ProgramStore::NotFound == store.open(path));
+}
+
+TEST_CASE("Testing AST binary round trip")
+{
+   using namespace mep;
+   std::vector<std::string> sources = test_cases;
+   sources.insert(sources.end(), { "x * exp(-k*t) + y", "a + b + c + d * e * f", "-(-(x))", "log10(abs(x - 123456789))",
+                                   "2^3^2 % 5", "a + a + a + b" });
+   size_t nb_checked = 0;
+   for (const std::string& source : sources) {
+      Parser parser;
+      AST* ast = nullptr;
+      try {
+         ast = flatten(parser.parse(source));
+      } catch (ParserException&) {
+         continue; // invalid inputs of the list
+      }
+      std::vector<char> blob;
+      try {
+         blob = serialize_ast(ast);
+      } catch (MepException&) {
+         delete ast; // & and | parse but are not supported
+         continue;
+      }
+      // the mapping of a file is page aligned : copy into an aligned buffer
+      std::vector<double> aligned((blob.size() + 7) / 8);
+      std::memcpy(aligned.data(), blob.data(), blob.size());
+      AstBlobView view(aligned.data(), blob.size());
+      REQUIRE(view.validate());
+
+      EvaluteVisitor evaluator;
+      evaluator.set("x", 0.3);
+      std::map<std::string, number_t> vars = { {"x", 0.3} };
+      number_t expected = evaluator.collect(ast);
+      number_t in_place = view.evaluate(vars);
+      CHECK((expected == in_place || (std::isnan(expected) && std::isnan(in_place))));
+
+      AST* copy = view.to_ast();
+      CHECK(structurally_equal(ast, copy));
+      CHECK(blob == serialize_ast(copy));
+      delete copy;
+      delete ast;
+      nb_checked++;
+   }
+   CHECK(nb_checked >= 30);
+
+   // identifiers are stored once
+   Parser parser;
+   AST* ast = parser.parse("abcdef + abcdef * abcdef");
+   std::vector<char> blob = serialize_ast(ast);
+   delete ast;
+   CHECK(1 == reinterpret_cast<const AstBlobHeader*>(blob.data())->nb_strings);
+
+   // truncated or corrupted blobs are rejected
+   std::vector<double> aligned((blob.size() + 7) / 8);
+   std::memcpy(aligned.data(), blob.data(), blob.size());
+   CHECK(AstBlobView(aligned.data(), blob.size()).validate());
+   CHECK_FALSE(AstBlobView(aligned.data(), blob.size() - 16).validate());
+   reinterpret_cast<AstBlobHeader*>(aligned.data())->root -= sizeof(AstBlobNode);
+   CHECK_FALSE(AstBlobView(aligned.data(), blob.size()).validate());
+   reinterpret_cast<AstBlobHeader*>(aligned.data())->root += sizeof(AstBlobNode);
+   // a node shared by two references (a DAG) : abcdef * abcdef -> node #1 * node #1
+   AstBlobNode* nodes = reinterpret_cast<AstBlobNode*>(reinterpret_cast<char*>(aligned.data()) + sizeof(AstBlobHeader));
+   REQUIRE(AstBlobNode::Binary == nodes[3].kind);
+   nodes[3].ref.b = nodes[3].ref.a;
+   CHECK_FALSE(AstBlobView(aligned.data(), blob.size()).validate());
+
+   // leaves to_ast() could not rebuild : -1, inf and nan would read back as
+   // variables, 1b and a+ would not read back as one variable
+   ast = parser.parse("ab + 5");
+   blob = serialize_ast(ast);
+   delete ast;
+   aligned.assign((blob.size() + 7) / 8, 0);
+   std::memcpy(aligned.data(), blob.data(), blob.size());
+   nodes = reinterpret_cast<AstBlobNode*>(reinterpret_cast<char*>(aligned.data()) + sizeof(AstBlobHeader));
+   REQUIRE(AstBlobNode::Number == nodes[1].kind);
+   for (double value : { -1.0, -0.0, HUGE_VAL, std::nan("") }) {
+      nodes[1].value = value;
+      CHECK_FALSE(AstBlobView(aligned.data(), blob.size()).validate());
+   }
+   nodes[1].value = 5;
+   REQUIRE(AstBlobView(aligned.data(), blob.size()).validate());
+   const AstBlobHeader* header = reinterpret_cast<const AstBlobHeader*>(aligned.data());
+   char* chars = reinterpret_cast<char*>(aligned.data()) + header->strings_offset + (header->nb_strings + 1) * sizeof(uint32_t);
+   REQUIRE(std::string("ab") == std::string(chars, 2));
+   chars[0] = '1';
+   CHECK_FALSE(AstBlobView(aligned.data(), blob.size()).validate());
+   chars[0] = 'a';
+   chars[1] = '+';
+   CHECK_FALSE(AstBlobView(aligned.data(), blob.size()).validate());
+   chars[1] = 'b';
+   CHECK(AstBlobView(aligned.data(), blob.size()).validate());
+
+   // deep trees : written, checked, evaluated and rebuilt without recursion
+   std::string deep;
+   for (int i = 0; i < 100000; ++i) deep += "-(";
+   deep += "x" + std::string(100000, ')');
+   ParserLimits unlimited;
+   unlimited.max_depth = unlimited.max_nodes = static_cast<size_t>(-1);
+   AST* chain = Parser(unlimited).parse(deep);
+   blob = serialize_ast(chain);
+   delete chain;
+   aligned.assign((blob.size() + 7) / 8, 0);
+   std::memcpy(aligned.data(), blob.data(), blob.size());
+   AstBlobView view(aligned.data(), blob.size());
+   REQUIRE(view.validate());
+   CHECK(100001 == view.header().nb_nodes);
+   CHECK(3 == view.evaluate({ {"x", 3} }));
+   chain = view.to_ast();
+   CHECK(blob == serialize_ast(chain));
+   delete chain;
+}
+
+#ifndef _WIN32
+TEST_CASE("Testing shared memory store")
+{
+   using namespace mep;
+   const std::string name = "mep_test_shared_" + std::to_string(::getpid());
+   auto rules = [](const char* price) {
+      ProgramStoreWriter writer;
+      Parser parser;
+      for (const char* source : { price, "qty * 2" }) {
+         AST* ast = parser.parse(source);
+         writer.add(source, compile(ast));
+         delete ast;
+      }
+      return writer;
+   };
+
+   SharedStorePublisher publisher(name);
+   SharedStoreReader reader(name);
+   CHECK_FALSE(reader.refresh()); // nothing published yet
+
+   CHECK(1 == publisher.publish(rules("x + 1")));
+   CHECK(reader.refresh());
+   StoredProgram v1;
+   REQUIRE(reader.store().find("x + 1", v1));
+   std::vector<number_t> vars = { 41 }, regs(8);
+   CHECK(42 == v1.evaluate(vars.data(), regs.data()));
+   CHECK_FALSE(reader.refresh()); // unchanged
+
+   // a new generation is picked up on refresh
+   CHECK(2 == publisher.publish(rules("x + 2")));
+   CHECK(1 == reader.generation());
+   CHECK(reader.refresh());
+   CHECK(2 == reader.generation());
+   CHECK_FALSE(reader.store().find("x + 1", v1));
+   REQUIRE(reader.store().find("x + 2", v1));
+   CHECK(43 == v1.evaluate(vars.data(), regs.data()));
+
+   SharedStorePublisher::unlink(name);
+}
+#endif
+
+TEST_CASE("Testing registry hot reload under concurrent readers")
+{
+   using namespace mep;
+   auto rules = [](int i) {
+      return ExpressionSet::Definitions{ {"f", "x + " + std::to_string(i)}, {"g", "x * 2"} };
+   };
+   ExpressionRegistry registry;
+   CHECK(1 == registry.reload(rules(1)));
+   CHECK_THROWS_AS(registry.reload({ {"f", "x + "} }), ParserException);
+   CHECK(1 == registry.version()); // kept on error
+
+   // each set i holds f = x + i and has version i : readers check they
+   // always see a consistent, alive set
+   std::atomic<bool> stop{ false };
+   std::atomic<size_t> nb_errors{ 0 }, nb_reads{ 0 };
+   std::vector<std::thread> readers;
+   for (int t = 0; t < 4; ++t) {
+      readers.emplace_back([&]() {
+         ExpressionRegistry::Reader reader(registry);
+         std::vector<number_t> vars = { 0 };
+         while (!stop.load()) {
+            auto set = reader.read();
+            number_t f = set->find("f")->evaluate(vars);
+            if (f != static_cast<number_t>(set->version()) || set->find("g") == nullptr) nb_errors++;
+            nb_reads++;
+         }
+      });
+   }
+   for (int i = 2; i <= 300; ++i) {
+      if (i % 2) {
+         CHECK(static_cast<uint64_t>(i) == registry.reload(rules(i)));
+      } else {
+         CHECK(static_cast<uint64_t>(i) == registry.reload_async(rules(i)).get());
+      }
+   }
+   stop = true;
+   for (std::thread& reader : readers) reader.join();
+   CHECK(0 == nb_errors);
+   CHECK(nb_reads > 0);
+
+   registry.reclaim(); // no reader left : everything retired goes
+   CHECK(0 == registry.nb_retired());
+   CHECK(300 == registry.version());
+}
+
+TEST_CASE("Testing bulk loading")
+{
+   using namespace mep;
+   const std::string path = "mep_test_rules.txt";
+   {
+      std::ofstream out(path, std::ios::binary);
+      for (int i = 0; i < 5000; ++i) {
+         out << "x * " << i << " + sin(y)\r\n";
+      }
+      out << "\n";           // blank : skipped
+      out << "2 + (5 * 2\n"; // invalid
+      out << "x - 1";        // no final end of line
+   }
+   ThreadPool pool(4);
+   BulkLoadResult result = load_expression_file(path, pool);
+   std::remove(path.c_str());
+
+   REQUIRE(5003 == result.expressions.size());
+   CHECK(4999 * 2 + std::sin(1.0) == doctest::Approx(result.expressions[4999]->evaluate({ {"x", 2} })));
+   CHECK(nullptr == result.expressions[5000]);
+   CHECK(nullptr == result.expressions[5001]);
+   CHECK(1 == result.expressions[5002]->evaluate({ {"x", 2} }));
+   REQUIRE(1 == result.errors.size());
+   CHECK(5002 == result.errors[0].line);
+
+   CHECK_THROWS_AS(load_expression_file("no_such_file.txt", pool), MepException);
+}
+
+
+TEST_CASE("Testing exception free parse and evaluate")
+{
+   using namespace mep;
+   Result<AST*> ast = try_parse("x * (y + 2)");
+   REQUIRE(ast.ok());
+   CHECK(12 == try_evaluate(ast.value(), { {"x", 3}, {"y", 2} }).value());
+   delete ast.value();
+
+   Result<number_t> value = try_evaluate("2 + (5 * 2");
+   CHECK(!value);
+   CHECK(E_EXPECTED_RP == value.error().kind);
+   CHECK(10 == value.error().offset);
+   CHECK(-1 == value.value_or(-1));
+
+   CHECK(E_UNSUPPORTED_OPERATOR == try_parse("  7 & 2").error().kind);
+   CHECK(4 == try_parse("  7 & 2").error().offset);
+   CHECK(E_UNEXPECTED_TOKEN == try_parse(" % ").error().kind);
+   CHECK(E_TRAILING_INPUT == try_parse("(4))").error().kind);
+   CHECK(3 == try_parse("(4))").error().offset);
+   CHECK(E_EXPECTED_LP == try_parse("sin 2").error().kind);
+   CHECK(E_UNEXPECTED_TOKEN == try_parse("").error().kind);
+   CHECK(E_IDENTIFIER_TOO_LONG == try_parse("1 + " + std::string(100, 'a')).error().kind);
+   CHECK(E_INVALID_NUMBER == try_evaluate("1" + std::string(400, '0')).error().kind);
+   CHECK(E_INVALID_TREE == try_evaluate(static_cast<AST*>(nullptr)).error().kind);
+
+   // the throwing API reports the same error
+   Parser parser;
+   CHECK_THROWS_AS(parser.parse("((9)) * ((1)"), ParserException);
+   CHECK(E_EXPECTED_RP == parser.error().kind);
+   AST* tree = parser.parse("2 * 3");
+   CHECK(6 == try_evaluate(tree).value());
+   delete tree;
+}
+
+TEST_CASE("Testing syntax only validation")
+{
+   using namespace mep;
+   // same verdict and position as the full parser
+   std::vector<std::string> inputs = test_cases;
+   inputs.insert(inputs.end(), { "", "(4))", "sin 2", "sin(", "2 3", "x * (y + 2) 4", "- + -1",
+                                 "exp(-k*t)*x", "1 + " + std::string(100, 'a'), "((1) + 2))" });
+   for (const std::string& input : inputs) {
+      Error syntax = validate(input);
+      Result<AST*> ast = try_parse(input);
+      CHECK_MESSAGE(syntax.kind == ast.error().kind, input);
+      CHECK_MESSAGE(syntax.offset == ast.error().offset, input);
+      if (ast) delete ast.value();
+   }
+
+   std::string input = "x * (y + 2) - sin(x / z1) + y";
+   auto variables = collect_variables(input);
+   REQUIRE(variables.ok());
+   REQUIRE(3 == variables.value().size());
+   CHECK("x" == variables.value()[0]);
+   CHECK("y" == variables.value()[1]);
+   CHECK("z1" == variables.value()[2]);
+   CHECK(E_EXPECTED_RP == collect_variables("x * (y").error().kind);
+}
+
+TEST_CASE("Testing deeply nested input")
+{
+   using namespace mep;
+   const size_t n = 100000;
+   ParserLimits unlimited;
+   unlimited.max_depth = unlimited.max_nodes = static_cast<size_t>(-1);
+   Parser parser(unlimited);
+   // nesting costs no call stack
+   std::string nested = std::string(n, '(') + "x" + std::string(n, ')');
+   AST* leaf = parser.parse(nested);
+   CHECK(5 == try_evaluate(leaf, { {"x", 5} }).value());
+   delete leaf;
+   CHECK(E_EXPECTED_RP == try_parse(std::string(n, '(') + "x").error().kind);
+
+   // deep nesting is rejected by default ...
+   CHECK(E_TOO_DEEP == try_parse(nested).error().kind);
+   std::string signs;
+   for (size_t i = 0; i < n; ++i) signs += (i % 2) ? "+" : "-";
+   signs += "x";
+   CHECK(E_TOO_DEEP == try_parse(signs).error().kind);
+   ParserLimits shallow;
+   shallow.max_depth = 2;
+   CHECK(try_parse("-+x + sin(cos(x)) * ((y))", shallow).ok());
+   CHECK(E_TOO_DEEP == try_parse("-(-x)", shallow).error().kind);
+   CHECK(E_TOO_DEEP == try_parse("sin(cos(tan(x)))", shallow).error().kind);
+   ParserLimits small;
+   small.max_nodes = 10;
+   CHECK(E_TOO_LARGE == try_parse("a*b + c*d + e*f", small).error().kind);
+
+   // ... long chains of operators are not : a left (or right for ^) deep tree
+   // goes through all the passes without recursion
+   std::string flat = "1";
+   for (size_t i = 0; i < 49999; ++i) flat += "+1";
+   AST* long_sum = Parser().parse(flat);
+   CHECK(50000 == try_evaluate(long_sum).value());
+   Program program = compile(long_sum);
+   CHECK(50000 == program.evaluate(std::vector<number_t>()));
+   CHECK(structurally_equal(long_sum, long_sum));
+   long_sum = canonicalize(flatten(long_sum));
+   CHECK(50000 == try_evaluate(long_sum).value());
+   delete long_sum;
+   std::string tower = "x";
+   for (size_t i = 0; i < 49999; ++i) tower += "^1";
+   AST* powers = Parser().parse(tower);
+   CHECK(3 == compile(powers).evaluate({ {"x", 3} }));
+   powers = canonicalize(flatten(powers));
+   CHECK(3 == try_evaluate(powers, { {"x", 3} }).value());
+   delete powers;
+
+   // evaluating, printing and deleting deep trees does not recurse either
+   std::string sum = "1";
+   for (size_t i = 0; i < n; ++i) sum += "+1";
+   AST* deep = parser.parse(sum);
+   EvaluteVisitor evaluator;
+   CHECK(n + 1 == evaluator.collect(deep));
+   CHECK(n + 1 == try_evaluate(deep).value());
+   Evaluator legacy;
+   CHECK(n + 1 == legacy.evaluate(deep));
+   BeautifingVisitor printer;
+   deep->accept(printer);
+   CHECK(printer.result.size() > 6 * n);
+   delete deep;
+
+   deep = parser.parse(signs);
+   CHECK(5 == try_evaluate(deep, { {"x", 5} }).value()); // even number of -
+   delete deep;
+}
+
+TEST_CASE("Testing phase instrumentation")
+{
+   using namespace mep;
+   // log-linear buckets : exact below 32ns, then within 1/16
+   CHECK(7 == PhaseStats::bucket_low(PhaseStats::bucket_of(7)));
+   CHECK(31 == PhaseStats::bucket_low(PhaseStats::bucket_of(31)));
+   for (uint64_t ns : { uint64_t(100), uint64_t(12345), uint64_t(987654321) }) {
+      unsigned b = PhaseStats::bucket_of(ns);
+      CHECK(PhaseStats::bucket_low(b) <= ns);
+      CHECK(ns < PhaseStats::bucket_high(b));
+      CHECK(PhaseStats::bucket_high(b) - PhaseStats::bucket_low(b) <= ns / 16 + 1);
+   }
+
+   reset_instrumentation();
+   std::thread worker([] {
+      AST* ast = Parser().parse("x * y + 2");
+      Program prog = compile(ast);
+      prog.evaluate(std::vector<number_t>{ 1, 2 });
+      delete ast;
+   });
+   worker.join();
+   try_parse("x * (y");
+   CHECK(validate("a + b").kind == E_NONE);
+
+   InstrumentationSnapshot snapshot = instrumentation_snapshot();
+#ifdef MEP_INSTRUMENTATION
+   CHECK(2 == snapshot.phases[PH_PARSE].count); // the exited thread is kept
+   CHECK(1 == snapshot.phases[PH_COMPILE].count);
+   CHECK(1 == snapshot.phases[PH_EVALUATE].count);
+   CHECK(1 == snapshot.phases[PH_LEX].count);
+   CHECK(5 == snapshot.events[EV_NODES]);
+   CHECK(1 == snapshot.events[EV_PARSE_ERRORS]);
+   CHECK(snapshot.phases[PH_PARSE].percentile_ns(50) <= snapshot.phases[PH_PARSE].max_ns());
+#else
+   CHECK(0 == snapshot.phases[PH_PARSE].count);
+#endif
+   std::string text = to_prometheus(snapshot);
+   CHECK(text.find("mep_phase_duration_seconds_count{phase=\"parse\"}") != std::string::npos);
+   CHECK(text.find("le=\"+Inf\"") != std::string::npos);
+   CHECK(to_json(snapshot).find("\"p99_ns\"") != std::string::npos);
+}
+
+TEST_CASE("Testing allocation accounting")
+{
+   using namespace mep;
+   const MemStats before = mem_stats();
+   std::thread worker([] {
+      AST* ast = Parser().parse("aratherlongvariablename * y + 2");
+      Program prog = compile(ast);
+      delete ast;
+   });
+   worker.join();
+   const MemStats after = mem_stats();
+   auto delta = [&](MemCategory c) {
+      MemCounters d;
+      d.allocations = after[c].allocations - before[c].allocations;
+      d.frees = after[c].frees - before[c].frees;
+      d.bytes_allocated = after[c].bytes_allocated - before[c].bytes_allocated;
+      d.bytes_freed = after[c].bytes_freed - before[c].bytes_freed;
+      return d;
+   };
+#ifdef MEP_MEM_STATS
+   // 3 leaves, 2 operators, all freed by the exited thread
+   CHECK(5 == delta(MEM_AST_NODES).allocations);
+   CHECK(0 == delta(MEM_AST_NODES).live_bytes());
+   CHECK(delta(MEM_AST_NODES).bytes_allocated >= 5 * sizeof(Node));
+   CHECK(delta(MEM_TOKENS).allocations > 0);
+   CHECK(0 == delta(MEM_TOKENS).live_allocations());
+   CHECK(delta(MEM_STRINGS).allocations >= 2); // token and leaf of the long name
+   CHECK(0 == delta(MEM_STRINGS).live_bytes());
+   CHECK(delta(MEM_CODE).bytes_allocated >= 5 * sizeof(Program::Instr));
+   CHECK(0 == delta(MEM_CODE).live_bytes());
+#else
+   CHECK(0 == delta(MEM_AST_NODES).allocations);
+#endif
+   std::ostringstream os;
+   show_mem_stats(os);
+   CHECK(os.str().find("AST nodes") != std::string::npos);
+}
+
+TEST_CASE("Testing per node profiling")
+{
+   using namespace mep;
+   AST* ast = Parser().parse("x * y + exp(sin(z) ^ 3) + +w");
+   Profiler profiler(ast);
+   number_t value = 0;
+   for (int i = 0; i < 100; ++i) {
+      value = profiler.evaluate({ {"x", 2}, {"y", 3}, {"z", 0.5}, {"w", i} });
+   }
+   CHECK(doctest::Approx(6 + std::exp(std::pow(std::sin(0.5), 3)) + 99) == value);
+   for (size_t i = 0; i < profiler.program().size(); ++i) {
+      CHECK(100 == profiler.counter(i).executions);
+   }
+
+   // the root holds all the cost, the self costs share it
+   CHECK(doctest::Approx(100) == profiler.percent(ast));
+   double self = 0;
+   for (size_t i = 0; i < profiler.program().size(); ++i) {
+      self += 100.0 * profiler.counter(i).cycles / std::max<uint64_t>(1, profiler.total_cycles());
+   }
+   CHECK(doctest::Approx(100) == self);
+   UnaryNode* plus = dynamic_cast<UnaryNode*>(dynamic_cast<BinaryNode*>(ast)->m_right);
+   REQUIRE(plus != nullptr);
+   CHECK(-1 == profiler.percent(plus)); // +w compiles to no instruction
+
+   // BeautifingVisitor text with the shares
+   std::string text = profiler.annotate(0);
+   CHECK(0 == text.find("(((x * y)["));
+   CHECK(text.find("exp((sin(z)") != std::string::npos);
+   CHECK(text.size() - 8 == text.rfind(")[100.0%]") + 1);
+   std::string plain = profiler.annotate(101); // nothing annotated
+   BeautifingVisitor printer;
+   CHECK(printer.collect(ast) == plain);
+   CHECK(profiler.report().find("CALL exp") != std::string::npos);
+
+   profiler.reset();
+   CHECK(0 == profiler.total_cycles());
+   delete ast;
+}
+
+TEST_CASE("Testing chrome trace export")
+{
+   using namespace mep;
+   chrome_trace(); // drops what other tests recorded
+   start_tracing();
+   AST* ast = Parser().parse("x * exp(-k*t) + y");
+   BatchEvaluator batch(compile(ast));
+   delete ast;
+   std::vector<number_t> xs(10000, 1), out(10000);
+   batch.bind_column("x", xs.data());
+   ThreadPool pool(4);
+   batch.evaluate(xs.size(), out.data(), &pool);
+   ExpressionRegistry registry;
+   registry.reload({ {"price", "x * 2"} });
+   stop_tracing();
+   Parser().parse("1 + 2"); // not traced
+
+   const std::string trace = chrome_trace();
+#ifdef MEP_TRACING
+   auto count = [&](const std::string& what) {
+      size_t n = 0;
+      for (size_t pos = trace.find(what); pos != std::string::npos; pos = trace.find(what, pos + 1)) ++n;
+      return n;
+   };
+   CHECK(2 == count("\"name\": \"parse\""));
+   CHECK(2 == count("\"name\": \"compile\""));
+   CHECK(1 == count("\"name\": \"reload\""));
+   CHECK(count("\"name\": \"batch chunk\"") >= 1);
+   // the parse and compile of an expression share its id
+   char id[32];
+   std::snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(trace_id("x * exp(-k*t) + y")));
+   CHECK(2 == count(id));
+#endif
+   CHECK(0 == trace.find("{\"displayTimeUnit\""));
+   CHECK(chrome_trace().find("\"ph\": \"X\"") == std::string::npos); // drained
+}
+
+TEST_CASE("Testing static cost analysis")
+{
+   using namespace mep;
+   AST* ast = Parser().parse("x * y + exp(sin(z) ^ 3) - -x + +w");
+   ExpressionAnalysis analysis = analyze(ast);
+   CHECK(15 == analysis.nb_nodes);
+   CHECK(7 == analysis.depth); // + - + exp ^ sin z
+   CHECK(std::set<std::string>{ "w", "x", "y", "z" } == analysis.variables);
+   CHECK(5 == analysis.operations[Program::Var]);
+   CHECK(1 == analysis.operations[Program::Const]);
+   CHECK(2 == analysis.operations[Program::Add]);
+   CHECK(1 == analysis.operations[Program::Sub]);
+   CHECK(1 == analysis.operations[Program::Mul]);
+   CHECK(1 == analysis.operations[Program::Pow]);
+   CHECK(3 == analysis.operations[Program::Call]); // +w compiles to nothing
+   CHECK(1 == analysis.functions[FunctionId::Sin]);
+   CHECK(1 == analysis.functions[FunctionId::Negate]);
+   CHECK(1 == analysis.functions[FunctionId::Identity]);
+   // the estimate is the one of the compiled form
+   CHECK(analysis.cycles > 0);
+   CHECK(doctest::Approx(analysis.cycles) == estimate_cycles(compile(ast)));
+   const std::string report = analysis.report();
+   CHECK(0 == report.find("nodes 15, depth 7\nvariables 4 : w x y z\n"));
+   CHECK(report.find("sin 1") != std::string::npos);
+
+   // n-ary nodes cost per operand, functions more than arithmetic
+   AST* sum = flatten(Parser().parse("a + b + c + d"));
+   ExpressionAnalysis flat = analyze(sum);
+   CHECK(1 == flat.operations[Program::Sum]);
+   CHECK(2 == flat.depth);
+   CHECK(doctest::Approx(flat.cycles) == estimate_cycles(compile(sum)));
+   AST* cheap = Parser().parse("a + b");
+   AST* costly = Parser().parse("exp(a) + b");
+   CHECK(analyze(cheap).cycles < analyze(costly).cycles);
+
+   // non ASCII names (negative chars) are variables, as for the compiler
+   AST* latin1 = Parser().parse("\xe9 * 2");
+   ExpressionAnalysis accented = analyze(latin1);
+   CHECK(1 == accented.variables.count("\xe9"));
+   CHECK(1 == accented.operations[Program::Var]);
+   CHECK(doctest::Approx(accented.cycles) == estimate_cycles(compile(latin1)));
+   delete latin1;
+
+   // deep trees : no recursion
+   std::string deep;
+   for (int i = 0; i < 100000; ++i) deep += "sin(";
+   deep += "x" + std::string(100000, ')');
+   ParserLimits unlimited;
+   unlimited.max_depth = unlimited.max_nodes = static_cast<size_t>(-1);
+   AST* chain = Parser(unlimited).parse(deep);
+   CHECK(100001 == analyze(chain).depth);
+   delete chain;
+   delete costly;
+   delete cheap;
+   delete sum;
+   delete ast;
+}
+
+TEST_CASE("Testing tiered execution")
+{
+   using namespace mep;
+   ThreadPool pool(1); // outlives the expressions
+   Expression::Policy policy;
+   policy.bytecode_after = 10;
+   policy.optimize_after = 50;
+   policy.pool = &pool;
+   Expression expr("x * exp(-k*t) + 2 * 3 + y ^ 1 + z ^ 0", policy);
+   CHECK(std::vector<std::string>{ "x", "k", "t", "y", "z" } == expr.variables());
+   auto expected = [](number_t x) { return x * std::exp(-0.5 * 2) + 6 + 4 + 1; };
+
+   CHECK(Expression::TREE == expr.tier());
+   for (int i = 1; i < 10; ++i) {
+      CHECK(doctest::Approx(expected(i)) == expr.evaluate({ {"x", i}, {"k", 0.5}, {"t", 2}, {"y", 4} }));
+   }
+   expr.wait();
+   CHECK(Expression::TREE == expr.tier());
+   expr.evaluate({ {"x", 10} }); // 10th
+   expr.wait();
+   CHECK(Expression::BYTECODE == expr.tier());
+   // the optimized form drops z (z ^ 0 == 1) : the values are reordered
+   const number_t values[] = { 3, 0.5, 2, 4, 123 };
+   for (int i = 11; i <= 50; ++i) {
+      CHECK(doctest::Approx(expected(3)) == expr.evaluate(values));
+   }
+   expr.wait();
+   CHECK(Expression::OPTIMIZED == expr.tier());
+   CHECK(50 == expr.nb_evaluations());
+   CHECK(doctest::Approx(expected(3)) == expr.evaluate(values));
+   CHECK(50 == expr.nb_evaluations()); // no longer counted
+
+   // promoted while evaluated from several threads
+   Expression shared("a * b + sin(a)", policy);
+   std::atomic<int> mismatches{ 0 };
+   std::vector<std::thread> threads;
+   for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&shared, &mismatches, t]() {
+         for (int i = 0; i < 1000; ++i) {
+            number_t a = t + i * 0.001;
+            if (shared.evaluate({ {"a", a}, {"b", 2} }) != a * 2 + std::sin(a)) ++mismatches;
+         }
+      });
+   }
+   for (std::thread& thread : threads) thread.join();
+   shared.wait();
+   CHECK(0 == mismatches);
+   CHECK(Expression::OPTIMIZED == shared.tier());
+
+   policy.start = Expression::BYTECODE;
+   Expression eager("1 + x", policy);
+   CHECK(Expression::BYTECODE == eager.tier());
+   CHECK(3 == eager.evaluate({ {"x", 2} }));
+   CHECK_THROWS_AS(Expression("1 +"), ParserException);
+}
 
 int main_old()
 {
@@ -166,7 +1111,7 @@ int main_old()
       std::cout << "Evaluating: " << exp << std::endl;
       try {
          Test(exp.c_str());
-         mep::MemTracker::show_mem_stats();
+         mep::show_mem_stats();
       } catch (std::exception& e) {
          std::cout << e.what() << std::endl;
       }
@@ -0,0 +1,31 @@
+// Allocation counting : the global operator new is replaced for the whole process
+// (shared library included on ELF platforms, not across a Windows DLL boundary).
+// Kept alone in this file : inlined next to the containers of the benchmarks, the
+// malloc / free pair of the replacement trips GCC's -Wmismatched-new-delete.
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "bench.hpp"
+
+
+static std::atomic<uint64_t> g_nb_allocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+   g_nb_allocations.fetch_add(1, std::memory_order_relaxed);
+   if (void* p = std::malloc(size ? size : 1)) return p;
+   throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { ::operator delete(p); }
+
+namespace bench {
+
+uint64_t allocation_count()
+{
+   return g_nb_allocations.load(std::memory_order_relaxed);
+}
+
+} // ns
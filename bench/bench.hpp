@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+/* Micro benchmark harness (no external dependency)
+ Each measurement is calibrated (iterations doubled until one run lasts min_time),
+ then repeated : ns/op is the median of the repetitions and the MAD (median absolute
+ deviation) gives the noise. Allocations are counted through the replaced global
+ operator new (see mep_bench.cpp). When available, the hardware counters (see
+ perf_counters.hpp) are read around the repetitions.
+ With a reference kernel, a short burst of it is timed before and after each
+ repetition : the ratio stage / reference of the repetitions cancels the changes of
+ machine speed (frequency scaling, noisy neighbours) for the regression check.
+*/
+
+namespace bench {
+
+// number of calls to the global operator new so far
+uint64_t allocation_count();
+
+struct Options {
+   double min_time{ 0.05 };   // seconds per repetition
+   size_t repetitions{ 5 };
+   std::string filter;        // substring of "workload/stage"
+   std::vector<std::string> only; // exact "workload/stage" names, all if empty
+   double (*reference)(){ nullptr }; // machine speed reference kernel
+};
+
+struct Measurement {
+   std::string workload;
+   std::string stage;
+   uint64_t iterations{ 0 };     // per repetition
+   std::vector<double> samples;  // ns/op of each repetition
+   double ns_per_op{ 0 };        // median
+   double mad{ 0 };              // ns
+   double ops_per_s{ 0 };
+   double bytes_per_s{ 0 };      // source bytes processed
+   double allocs_per_op{ 0 };
+   double nodes_per_op{ 0 };     // AST nodes processed
+   double reference_ns{ 0 };     // median ns per reference call, 0 without reference
+   double relative{ 0 };         // median of ns/op / reference_ns of the repetitions
+   double relative_mad{ 0 };
+   double counters[C_NB_COUNTERS]; // per op, -1 when unavailable
+
+   Measurement()
+   {
+      for (double& c : counters) c = -1;
+   }
+   bool has(Counter c) const { return counters[c] >= 0; }
+   // instructions per cycle, -1 when unavailable
+   double ipc() const
+   {
+      return (has(C_CYCLES) && has(C_INSTRUCTIONS) && counters[C_CYCLES] > 0)
+         ? counters[C_INSTRUCTIONS] / counters[C_CYCLES] : -1;
+   }
+   // counter per AST node, -1 when unavailable
+   double per_node(Counter c) const
+   {
+      return (has(c) && nodes_per_op > 0) ? counters[c] / nodes_per_op : -1;
+   }
+};
+
+inline
+double median(std::vector<double> values)
+{
+   if (values.empty()) return 0;
+   std::sort(values.begin(), values.end());
+   size_t n = values.size();
+   return (n % 2) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+inline
+double median_absolute_deviation(const std::vector<double>& values)
+{
+   double m = median(values);
+   std::vector<double> deviations;
+   deviations.reserve(values.size());
+   for (double v : values) deviations.push_back(v > m ? v - m : m - v);
+   return median(deviations);
+}
+
+// keeps the results alive for the optimizer
+extern volatile double g_sink;
+
+class Runner {
+   Options m_options;
+   std::vector<Measurement> m_results;
+   PerfCounters* m_counters{ nullptr };
+
+   using clock = std::chrono::steady_clock;
+
+   template<class Op>
+   static double time_ns(Op& op, uint64_t iterations)
+   {
+      double acc = 0;
+      auto start = clock::now();
+      for (uint64_t i = 0; i < iterations; ++i) {
+         acc += op();
+      }
+      auto stop = clock::now();
+      g_sink = acc;
+      return std::chrono::duration<double, std::nano>(stop - start).count();
+   }
+
+public:
+   explicit Runner(const Options& options, PerfCounters* counters = nullptr)
+      : m_options(options)
+      , m_counters(counters && counters->available() ? counters : nullptr)
+   {}
+
+   const Options& options() const { return m_options; }
+   const std::vector<Measurement>& results() const { return m_results; }
+
+   bool selected(const std::string& workload, const std::string& stage) const
+   {
+      const std::string name = workload + "/" + stage;
+      if (!m_options.only.empty()
+         && std::find(m_options.only.begin(), m_options.only.end(), name) == m_options.only.end()) {
+         return false;
+      }
+      return name.find(m_options.filter) != std::string::npos;
+   }
+   // false when no stage of the workload can be selected
+   bool selected(const std::string& workload) const
+   {
+      if (m_options.only.empty()) return true;
+      const std::string prefix = workload + "/";
+      for (const std::string& name : m_options.only) {
+         if (name.compare(0, prefix.size(), prefix) == 0) return true;
+      }
+      return false;
+   }
+
+   // op() performs items operations on bytes source bytes and nodes AST nodes,
+   // returns any value
+   template<class Op>
+   void run(const std::string& workload, const std::string& stage, size_t bytes, size_t nodes, size_t items, Op op)
+   {
+      if (!selected(workload, stage)) return;
+      Measurement m;
+      m.workload = workload;
+      m.stage = stage;
+
+      // calibration, also the warm up
+      uint64_t iterations = 1;
+      const double target = m_options.min_time * 1e9;
+      while (true) {
+         double ns = time_ns(op, iterations);
+         if (ns >= target || iterations >= (uint64_t(1) << 40)) break;
+         uint64_t next = (ns < target / 16) ? iterations * 8 : iterations * 2;
+         iterations = next;
+      }
+      m.iterations = iterations;
+
+      // reference bursts of about min_time / 8
+      uint64_t reference_iterations = 0;
+      if (m_options.reference) {
+         reference_iterations = 1;
+         while (time_ns(m_options.reference, reference_iterations) < target / 8
+            && reference_iterations < (uint64_t(1) << 40)) {
+            reference_iterations *= 2;
+         }
+      }
+
+      uint64_t allocs = allocation_count();
+      time_ns(op, 1);
+      m.allocs_per_op = double(allocation_count() - allocs) / items;
+
+      const size_t repetitions = std::max<size_t>(1, m_options.repetitions);
+      std::vector<double> references, relatives;
+      for (size_t r = 0; r < repetitions; ++r) {
+         double before = reference_iterations ? time_ns(m_options.reference, reference_iterations) : 0;
+         if (m_counters) r == 0 ? m_counters->start() : m_counters->resume();
+         m.samples.push_back(time_ns(op, iterations) / (double(iterations) * items));
+         if (m_counters) m_counters->pause();
+         if (reference_iterations) {
+            double after = time_ns(m_options.reference, reference_iterations);
+            references.push_back((before + after) / (2.0 * reference_iterations));
+            relatives.push_back(m.samples.back() / references.back());
+         }
+      }
+      if (m_counters) {
+         m_counters->stop(m.counters);
+         for (double& c : m.counters) {
+            if (c >= 0) c /= double(iterations) * repetitions * items;
+         }
+      }
+      m.nodes_per_op = double(nodes) / items;
+      m.ns_per_op = median(m.samples);
+      if (!references.empty()) {
+         m.reference_ns = median(references);
+         m.relative = median(relatives);
+         m.relative_mad = median_absolute_deviation(relatives);
+      }
+      m.mad = median_absolute_deviation(m.samples);
+      m.ops_per_s = m.ns_per_op > 0 ? 1e9 / m.ns_per_op : 0;
+      m.bytes_per_s = m.ops_per_s * double(bytes) / items;
+      m_results.push_back(std::move(m));
+   }
+};
+
+} // ns
@@ -0,0 +1,174 @@
+#include "calibration.hpp"
+#include "bench.hpp"
+#include "workloads.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mep/mep.hpp>
+
+using namespace mep;
+
+namespace bench {
+
+namespace {
+
+const size_t nb_terms = 16;     // instructions of the measured kind per expression
+const size_t nb_variables = 8;  // x0 .. x7
+
+// nb_terms terms joined by sep, term(i) being the text of term i
+template<class Term>
+std::string repeat(const char* sep, Term term)
+{
+   std::string s;
+   for (size_t i = 0; i < nb_terms; ++i) {
+      if (i) s += sep;
+      s += term(i);
+   }
+   return s;
+}
+
+std::string var(size_t i)
+{
+   return "x" + std::to_string(i % nb_variables);
+}
+
+// n operands joined by op, in parenthesis
+std::string group(const char* op, size_t first, size_t n)
+{
+   std::string s = "(";
+   for (size_t k = 0; k < n; ++k) {
+      if (k) s += op;
+      s += var(first + k);
+   }
+   return s + ")";
+}
+
+// median of the profiled cycles per execution of the op (func) instructions of text
+double measure(const std::string& text, Program::OpCode op, int func, double min_time)
+{
+   std::unique_ptr<AST> ast(flatten(Parser().parse(text)));
+   Profiler profiler(ast.get());
+
+   // variables in ]0, 1[ : inside the domain of every function
+   Random rnd(11);
+   std::vector<number_t> vars(nb_variables * 64);
+   for (number_t& v : vars) v = 0.05 + 0.9 * double(rnd.below(1000)) / 1000;
+
+   using clock = std::chrono::steady_clock;
+   const auto stop = clock::now() + std::chrono::duration<double>(min_time);
+   double acc = 0;
+   for (size_t round = 0; clock::now() < stop; ++round) {
+      for (size_t i = 0; i < 64; ++i) acc += profiler.evaluate(vars.data() + (i + round) % 57);
+   }
+   g_sink = acc;
+
+   const Program& program = profiler.program();
+   std::vector<double> cycles;
+   for (size_t i = 0; i < program.size(); ++i) {
+      const Program::Instr& instr = program.m_code[i];
+      if (instr.op != op || (op == Program::Call && instr.func != func)) continue;
+      const Profiler::Counter& counter = profiler.counter(i);
+      cycles.push_back(double(counter.cycles) / double(std::max<uint64_t>(1, counter.executions)));
+   }
+   return median(cycles);
+}
+
+std::string function_label(size_t func)
+{
+   switch (func) {
+   case FunctionId::Identity: return "Identity (no instruction)";
+   case FunctionId::Negate:   return "Negate";
+   }
+   return mep_function_name(FunctionId(func));
+}
+
+} // ns
+
+void write_cost_table(const CalibrationOptions& options, std::ostream& header)
+{
+   struct Probe {
+      std::string text;
+      Program::OpCode op;
+      int func;
+      std::vector<double> samples;
+   };
+   std::vector<Probe> probes;
+   probes.push_back({ repeat(" + ", [](size_t i) { return std::to_string(i + 1); }), Program::Const, 0, {} });
+   probes.push_back({ repeat(" + ", var), Program::Var, 0, {} });
+   const char* binary[] = { " + ", " - ", " * ", " / ", " % ", " ^ " };
+   for (int op = Program::Add; op <= Program::Pow; ++op) {
+      // terms joined by another operator
+      const char* sep = (op == Program::Mul || op == Program::Div) ? " + " : " * ";
+      const char* text = binary[op - Program::Add];
+      probes.push_back({ repeat(sep, [&](size_t i) { return group(text, 2 * i, 2); }), Program::OpCode(op), 0, {} });
+   }
+   const size_t nary = probes.size(); // sum 4, sum 16, product 4, product 16
+   for (int k = 0; k < 2; ++k) {
+      const char* text = k ? " * " : " + ";
+      const char* sep = k ? " + " : " * ";
+      for (size_t n : { 4, 16 }) {
+         probes.push_back({ repeat(sep, [&](size_t i) { return group(text, i, n); }),
+            k ? Program::Product : Program::Sum, 0, {} });
+      }
+   }
+   const size_t calls = probes.size();
+   for (size_t func = FunctionId::Negate; func < nb_function_ids; ++func) {
+      std::string name = (func == FunctionId::Negate) ? "-" : mep_function_name(FunctionId(func));
+      probes.push_back({ repeat(" + ", [&](size_t i) { return name + "(" + var(i) + ")"; }), Program::Call, int(func), {} });
+   }
+
+   // interleaved passes : a change of machine speed affects every kind alike
+   const size_t nb_passes = 5;
+   for (size_t pass = 0; pass < nb_passes; ++pass) {
+      for (Probe& probe : probes) {
+         probe.samples.push_back(measure(probe.text, probe.op, probe.func, options.min_time / nb_passes));
+      }
+   }
+
+   double opcodes[Program::nb_opcodes] = {};
+   for (size_t i = 0; i < nary; ++i) opcodes[probes[i].op] = median(probes[i].samples);
+   // n-ary : fixed cost + n * operand cost, the operand cost being shared
+   const double sum4 = median(probes[nary].samples), sum16 = median(probes[nary + 1].samples);
+   const double product4 = median(probes[nary + 2].samples), product16 = median(probes[nary + 3].samples);
+   const double operand = std::max(0.0, (sum16 - sum4 + product16 - product4) / 24);
+   opcodes[Program::Sum] = std::max(0.0, sum4 - 4 * operand);
+   opcodes[Program::Product] = std::max(0.0, product4 - 4 * operand);
+   double calls_cycles[nb_function_ids] = {};
+   for (size_t i = calls; i < probes.size(); ++i) calls_cycles[probes[i].func] = median(probes[i].samples);
+
+   header << std::fixed << std::setprecision(1);
+   header << "#pragma once\n"
+             "\n"
+             "// Cost table of the static cost model (see analysis.hpp) : median Profiler cycles\n"
+             "// of each kind of instruction, generated by mep_bench --cost-table (see\n"
+             "// bench/calibration.hpp). Regenerate it rather than edit it.\n"
+             "\n"
+             "namespace mep {\n"
+             "namespace cost_table {\n"
+             "\n"
+             "// by Program::OpCode, Sum and Product also cost operand_cycles per operand\n"
+             "static constexpr double opcode_cycles[] = {\n";
+   for (size_t op = 0; op < Program::nb_opcodes; ++op) {
+      header << "   " << std::setw(6) << opcodes[op] << ", // " << opcode_name(Program::OpCode(op))
+             << (op == Program::Call ? " (see call_cycles)" : "") << "\n";
+   }
+   header << "};\n"
+             "static constexpr double operand_cycles = " << operand << ";\n"
+             "\n"
+             "// Call, by FunctionId\n"
+             "static constexpr double call_cycles[] = {\n";
+   for (size_t func = 0; func < nb_function_ids; ++func) {
+      header << "   " << std::setw(6) << calls_cycles[func] << ", // " << function_label(func) << "\n";
+   }
+   header << "};\n"
+             "\n"
+             "} // ns\n"
+             "} // ns\n";
+}
+
+} // ns
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ostream>
+
+/* Cost model calibration
+ Profiles (see mep/profiler.hpp) expressions repeating one kind of instruction and
+ writes the median cycles of each kind as the mep/cost_table.hpp header, the table of
+ the static cost model (see mep/analysis.hpp). Sum and Product are measured with 4
+ and 16 operands, the difference gives the cost per operand.
+*/
+
+namespace bench {
+
+struct CalibrationOptions {
+   double min_time{ 0.1 };  // seconds of profiling per instruction kind
+};
+
+void write_cost_table(const CalibrationOptions& options, std::ostream& header);
+
+} // ns
@@ -0,0 +1,477 @@
+// Benchmark suite : lexer, parser, evaluators and printer on synthetic workloads
+/*
+ usage : mep_bench [--filter=<workload/stage>] [--min-time=<ms>] [--repetitions=<n>]
+                   [--json[=<file>]] [--no-counters] [--list]
+         mep_bench --matrix[=<file.csv>] [--max-nodes=<n>] [--filter=<axis/stage>] [--min-time=<ms>]
+         mep_bench --check=<baseline.json> [--tolerance=<percent>] [--min-time=<ms>] [--repetitions=<n>]
+         mep_bench --cost-table[=<file.hpp>] [--min-time=<ms>]
+ A baseline is a --json output, see regression.hpp for the comparison.
+ Linux hardware counters (IPC, misses per AST node) are reported when the kernel
+ allows perf_event_open, see perf_counters.hpp.
+*/
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <mep/mep.hpp>
+
+#include "bench.hpp"
+#include "calibration.hpp"
+#include "regression.hpp"
+#include "scaling.hpp"
+#include "workloads.hpp"
+
+
+namespace bench {
+
+volatile double g_sink = 0;
+
+} // ns
+
+
+using namespace mep;
+using bench::Workload;
+using bench::Runner;
+
+namespace {
+
+size_t count_nodes(AST* root)
+{
+   size_t n = 0;
+   std::vector<Node*> todo{ root };
+   while (!todo.empty()) {
+      Node* node = todo.back();
+      todo.pop_back();
+      ++n;
+      for (size_t i = 0; i < node->nb_children(); ++i) todo.push_back(node->child(i));
+   }
+   return n;
+}
+
+// compiled forms of the sources of a workload
+struct Prepared {
+   std::vector<AST*> asts;
+   std::vector<Program> programs;
+   std::vector<std::map<std::string, number_t>> values;
+   std::vector<std::vector<number_t>> slots;
+   size_t nb_nodes{ 0 };
+
+   explicit Prepared(const Workload& workload)
+   {
+      Parser parser;
+      for (const std::string& source : workload.sources) {
+         AST* ast = parser.parse(source);
+         asts.push_back(ast);
+         nb_nodes += count_nodes(ast);
+         programs.push_back(compile(ast));
+         std::map<std::string, number_t> vars;
+         auto names = collect_variables(source);
+         for (size_t i = 0; i < names.value().size(); ++i) {
+            vars[std::string(names.value()[i])] = 1 + (i % 7) * 0.25;
+         }
+         std::vector<number_t> slot_values(programs.back().nb_variables(), 1);
+         for (const auto& var : vars) {
+            int slot = programs.back().slot(var.first);
+            if (slot >= 0) slot_values[slot] = var.second;
+         }
+         values.push_back(std::move(vars));
+         slots.push_back(std::move(slot_values));
+      }
+   }
+   ~Prepared()
+   {
+      for (AST* ast : asts) delete ast;
+   }
+   Prepared(const Prepared&) = delete;
+   Prepared& operator=(const Prepared&) = delete;
+};
+
+void run_workload(Runner& runner, const Workload& w)
+{
+   if (!runner.selected(w.name)) return;
+   const size_t nb = w.sources.size();
+   const size_t bytes = w.bytes();
+   Prepared prep(w);
+   const size_t nodes = prep.nb_nodes;
+
+   runner.run(w.name, "lex", bytes, nodes, 1, [&]() {
+      size_t count = 0;
+      for (const std::string& source : w.sources) {
+         Lexer lexer;
+         lexer.init(source);
+         while (lexer.next_lexeme().tag != T_EOF) ++count;
+      }
+      return double(count);
+   });
+
+   runner.run(w.name, "validate", bytes, nodes, 1, [&]() {
+      size_t errors = 0;
+      for (const std::string& source : w.sources) {
+         errors += validate(source).kind;
+      }
+      return double(errors);
+   });
+
+   Parser parser;
+   runner.run(w.name, "parse", bytes, nodes, 1, [&]() {
+      for (const std::string& source : w.sources) {
+         delete parser.parse(source);
+      }
+      return double(nb);
+   });
+
+   runner.run(w.name, "compile", bytes, nodes, 1, [&]() {
+      size_t size = 0;
+      for (AST* ast : prep.asts) size += compile(ast).size();
+      return double(size);
+   });
+
+   runner.run(w.name, "print", bytes, nodes, 1, [&]() {
+      size_t size = 0;
+      BeautifingVisitor printer;
+      for (AST* ast : prep.asts) size += printer.collect(ast).size();
+      return double(size);
+   });
+
+   std::vector<EvaluteVisitor> visitors(nb);
+   for (size_t i = 0; i < nb; ++i) {
+      for (const auto& var : prep.values[i]) visitors[i].set(var.first, var.second);
+   }
+   runner.run(w.name, "eval.visitor", bytes, nodes, 1, [&]() {
+      double acc = 0;
+      for (size_t i = 0; i < nb; ++i) acc += visitors[i].collect(prep.asts[i]);
+      return acc;
+   });
+
+   runner.run(w.name, "eval.checked", bytes, nodes, 1, [&]() {
+      double acc = 0;
+      for (size_t i = 0; i < nb; ++i) acc += try_evaluate(prep.asts[i], prep.values[i]).value();
+      return acc;
+   });
+
+   std::vector<std::vector<number_t>> regs(nb);
+   for (size_t i = 0; i < nb; ++i) regs[i].resize(prep.programs[i].size());
+   runner.run(w.name, "eval.program", bytes, nodes, 1, [&]() {
+      double acc = 0;
+      for (size_t i = 0; i < nb; ++i) acc += prep.programs[i].evaluate(prep.slots[i].data(), regs[i].data());
+      return acc;
+   });
+
+   // one variable changed between two evaluations
+   std::vector<IncrementalEvaluator> incrementals;
+   for (size_t i = 0; i < nb; ++i) {
+      incrementals.emplace_back(prep.programs[i]);
+      for (size_t s = 0; s < prep.slots[i].size(); ++s) incrementals.back().set(s, prep.slots[i][s]);
+   }
+   uint64_t toggle = 0;
+   runner.run(w.name, "eval.incremental", bytes, nodes, 1, [&]() {
+      double acc = 0;
+      ++toggle;
+      for (IncrementalEvaluator& incr : incrementals) {
+         if (incr.program().nb_variables()) incr.set(size_t(0), 1 + (toggle & 1));
+         acc += incr.evaluate();
+      }
+      return acc;
+   });
+
+   // per row
+   const size_t nb_rows = 1024;
+   std::vector<std::unique_ptr<BatchEvaluator>> batches;
+   std::vector<std::vector<number_t>> columns;
+   std::vector<number_t> out(nb_rows);
+   for (size_t i = 0; i < nb; ++i) {
+      batches.emplace_back(new BatchEvaluator(prep.programs[i]));
+      size_t k = 0;
+      for (const auto& var : prep.values[i]) {
+         std::vector<number_t> column(nb_rows);
+         for (size_t r = 0; r < nb_rows; ++r) column[r] = var.second + 0.001 * ((r + k) % 13);
+         columns.push_back(std::move(column));
+         batches.back()->bind_column(var.first, columns.back().data());
+         ++k;
+      }
+   }
+   runner.run(w.name, "eval.batch", bytes * nb_rows, nodes * nb_rows, nb_rows, [&]() {
+      double acc = 0;
+      for (auto& batch : batches) {
+         batch->evaluate(nb_rows, out.data());
+         acc += out[0];
+      }
+      return acc;
+   });
+}
+
+void print_counter(double value, int precision)
+{
+   if (value < 0) {
+      std::cout << std::setw(12) << "-";
+   } else {
+      std::cout << std::setw(12) << std::setprecision(precision) << value;
+   }
+}
+
+void print_table(const std::vector<bench::Measurement>& results, bool counters)
+{
+   std::cout << std::left << std::setw(34) << "benchmark"
+             << std::right << std::setw(14) << "ns/op"
+             << std::setw(10) << "+/-%"
+             << std::setw(14) << "ops/s"
+             << std::setw(12) << "MB/s"
+             << std::setw(12) << "allocs/op";
+   if (counters) {
+      std::cout << std::setw(12) << "IPC"
+                << std::setw(12) << "br-miss/nd"
+                << std::setw(12) << "L1-miss/nd"
+                << std::setw(12) << "LLC-miss/nd";
+   }
+   std::cout << std::endl;
+   for (const bench::Measurement& m : results) {
+      std::cout << std::left << std::setw(34) << (m.workload + "/" + m.stage) << std::right
+                << std::fixed << std::setprecision(1)
+                << std::setw(14) << m.ns_per_op
+                << std::setw(10) << (m.ns_per_op > 0 ? 100 * m.mad / m.ns_per_op : 0)
+                << std::setprecision(0)
+                << std::setw(14) << m.ops_per_s
+                << std::setprecision(1)
+                << std::setw(12) << m.bytes_per_s / 1e6
+                << std::setw(12) << m.allocs_per_op;
+      if (counters) {
+         print_counter(m.ipc(), 2);
+         print_counter(m.per_node(bench::C_BRANCH_MISSES), 3);
+         print_counter(m.per_node(bench::C_L1D_MISSES), 3);
+         print_counter(m.per_node(bench::C_LLC_MISSES), 4);
+      }
+      std::cout << std::endl;
+   }
+}
+
+void write_json(std::ostream& os, const std::vector<bench::Measurement>& results)
+{
+   os << "{\n  \"results\": [\n";
+   for (size_t i = 0; i < results.size(); ++i) {
+      const bench::Measurement& m = results[i];
+      os << "    {\"workload\": \"" << m.workload << "\", \"stage\": \"" << m.stage << "\""
+         << std::setprecision(6)
+         << ", \"ns_per_op\": " << m.ns_per_op
+         << ", \"mad_ns\": " << m.mad
+         << ", \"ops_per_s\": " << m.ops_per_s
+         << ", \"bytes_per_s\": " << m.bytes_per_s
+         << ", \"allocs_per_op\": " << m.allocs_per_op
+         << ", \"nodes_per_op\": " << m.nodes_per_op
+         << ", \"iterations\": " << m.iterations;
+      if (m.reference_ns > 0) {
+         os << ", \"reference_ns\": " << m.reference_ns
+            << ", \"relative\": " << m.relative
+            << ", \"relative_mad\": " << m.relative_mad;
+      }
+      os << ", \"samples\": [";
+      for (size_t s = 0; s < m.samples.size(); ++s) {
+         os << (s ? ", " : "") << m.samples[s];
+      }
+      os << "], \"counters\": {";
+      bool first = true;
+      for (int c = 0; c < bench::C_NB_COUNTERS; ++c) {
+         if (!m.has(bench::Counter(c))) continue;
+         os << (first ? "" : ", ") << "\"" << bench::counter_name(bench::Counter(c)) << "\": " << m.counters[c];
+         first = false;
+      }
+      if (m.ipc() >= 0) os << (first ? "" : ", ") << "\"ipc\": " << m.ipc();
+      os << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+   }
+   os << "  ]\n}\n";
+}
+
+// Machine speed reference, independent of mep : integer, floating point and cache
+// work in fixed proportions. Timed around the repetitions of --json and --check runs
+double reference_kernel()
+{
+   static const std::vector<uint32_t> table = []() {
+      std::vector<uint32_t> t(1 << 16);
+      bench::Random rnd(42);
+      for (uint32_t& v : t) v = static_cast<uint32_t>(rnd.next());
+      return t;
+   }();
+   bench::Random rnd(7);
+   double acc = 1;
+   for (int i = 0; i < 4096; ++i) {
+      uint64_t x = rnd.next();
+      acc = acc * 0.999 + table[x & 0xffff] * 1e-9 + std::sqrt(double(x >> 40));
+   }
+   return acc;
+}
+
+std::vector<bench::Measurement> run_suite(const bench::Options& options, bench::PerfCounters* perf)
+{
+   Runner runner(options, perf);
+   for (const Workload& w : bench::standard_workloads()) {
+      run_workload(runner, w);
+   }
+   return runner.results();
+}
+
+// regression gate : 0 when no stage of the baseline is slower than tolerated
+int check_baseline(bench::Options options, const std::string& path, double tolerance)
+{
+   const std::vector<bench::Baseline> baseline = bench::load_baseline(path);
+   if (baseline.empty()) {
+      std::cerr << "No baseline in " << path << std::endl;
+      return EXIT_FAILURE;
+   }
+   options.reference = reference_kernel;
+   for (const bench::Baseline& b : baseline) options.only.push_back(b.name());
+   std::vector<std::string> regressed = bench::find_regressions(baseline, run_suite(options, nullptr), tolerance, std::cout);
+   if (!regressed.empty()) {
+      // a noisy neighbour is more likely than a regression : measure those again
+      std::cout << std::endl << regressed.size() << " regression(s), measuring them again" << std::endl;
+      std::vector<bench::Baseline> suspects;
+      for (const bench::Baseline& b : baseline) {
+         if (std::find(regressed.begin(), regressed.end(), b.name()) != regressed.end()) {
+            suspects.push_back(b);
+         }
+      }
+      options.only = regressed;
+      regressed = bench::find_regressions(suspects, run_suite(options, nullptr), tolerance, std::cout);
+   }
+   std::cout << std::endl << (regressed.empty() ? "No performance regression" : "PERFORMANCE REGRESSION")
+             << " (tolerance " << tolerance << "%)" << std::endl;
+   return regressed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool option(const char* arg, const char* name, std::string& value)
+{
+   size_t n = std::strlen(name);
+   if (std::strncmp(arg, name, n) != 0) return false;
+   if (arg[n] == '\0') { value.clear(); return true; }
+   if (arg[n] != '=') return false;
+   value = arg + n + 1;
+   return true;
+}
+
+} // ns
+
+
+int main(int argc, char* argv[])
+{
+   bench::Options options;
+   bool json = false, list = false, counters = true, matrix = false, cost_table = false;
+   std::string json_path, csv_path, check_path, header_path, value;
+   double tolerance = 25;
+   bench::MatrixOptions matrix_options;
+   for (int i = 1; i < argc; ++i) {
+      if (option(argv[i], "--filter", value)) {
+         options.filter = value;
+      } else if (option(argv[i], "--min-time", value)) {
+         options.min_time = std::atof(value.c_str()) / 1000;
+      } else if (option(argv[i], "--repetitions", value)) {
+         options.repetitions = std::strtoul(value.c_str(), nullptr, 10);
+      } else if (option(argv[i], "--json", value)) {
+         json = true;
+         json_path = value;
+      } else if (option(argv[i], "--list", value)) {
+         list = true;
+      } else if (option(argv[i], "--no-counters", value)) {
+         counters = false;
+      } else if (option(argv[i], "--matrix", value)) {
+         matrix = true;
+         csv_path = value;
+      } else if (option(argv[i], "--check", value) && !value.empty()) {
+         check_path = value;
+      } else if (option(argv[i], "--tolerance", value)) {
+         tolerance = std::atof(value.c_str());
+      } else if (option(argv[i], "--max-nodes", value)) {
+         matrix_options.max_nodes = std::strtoul(value.c_str(), nullptr, 10);
+      } else if (option(argv[i], "--cost-table", value)) {
+         cost_table = true;
+         header_path = value;
+      } else {
+         std::cerr << "usage : mep_bench [--filter=<workload/stage>] [--min-time=<ms>] "
+                      "[--repetitions=<n>] [--json[=<file>]] [--no-counters] [--list]\n"
+                      "       mep_bench --matrix[=<file.csv>] [--max-nodes=<n>] [--filter=<axis/stage>] "
+                      "[--min-time=<ms>]\n"
+                      "       mep_bench --check=<baseline.json> [--tolerance=<percent>] "
+                      "[--min-time=<ms>] [--repetitions=<n>]\n"
+                      "       mep_bench --cost-table[=<file.hpp>] [--min-time=<ms>]" << std::endl;
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (matrix) {
+      matrix_options.min_time = options.min_time;
+      matrix_options.filter = options.filter;
+      if (csv_path.empty()) {
+         bench::run_scaling_matrix(matrix_options, std::cout);
+      } else {
+         std::ofstream csv(csv_path);
+         bench::run_scaling_matrix(matrix_options, csv);
+         if (!csv) {
+            std::cerr << "Cannot write " << csv_path << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+      return EXIT_SUCCESS;
+   }
+
+   if (cost_table) {
+      bench::CalibrationOptions calibration;
+      calibration.min_time = options.min_time * 2;
+      if (header_path.empty()) {
+         bench::write_cost_table(calibration, std::cout);
+      } else {
+         std::ofstream header(header_path);
+         bench::write_cost_table(calibration, header);
+         if (!header) {
+            std::cerr << "Cannot write " << header_path << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+      return EXIT_SUCCESS;
+   }
+
+   if (!check_path.empty()) {
+      return check_baseline(options, check_path, tolerance);
+   }
+
+   const std::vector<Workload> workloads = bench::standard_workloads();
+   if (list) {
+      for (const Workload& w : workloads) {
+         std::cout << w.name << " : " << w.sources.size() << " source(s), " << w.bytes() << " bytes" << std::endl;
+      }
+      return EXIT_SUCCESS;
+   }
+
+   std::unique_ptr<bench::PerfCounters> perf;
+   if (counters) {
+      perf.reset(new bench::PerfCounters());
+      if (!perf->available()) {
+         std::cerr << "note : hardware counters unavailable (perf_event_open refused), timing only" << std::endl;
+         perf.reset();
+      }
+   }
+   if (json) options.reference = reference_kernel; // usable as a --check baseline
+   const std::vector<bench::Measurement> results = run_suite(options, perf.get());
+
+   if (!json || !json_path.empty()) {
+      print_table(results, perf != nullptr);
+   }
+   if (json) {
+      if (json_path.empty()) {
+         write_json(std::cout, results);
+      } else {
+         std::ofstream out(json_path);
+         write_json(out, results);
+         if (!out) {
+            std::cerr << "Cannot write " << json_path << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Hardware performance counters (Linux perf_event_open)
+ Counts user space events of the calling thread around a measured region. Every
+ counter is opened on its own : the ones refused by the kernel, the hardware or the
+ container (perf_event_paranoid, seccomp, virtual machines) are reported unavailable
+ and the others still work. Elsewhere than on Linux nothing is available.
+ Values are scaled when the kernel multiplexes the counters.
+*/
+
+namespace bench {
+
+enum Counter {
+   C_CYCLES,
+   C_INSTRUCTIONS,
+   C_BRANCH_MISSES,
+   C_L1D_MISSES,    // L1 data cache read misses
+   C_LLC_MISSES,    // last level cache misses
+   C_NB_COUNTERS
+};
+
+inline
+const char* counter_name(Counter c)
+{
+   switch (c) {
+   case C_CYCLES: return "cycles";
+   case C_INSTRUCTIONS: return "instructions";
+   case C_BRANCH_MISSES: return "branch_misses";
+   case C_L1D_MISSES: return "l1d_misses";
+   case C_LLC_MISSES: return "llc_misses";
+   default: break;
+   }
+   return "?";
+}
+
+class PerfCounters {
+   int m_fd[C_NB_COUNTERS];
+
+#if defined(__linux__)
+   static int open_counter(uint32_t type, uint64_t config)
+   {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      long fd = syscall(__NR_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */, -1, 0);
+      return static_cast<int>(fd);
+   }
+#endif
+
+   void enable(bool on)
+   {
+#if defined(__linux__)
+      for (int fd : m_fd) {
+         if (fd >= 0) ioctl(fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+      }
+#else
+      (void)on;
+#endif
+   }
+
+public:
+   PerfCounters()
+   {
+      for (int& fd : m_fd) fd = -1;
+#if defined(__linux__)
+      m_fd[C_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      m_fd[C_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      m_fd[C_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+      m_fd[C_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+         | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+      m_fd[C_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+   }
+   ~PerfCounters()
+   {
+#if defined(__linux__)
+      for (int fd : m_fd) {
+         if (fd >= 0) close(fd);
+      }
+#endif
+   }
+   PerfCounters(const PerfCounters&) = delete;
+   PerfCounters& operator=(const PerfCounters&) = delete;
+
+   bool available(Counter c) const { return m_fd[c] >= 0; }
+   bool available() const
+   {
+      for (int fd : m_fd) {
+         if (fd >= 0) return true;
+      }
+      return false;
+   }
+
+   void start()
+   {
+#if defined(__linux__)
+      for (int fd : m_fd) {
+         if (fd < 0) continue;
+         ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+         ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+   }
+
+   // pause() / resume() exclude work from the counts
+   void pause() { enable(false); }
+   void resume() { enable(true); }
+
+   // counts since start(), -1 for the unavailable counters
+   void stop(double values[C_NB_COUNTERS])
+   {
+      for (int c = 0; c < C_NB_COUNTERS; ++c) {
+         values[c] = -1;
+#if defined(__linux__)
+         int fd = m_fd[c];
+         if (fd < 0) continue;
+         ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+         uint64_t data[3] = { 0, 0, 0 }; // value, time enabled, time running
+         if (read(fd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[2] == 0) continue;
+         values[c] = static_cast<double>(data[0]) * (static_cast<double>(data[1]) / static_cast<double>(data[2]));
+#endif
+      }
+   }
+};
+
+} // ns
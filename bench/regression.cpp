@@ -0,0 +1,85 @@
+#include "regression.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+
+namespace bench {
+
+namespace {
+
+// value of "key": in a line of the --json output
+bool find_string(const std::string& line, const std::string& key, std::string& value)
+{
+   size_t pos = line.find("\"" + key + "\": \"");
+   if (pos == std::string::npos) return false;
+   pos += key.size() + 5;
+   size_t end = line.find('"', pos);
+   if (end == std::string::npos) return false;
+   value = line.substr(pos, end - pos);
+   return true;
+}
+
+bool find_number(const std::string& line, const std::string& key, double& value)
+{
+   size_t pos = line.find("\"" + key + "\": ");
+   if (pos == std::string::npos) return false;
+   value = std::strtod(line.c_str() + pos + key.size() + 4, nullptr);
+   return true;
+}
+
+} // ns
+
+std::vector<Baseline> load_baseline(const std::string& path)
+{
+   std::vector<Baseline> baseline;
+   std::ifstream in(path);
+   std::string line;
+   while (std::getline(in, line)) { // one result per line
+      Baseline b;
+      if (find_string(line, "workload", b.workload) && find_string(line, "stage", b.stage)
+         && find_number(line, "ns_per_op", b.ns_per_op)) {
+         find_number(line, "mad_ns", b.mad);
+         find_number(line, "relative", b.relative);
+         find_number(line, "relative_mad", b.relative_mad);
+         baseline.push_back(b);
+      }
+   }
+   return baseline;
+}
+
+std::vector<std::string> find_regressions(const std::vector<Baseline>& baseline,
+   const std::vector<Measurement>& results, double tolerance, std::ostream& report)
+{
+   std::vector<std::string> regressed;
+   report << std::left << std::setw(34) << "benchmark" << std::right
+          << std::setw(14) << "baseline" << std::setw(14) << "current"
+          << std::setw(10) << "delta %" << std::setw(10) << "limit %" << "  status" << std::endl;
+   for (const Baseline& b : baseline) {
+      auto it = std::find_if(results.begin(), results.end(), [&](const Measurement& m) {
+         return m.workload == b.workload && m.stage == b.stage;
+      });
+      if (it == results.end()) {
+         report << std::left << std::setw(34) << b.name() << std::right << std::setw(14) << "-"
+                << std::setw(14) << "-" << std::setw(10) << "-" << std::setw(10) << "-" << "  missing" << std::endl;
+         continue;
+      }
+      // relative costs when both runs have them, else ns/op
+      const bool relative = b.relative > 0 && it->relative > 0;
+      const double expected = relative ? b.relative : b.ns_per_op;
+      const double current = relative ? it->relative : it->ns_per_op;
+      const double noise = 3 * 1.4826 * (relative ? std::max(b.relative_mad, it->relative_mad) : std::max(b.mad, it->mad));
+      const double limit = expected * (1 + tolerance / 100) + noise;
+      const bool slower = current > limit;
+      report << std::left << std::setw(34) << b.name() << std::right << std::setprecision(4)
+             << std::setw(14) << expected << std::setw(14) << current << std::fixed << std::setprecision(1)
+             << std::setw(10) << 100 * (current - expected) / expected
+             << std::setw(10) << 100 * (limit - expected) / expected
+             << (slower ? "  REGRESSION" : "  ok") << std::defaultfloat << std::setprecision(6) << std::endl;
+      if (slower) regressed.push_back(b.name());
+   }
+   return regressed;
+}
+
+} // ns
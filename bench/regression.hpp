@@ -0,0 +1,40 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+
+/* Performance regression check against stored baselines
+ The baseline is a mep_bench --json output. Both runs time the reference kernel
+ around each repetition (see bench.hpp) : the stages are compared through their
+ relative cost (ns/op / reference ns), which cancels the speed difference between
+ machines, or between a quiet and a loaded machine. Without reference in the
+ baseline, the absolute ns/op are compared.
+ A stage regresses when its median is above the baseline median by more than the
+ tolerance plus the noise, the noise being estimated from the MAD of both runs
+ (3 sigma, sigma ~ 1.4826 MAD).
+*/
+
+namespace bench {
+
+struct Baseline {
+   std::string workload;
+   std::string stage;
+   double ns_per_op{ 0 };
+   double mad{ 0 };
+   double relative{ 0 };     // 0 when the baseline was measured without reference
+   double relative_mad{ 0 };
+
+   std::string name() const { return workload + "/" + stage; }
+};
+
+// empty if the file cannot be read or holds no result
+std::vector<Baseline> load_baseline(const std::string& path);
+
+// names ("workload/stage") of the regressed measurements, writes a report
+std::vector<std::string> find_regressions(const std::vector<Baseline>& baseline,
+   const std::vector<Measurement>& results, double tolerance, std::ostream& report);
+
+} // ns
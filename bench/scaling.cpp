@@ -0,0 +1,248 @@
+#include "scaling.hpp"
+#include "bench.hpp"
+#include "workloads.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <mep/mep.hpp>
+
+using namespace mep;
+
+namespace bench {
+
+void reset_peak_rss()
+{
+#if defined(__linux__)
+   std::ofstream clear("/proc/self/clear_refs");
+   clear << "5"; // resets VmHWM (Linux 4.0+), silently ignored if refused
+#endif
+}
+
+long peak_rss_kb()
+{
+#if defined(__linux__)
+   std::ifstream status("/proc/self/status");
+   std::string line;
+   while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmHWM:") == 0) {
+         return std::atol(line.c_str() + 6);
+      }
+   }
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+   rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+      return static_cast<long>(usage.ru_maxrss / 1024); // bytes
+#else
+      return static_cast<long>(usage.ru_maxrss);
+#endif
+   }
+#endif
+   return 0;
+}
+
+namespace {
+
+// (a op b) combined pair by pair up to the root : height log2(nb_leaves)
+std::string balanced(size_t nb_leaves, size_t nb_variables, uint64_t seed)
+{
+   static const char* ops[] = { " + ", " - ", " * ", " / " };
+   Random rnd(seed);
+   std::vector<std::string> level;
+   level.reserve(nb_leaves);
+   for (size_t i = 0; i < nb_leaves; ++i) {
+      if (nb_variables && (i % 4 != 3)) {
+         level.push_back("v" + std::to_string(i % nb_variables));
+      } else {
+         level.push_back(std::to_string(1 + rnd.below(9)));
+      }
+   }
+   while (level.size() > 1) {
+      std::vector<std::string> next;
+      next.reserve((level.size() + 1) / 2);
+      for (size_t i = 0; i + 1 < level.size(); i += 2) {
+         next.push_back("(" + level[i] + ops[rnd.below(4)] + level[i + 1] + ")");
+      }
+      if (level.size() % 2) next.push_back(level.back());
+      level.swap(next);
+   }
+   return level.empty() ? std::string("1") : level[0];
+}
+
+struct Point {
+   std::string axis;
+   size_t nodes;
+   size_t depth;
+   size_t variables;
+   size_t threads;
+   std::string source;
+};
+
+struct Row {
+   std::string stage;
+   double ns_per_op;
+   double allocs_per_op;
+   long peak_rss_kb;
+};
+
+size_t tree_height(AST* root, size_t& nb_nodes)
+{
+   size_t height = 0;
+   std::vector<std::pair<Node*, size_t>> todo{ { root, 1 } };
+   nb_nodes = 0;
+   while (!todo.empty()) {
+      auto [node, h] = todo.back();
+      todo.pop_back();
+      ++nb_nodes;
+      height = std::max(height, h);
+      for (size_t i = 0; i < node->nb_children(); ++i) todo.emplace_back(node->child(i), h + 1);
+   }
+   return height;
+}
+
+class Matrix {
+   MatrixOptions m_options;
+   std::ostream& m_csv;
+   ParserLimits m_limits;
+
+   using clock = std::chrono::steady_clock;
+
+   // repeats op() on every thread until min_time elapsed : ns per op over all threads
+   template<class Op>
+   Row measure(const std::string& stage, size_t nb_threads, Op make_op)
+   {
+      Row row{ stage, 0, 0, 0 };
+      reset_peak_rss();
+      uint64_t allocs = allocation_count();
+      std::vector<uint64_t> counts(nb_threads, 0);
+      std::vector<double> sinks(nb_threads, 0);
+      auto body = [&](size_t t) {
+         auto op = make_op();
+         auto start = clock::now();
+         do {
+            sinks[t] += op();
+            ++counts[t];
+         } while (std::chrono::duration<double>(clock::now() - start).count() < m_options.min_time);
+      };
+      auto start = clock::now();
+      if (nb_threads == 1) {
+         body(0);
+      } else {
+         std::vector<std::thread> threads;
+         for (size_t t = 0; t < nb_threads; ++t) threads.emplace_back(body, t);
+         for (std::thread& th : threads) th.join();
+      }
+      double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+      uint64_t total = 0;
+      for (size_t t = 0; t < nb_threads; ++t) {
+         total += counts[t];
+         g_sink = sinks[t];
+      }
+      row.ns_per_op = ns / double(total);
+      row.allocs_per_op = double(allocation_count() - allocs) / double(total);
+      row.peak_rss_kb = peak_rss_kb();
+      return row;
+   }
+
+   void write(const Point& p, const Row& row)
+   {
+      double nodes_per_s = row.ns_per_op > 0 ? 1e9 * double(p.nodes) / row.ns_per_op : 0;
+      m_csv << p.axis << ',' << p.nodes << ',' << p.depth << ',' << p.variables << ',' << p.threads
+            << ',' << row.stage
+            << ',' << std::fixed << std::setprecision(1) << row.ns_per_op
+            << ',' << std::setprecision(0) << nodes_per_s
+            << ',' << std::setprecision(1) << row.allocs_per_op
+            << ',' << row.peak_rss_kb << std::endl;
+   }
+
+   bool selected(const Point& p, const std::string& stage) const
+   {
+      return (p.axis + "/" + stage).find(m_options.filter) != std::string::npos;
+   }
+
+   void run(Point p)
+   {
+      Parser parser(m_limits);
+      AST* ast = parser.parse(p.source);
+      p.depth = tree_height(ast, p.nodes);
+      const Program program = compile(ast);
+      std::vector<number_t> vars(program.nb_variables(), 1.5);
+
+      if (selected(p, "parse")) {
+         write(p, measure("parse", p.threads, [&]() {
+            return [&, parser = std::make_shared<Parser>(m_limits)]() {
+               delete parser->parse(p.source);
+               return 1.0;
+            };
+         }));
+      }
+      if (selected(p, "compile")) {
+         write(p, measure("compile", p.threads, [&]() {
+            return [&]() { return double(compile(ast).size()); };
+         }));
+      }
+      if (selected(p, "eval.visitor")) {
+         write(p, measure("eval.visitor", p.threads, [&]() {
+            return [&, eval = std::make_shared<EvaluteVisitor>()]() { return eval->collect(ast); };
+         }));
+      }
+      if (selected(p, "eval.program")) {
+         write(p, measure("eval.program", p.threads, [&]() {
+            return [&, regs = std::vector<number_t>(program.size())]() mutable {
+               return program.evaluate(vars.data(), regs.data());
+            };
+         }));
+      }
+      delete ast;
+   }
+
+public:
+   Matrix(const MatrixOptions& options, std::ostream& csv)
+      : m_options(options)
+      , m_csv(csv)
+   {
+      m_limits.max_depth = m_limits.max_nodes = static_cast<size_t>(-1);
+   }
+
+   void run_all()
+   {
+      m_csv << "axis,nodes,depth,variables,threads,stage,ns_per_op,nodes_per_s,allocs_per_op,peak_rss_kb" << std::endl;
+      for (size_t nodes = 10; nodes <= m_options.max_nodes; nodes *= 10) {
+         run({ "size", nodes, 0, 8, 1, balanced((nodes + 1) / 2, 8, nodes) });
+      }
+      for (size_t depth = 10; depth <= 10000; depth *= 10) {
+         run({ "depth", 0, depth, 1, 1, deep_nesting(depth) });
+      }
+      for (size_t nb_vars = 1; nb_vars <= 10000; nb_vars *= 10) {
+         run({ "variables", 0, 0, nb_vars, 1, balanced(10000, nb_vars, 5) });
+      }
+      const size_t hw = std::max<unsigned>(1, std::thread::hardware_concurrency());
+      for (size_t threads = 1; ; threads *= 2) {
+         threads = std::min(threads, hw);
+         run({ "threads", 0, 0, 8, threads, balanced(500, 8, 6) });
+         if (threads == hw) break;
+      }
+   }
+};
+
+} // ns
+
+void run_scaling_matrix(const MatrixOptions& options, std::ostream& csv)
+{
+   Matrix(options, csv).run_all();
+}
+
+} // ns
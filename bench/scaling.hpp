@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/* Scalability matrix
+ Parse and evaluation throughput along four axes, one axis varying at a time :
+    size       AST nodes 10 .. 10^6 (balanced trees, 8 variables)
+    depth      parenthesis nesting 10 .. 10^4
+    variables  distinct variables 1 .. 10^4 in a tree of 2.10^4 nodes
+    threads    1 .. hardware concurrency, each thread parsing/evaluating its own copy
+ One CSV row per (axis, point, stage) in a fixed order, with peak RSS and allocations,
+ so that two runs can be diffed.
+*/
+
+namespace bench {
+
+struct MatrixOptions {
+   double min_time{ 0.05 };     // seconds per cell
+   size_t max_nodes{ 1000000 }; // cap of the size axis
+   std::string filter;          // substring of "axis/stage"
+};
+
+// peak resident set size (kB) since the last reset_peak_rss(), when the platform
+// allows the reset (Linux clear_refs), else since the process start ; 0 if unknown
+void reset_peak_rss();
+long peak_rss_kb();
+
+void run_scaling_matrix(const MatrixOptions& options, std::ostream& csv);
+
+} // ns
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Synthetic workloads
+ Generated from a fixed seed with a self contained generator : the same sources on
+ every platform and standard library (std::uniform_*_distribution is not portable).
+*/
+
+namespace bench {
+
+struct Workload {
+   std::string name;
+   std::vector<std::string> sources;
+
+   size_t bytes() const
+   {
+      size_t n = 0;
+      for (const std::string& s : sources) n += s.size();
+      return n;
+   }
+};
+
+// splitmix64
+class Random {
+   uint64_t m_state;
+public:
+   explicit Random(uint64_t seed) : m_state(seed) {}
+   uint64_t next()
+   {
+      uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+   }
+   size_t below(size_t n) { return static_cast<size_t>(next() % n); }
+};
+
+// c0 * x0 + c1 * x1 + ... : a long left deep chain
+inline
+std::string flat_sum(size_t nb_terms, uint64_t seed = 1)
+{
+   Random rnd(seed);
+   std::string s;
+   for (size_t i = 0; i < nb_terms; ++i) {
+      if (i) s += (rnd.below(4) == 0) ? " - " : " + ";
+      s += std::to_string(1 + rnd.below(99)) + " * x" + std::to_string(i % 8);
+   }
+   return s;
+}
+
+// (((x + 1) * 2) - 3) ... : one level of parenthesis per operation
+inline
+std::string deep_nesting(size_t depth, uint64_t seed = 2)
+{
+   static const char ops[] = { '+', '*', '-', '/' };
+   Random rnd(seed);
+   std::string s = "x";
+   for (size_t i = 0; i < depth; ++i) {
+      s = "(" + s + " " + ops[rnd.below(4)] + " " + std::to_string(1 + rnd.below(9)) + ")";
+   }
+   return s;
+}
+
+// sums of function calls
+inline
+std::string transcendental(size_t nb_terms, uint64_t seed = 3)
+{
+   static const char* funcs[] = { "sin", "cos", "exp", "log", "atan", "abs" };
+   Random rnd(seed);
+   std::string s;
+   for (size_t i = 0; i < nb_terms; ++i) {
+      if (i) s += " + ";
+      s += std::string(funcs[rnd.below(6)]) + "(x" + std::to_string(i % 4) + " * " + std::to_string(1 + rnd.below(9)) + ")";
+   }
+   return s;
+}
+
+// every term a distinct variable
+inline
+std::string many_variables(size_t nb_variables, uint64_t seed = 4)
+{
+   static const char* ops[] = { " + ", " - ", " * ", " / " };
+   Random rnd(seed);
+   std::string s;
+   for (size_t i = 0; i < nb_variables; ++i) {
+      if (i) s += ops[rnd.below(4)];
+      s += "v" + std::to_string(i);
+   }
+   return s;
+}
+
+// formulas as found in spreadsheets and rule engines
+inline
+std::vector<std::string> real_world()
+{
+   return {
+      "s * exp(-q * t) * n1 - k * exp(-r * t) * n2",
+      "(log(s / k) + (r - q + v ^ 2 / 2) * t) / (v * t ^ (1 / 2))",
+      "p * (1 + r / 12) ^ (12 * y)",
+      "m * g * h + m * v ^ 2 / 2",
+      "a * sin(2 * pi * f * t + phi) * exp(-d * t)",
+      "abs(x1 - x2) + abs(y1 - y2)",
+      "(tmax - tmin) / (1 + exp(-k * (x - x0))) + tmin",
+      "10 * log10(i / i0)",
+      "atan(y / x) * 180 / pi",
+      "price * qty * (1 - discount / 100) * (1 + vat / 100)",
+   };
+}
+
+inline
+std::vector<Workload> standard_workloads()
+{
+   return {
+      { "flat_sum", { flat_sum(200) } },
+      { "deep_nesting", { deep_nesting(200) } },
+      { "transcendental", { transcendental(64) } },
+      { "many_variables", { many_variables(500) } },
+      { "real_world", real_world() },
+   };
+}
+
+} // ns
@@ -1,11 +1,14 @@
 #pragma once 
 
+#include <cctype>
 #include <iomanip>
 #include <sstream>
 #include <map>
+#include <vector>
 // #include <ostream>
 
 #include <mep/math.hpp>
+#include <mep/mem_stats.hpp>
 
 /*
  ----------------------------
@@ -84,6 +87,7 @@ public:
 
 class UnaryNode;
 class BinaryNode;
+class NaryNode;
 class TerminalNode;
 
 
@@ -92,13 +96,14 @@ class IVisitor {
 public:
    virtual void visit(UnaryNode& node) = 0;
    virtual void visit(BinaryNode& node) = 0;
+   virtual void visit(NaryNode& node) = 0;
    virtual void visit(TerminalNode& node) = 0;
 };
 
 
 
 //----------------------------------------------------------------------------
-class Node : public MemTracker {
+class Node {
 public:
    enum NodeTag  { N_OPERATOR, N_VALUE};
    NodeTag    m_type;
@@ -110,11 +115,45 @@ public:
    {
    }
 
+   // accounted in MEM_AST_NODES (see mem_stats.hpp)
+   static void* operator new(size_t size)
+   {
+      void* p = ::operator new(size);
+      MEP_MEM_ALLOC(MEM_AST_NODES, size);
+      return p;
+   }
+   static void operator delete(void* p, [[maybe_unused]] size_t size)
+   {
+      MEP_MEM_FREE(MEM_AST_NODES, size);
+      ::operator delete(p);
+   }
+
+   // operands, in evaluation order
+   virtual size_t nb_children() const { return 0; }
+   virtual Node* child(size_t) const { return nullptr; }
+   // moves the children out, the node is left childless
+   virtual void detach_children(std::vector<Node*>&) {}
+
    // Travsers the tree with the specified visitor
    void traverse(IVisitor& visitor)
    {
       this->accept(visitor);
    }
+
+protected:
+   // Deletes subtrees without recursion on the tree depth : each node is emptied
+   // of its children before being deleted, its destructor has nothing left to do
+   static void delete_subtrees(std::vector<Node*>& pending)
+   {
+      while (!pending.empty()) {
+         Node* node = pending.back();
+         pending.pop_back();
+         if (node) {
+            node->detach_children(pending);
+            delete node;
+         }
+      }
+   }
 };
 
 // Node specialisations :
@@ -126,9 +165,16 @@ public:
       : Node(N_VALUE)
       , m_value(value)
    {
-      
+      MEP_MEM_STRING_ALLOC(m_value);
+   }
+   ~TerminalNode()
+   {
+      MEP_MEM_STRING_FREE(m_value);
    }
    void accept(IVisitor& visitor) override { visitor.visit(*this); }
+
+   // a literal, else a variable : the lexer starts numbers with a digit
+   bool is_number() const { return ::isdigit(static_cast<unsigned char>(m_value[0])) != 0; }
 };
 
 class OperatorNode : public Node {
@@ -149,10 +195,21 @@ public:
    {
    }
    void accept(IVisitor& visitor) override { visitor.visit(*this); }
+   size_t nb_children() const override { return 1; }
+   Node* child(size_t) const override { return m_child; }
+   void detach_children(std::vector<Node*>& out) override
+   {
+      out.push_back(m_child);
+      m_child = nullptr;
+   }
    
    ~UnaryNode()
    {
-      if (m_child) delete m_child;
+      if (m_child) {
+         std::vector<Node*> pending;
+         detach_children(pending);
+         delete_subtrees(pending);
+      }
    }   
    
    std::string function_name()
@@ -175,13 +232,78 @@ public:
    {
       visitor.visit(*this);
    }
+   size_t nb_children() const override { return 2; }
+   Node* child(size_t i) const override { return i ? m_right : m_left; }
+   void detach_children(std::vector<Node*>& out) override
+   {
+      out.push_back(m_left);
+      out.push_back(m_right);
+      m_left = m_right = nullptr;
+   }
    ~BinaryNode()
    {
-      if (m_left)  delete m_left;
-      if (m_right) delete m_right;
+      if (m_left || m_right) {
+         std::vector<Node*> pending;
+         detach_children(pending);
+         delete_subtrees(pending);
+      }
+   }
+};
+
+// AST n-ary operator : flattened chain of a single associative operator (Add or Mul)
+//    a + b + c + d  ->  +(a, b, c, d)   instead of   +(+(+(a,b),c),d)
+// produced by the flattening pass (see flatten.hpp), never by the parser
+class NaryNode : public OperatorNode {
+public:
+   std::vector<Node*> m_children;
+   NaryNode(Operator& op, std::vector<Node*> children)
+      : OperatorNode(op)
+      , m_children(std::move(children))
+   {
+   }
+   void accept(IVisitor& visitor) override
+   {
+      visitor.visit(*this);
+   }
+   size_t nb_children() const override { return m_children.size(); }
+   Node* child(size_t i) const override { return m_children[i]; }
+   void detach_children(std::vector<Node*>& out) override
+   {
+      out.insert(out.end(), m_children.begin(), m_children.end());
+      m_children.clear();
+   }
+   ~NaryNode()
+   {
+      if (!m_children.empty()) {
+         std::vector<Node*> pending;
+         detach_children(pending);
+         delete_subtrees(pending);
+      }
    }
 };
 
+// Reduce n values with + or * :
+// sequential reduction gives the exact same result as the binary left-deep tree,
+// pairwise reduction keeps the rounding error growth in O(log n) instead of O(n)
+inline
+number_t reduce_values(Operator::Tag op, const number_t* values, size_t n, bool pairwise)
+{
+   const size_t block = 8; // below that, pairwise splitting brings nothing
+   if (!pairwise || n <= block) {
+      number_t acc = values[0];
+      if (op == Operator::Mul) {
+         for (size_t i = 1; i < n; ++i) acc *= values[i];
+      } else {
+         for (size_t i = 1; i < n; ++i) acc += values[i];
+      }
+      return acc;
+   }
+   size_t half = n / 2;
+   number_t l = reduce_values(op, values, half, pairwise);
+   number_t r = reduce_values(op, values + half, n - half, pairwise);
+   return (op == Operator::Mul) ? l * r : l + r;
+}
+
 /*
 * AST traversal with visitor (see https://github.com/agentcooper/cpp-ast-example/tree/main)
        AST
@@ -197,17 +319,93 @@ public:
        Number(2)   Number(444)
 */
 
+// Post-order traversal with an explicit stack (no recursion on the tree depth) :
+// node->accept(visitor) is called once all the children of node have been accepted.
+// Null children are skipped.
+inline
+void walk_postorder(Node* root, IVisitor& visitor)
+{
+   std::vector<std::pair<Node*, bool>> todo; // node, children already scheduled
+   todo.emplace_back(root, false);
+   while (!todo.empty()) {
+      Node* node = todo.back().first;
+      if (node == nullptr) {
+         todo.pop_back();
+      } else if (!todo.back().second) {
+         todo.back().second = true;
+         for (size_t i = node->nb_children(); i-- > 0; ) {
+            todo.emplace_back(node->child(i), false);
+         }
+      } else {
+         todo.pop_back();
+         node->accept(visitor);
+      }
+   }
+}
+
+// Operands stack for the visitors driven by walk_postorder :
+// each visit pops the values of its children and pushes its own
+template<class T>
+class OperandStack {
+   std::vector<T> m_values;
+   bool m_f_walking{ false };
+public:
+   bool walking() const { return m_f_walking; }
+   void push(T value) { m_values.push_back(std::move(value)); }
+   T pop()
+   {
+      T value = std::move(m_values.back());
+      m_values.pop_back();
+      return value;
+   }
+   // the n values on top, first pushed first
+   T* top(size_t n) { return m_values.data() + m_values.size() - n; }
+   void drop(size_t n) { m_values.resize(m_values.size() - n); }
+
+   // runs walk_postorder and returns the value of root
+   T collect(Node* root, IVisitor& visitor)
+   {
+      const size_t base = m_values.size();
+      const bool nested = m_f_walking;
+      m_f_walking = true;
+      try {
+         walk_postorder(root, visitor);
+      } catch (...) {
+         m_values.resize(base);
+         m_f_walking = nested;
+         throw;
+      }
+      m_f_walking = nested;
+      T value = std::move(m_values.back());
+      m_values.resize(base);
+      return value;
+   }
+};
+
 // Concrete Visitor to evaluate the AST
 class EvaluteVisitor : public IVisitor {
    using VarTable = std::map<std::string, number_t>;
    VarTable vars; // need to be passed in
+   bool m_f_pairwise{ false };
+   OperandStack<number_t> m_operands;
 public:
    number_t result{ 0 };
+
+   // n-ary sums/products (see NaryNode) are reduced pairwise instead of sequentially
+   void pairwise(bool on_or_off)
+   {
+      m_f_pairwise = on_or_off;
+   }
+   // iterative : safe on arbitrarily deep trees
    number_t collect(Node* node)
    {
-      node->accept(*this);
+      result = m_operands.collect(node, *this);
       return result;
    }
+   void set(const std::string& variable, number_t value)
+   {
+      vars[variable] = value;
+   }
    // variable replacement
    number_t lookup(const std::string& variable)
    {
@@ -218,30 +416,36 @@ public:
       return 1;
    }
 
+   // node->accept(visitor) from outside a traversal starts one
    void visit(TerminalNode& node) override
    {
+      if (!m_operands.walking()) { collect(&node); return; }
       result = 0;
-      if(::isdigit(node.m_value[0])) {
+      if (node.is_number()) {
          result = std::stod(node.m_value);     
       } else {
          result = lookup(node.m_value);
       }
-      
+      m_operands.push(result);
    }
    void visit(UnaryNode& node) override
    {
+      if (!m_operands.walking()) { collect(&node); return; }
+      number_t value = m_operands.pop();
       if (node.m_func == FunctionId::Negate) {
-         result = -collect(node.m_child);
+         result = -value;
       } else if (node.m_func == FunctionId::Identity) {
-         result = collect(node.m_child);
+         result = value;
       } else {
-         result = ::mep::call_math_function(node.m_func, collect(node.m_child));
+         result = ::mep::call_math_function(node.m_func, value);
       }
+      m_operands.push(result);
    }
    void visit(BinaryNode& node) override
    {
-      double v1 = collect(node.m_left);
-      double v2 = collect(node.m_right);
+      if (!m_operands.walking()) { collect(&node); return; }
+      double v2 = m_operands.pop();
+      double v1 = m_operands.pop();
       switch (node.m_operator.m_operation) {
       case Operator::Add: result = v1 + v2; break;
       case Operator::Sub: result = v1 - v2; break;
@@ -251,45 +455,118 @@ public:
       case Operator::Mod: result = std::fmod(v1, v2); break;
       case Operator::Pow: result = std::pow(v1, v2); break;
       }
+      m_operands.push(result);
+   }
+   void visit(NaryNode& node) override
+   {
+      if (!m_operands.walking()) { collect(&node); return; }
+      const size_t n = node.m_children.size();
+      result = reduce_values(node.m_operator.m_operation, m_operands.top(n), n, m_f_pairwise);
+      m_operands.drop(n);
+      m_operands.push(result);
    }
 };
 
 
 // Visitor to reconstruct the expression
 class BeautifingVisitor : public IVisitor {
+   // pending output : a subtree, an operator (" + "), a fixed text or the end of
+   // a subtree (annotate)
+   struct Item {
+      Node* node;
+      char op;
+      const char* text;
+      Node* done;
+   };
+   std::vector<Item> m_todo;
+   std::string m_out;
+   bool m_f_walking{ false };
+
+   void schedule(Node* node) { m_todo.push_back({ node, 0, nullptr, nullptr }); }
+   void schedule(char op) { m_todo.push_back({ nullptr, op, nullptr, nullptr }); }
+   void schedule(const char* text) { m_todo.push_back({ nullptr, 0, text, nullptr }); }
+protected:
+   // when set, annotate() is called once the text of each subtree is written
+   bool m_f_annotate{ false };
+   virtual void annotate(Node&, std::string&) {}
 public:
+   virtual ~BeautifingVisitor() {}
    std::string result;
+   // iterative and linear in the output size : prefixes are written when a node is
+   // expanded, what follows its children is scheduled
    std::string collect(Node* node)
    {
-      node->accept(*this);
+      m_out.clear();
+      m_todo.clear();
+      m_f_walking = true;
+      schedule(node);
+      while (!m_todo.empty()) {
+         Item item = m_todo.back();
+         m_todo.pop_back();
+         if (item.node) {
+            if (m_f_annotate) m_todo.push_back({ nullptr, 0, nullptr, item.node });
+            item.node->accept(*this);
+         } else if (item.done) {
+            annotate(*item.done, m_out);
+         } else if (item.op) {
+            m_out += ' ';
+            m_out += item.op;
+            m_out += ' ';
+         } else if (item.text) {
+            m_out += item.text;
+         }
+      }
+      m_f_walking = false;
+      result = m_out;
       return result;
    }
 
+   // node->accept(visitor) from outside a traversal starts one
    void visit(TerminalNode& node) override
    {
-      if( ::isdigit(node.m_value[0]) ) {
+      if (!m_f_walking) { collect(&node); return; }
+      if (node.is_number()) {
          double value = std::stod(node.m_value);
          std::ostringstream os;
          os << std::fixed << std::setprecision(2) << value;
-         result = os.str();
+         m_out += os.str();
       } else {
-         result = node.m_value;
+         m_out += node.m_value;
       }
    }
    void visit(UnaryNode& node) override
    {
+      if (!m_f_walking) { collect(&node); return; }
       if (node.m_func == FunctionId::Identity) {
-         result = collect(node.m_child);
+         schedule(node.m_child);
       } else if (node.m_func == FunctionId::Negate) {
-         result = "-"  + collect(node.m_child);
+         m_out += '-';
+         schedule(node.m_child);
       } else {
-         result = node.function_name() + "(" + collect(node.m_child) + ")";
+         m_out += node.function_name();
+         m_out += '(';
+         schedule(")");
+         schedule(node.m_child);
       }         
-         
    }
    void visit(BinaryNode& node) override
    {
-      result = "(" + collect(node.m_left) + " " + node.to_char() + " " + collect(node.m_right) + ")";
+      if (!m_f_walking) { collect(&node); return; }
+      m_out += '(';
+      schedule(")");
+      schedule(node.m_right);
+      schedule(node.to_char());
+      schedule(node.m_left);
+   }
+   void visit(NaryNode& node) override
+   {
+      if (!m_f_walking) { collect(&node); return; }
+      m_out += '(';
+      schedule(")");
+      for (size_t i = node.m_children.size(); i-- > 0; ) {
+         schedule(node.m_children[i]);
+         if (i) schedule(node.to_char());
+      }
    }
 };
 
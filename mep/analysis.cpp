@@ -0,0 +1,155 @@
+#include <mep/analysis.hpp>
+#include <mep/cost_table.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+
+namespace mep {
+
+static_assert(sizeof(cost_table::opcode_cycles) / sizeof(double) == Program::nb_opcodes,
+   "cost_table.hpp is out of date, regenerate it with mep_bench --cost-table");
+static_assert(sizeof(cost_table::call_cycles) / sizeof(double) == nb_function_ids,
+   "cost_table.hpp is out of date, regenerate it with mep_bench --cost-table");
+
+namespace {
+
+double instruction_cycles(Program::OpCode op, size_t count, size_t func)
+{
+   if (op == Program::Call) return cost_table::call_cycles[func];
+   double cycles = cost_table::opcode_cycles[op];
+   if (op == Program::Sum || op == Program::Product) cycles += cost_table::operand_cycles * double(count);
+   return cycles;
+}
+
+// same instruction as the compiler (see program.cpp)
+Program::OpCode binary_opcode(const Operator& op)
+{
+   switch (op.m_operation) {
+   case Operator::Add: return Program::Add;
+   case Operator::Sub: return Program::Sub;
+   case Operator::Mul: return Program::Mul;
+   case Operator::Div: return Program::Div;
+   case Operator::Mod: return Program::Mod;
+   case Operator::Pow: return Program::Pow;
+   }
+   throw EvaluatorException("Unsupported operator");
+}
+
+std::string function_name(size_t func)
+{
+   switch (func) {
+   case FunctionId::Identity: return "+";
+   case FunctionId::Negate:   return "-";
+   }
+   return mep_function_name(FunctionId(func));
+}
+
+// driven by walk_postorder, the operands are the heights of the subtrees
+class AnalysisVisitor : public IVisitor {
+   ExpressionAnalysis& m_analysis;
+   OperandStack<size_t> m_heights;
+
+   void close(Node& node)
+   {
+      size_t n = 0;
+      for (size_t i = 0; i < node.nb_children(); ++i) {
+         if (node.child(i)) ++n; // null children are skipped by the walk
+      }
+      size_t height = 0;
+      const size_t* heights = m_heights.top(n);
+      for (size_t i = 0; i < n; ++i) height = std::max(height, heights[i]);
+      m_heights.drop(n);
+      m_heights.push(height + 1);
+      ++m_analysis.nb_nodes;
+   }
+   void count(Program::OpCode op, size_t nb_operands, size_t func = 0)
+   {
+      ++m_analysis.operations[op];
+      m_analysis.cycles += instruction_cycles(op, nb_operands, func);
+   }
+public:
+   explicit AnalysisVisitor(ExpressionAnalysis& analysis) : m_analysis(analysis) {}
+
+   size_t collect(Node* root) { return m_heights.collect(root, *this); }
+
+   void visit(TerminalNode& node) override
+   {
+      if (node.is_number()) {
+         count(Program::Const, 0);
+      } else {
+         m_analysis.variables.insert(node.m_value);
+         count(Program::Var, 0);
+      }
+      close(node);
+   }
+   void visit(UnaryNode& node) override
+   {
+      ++m_analysis.functions[node.m_func];
+      if (node.m_func != FunctionId::Identity) count(Program::Call, 1, node.m_func); // +x == x
+      close(node);
+   }
+   void visit(BinaryNode& node) override
+   {
+      count(binary_opcode(node.m_operator), 2);
+      close(node);
+   }
+   void visit(NaryNode& node) override
+   {
+      const bool is_mul = node.m_operator.m_operation == Operator::Mul;
+      count(is_mul ? Program::Product : Program::Sum, node.m_children.size());
+      close(node);
+   }
+};
+
+} // ns
+
+std::string ExpressionAnalysis::report() const
+{
+   std::ostringstream os;
+   os << "nodes " << nb_nodes << ", depth " << depth << "\n";
+   os << "variables " << variables.size();
+   const char* separator = " : ";
+   for (const std::string& name : variables) {
+      os << separator << name;
+      separator = " ";
+   }
+   os << "\noperations";
+   separator = " : ";
+   for (size_t op = 0; op < Program::nb_opcodes; ++op) {
+      if (operations[op] == 0) continue;
+      os << separator << opcode_name(Program::OpCode(op)) << ' ' << operations[op];
+      separator = ", ";
+   }
+   os << "\nfunctions";
+   separator = " : ";
+   for (size_t func = 0; func < nb_function_ids; ++func) {
+      if (functions[func] == 0) continue;
+      os << separator << function_name(func) << ' ' << functions[func];
+      separator = ", ";
+   }
+   os << "\nestimated cost " << static_cast<uint64_t>(cycles + 0.5) << " cycles\n";
+   return os.str();
+}
+
+ExpressionAnalysis MEP_EXPORTS analyze(AST* ast)
+{
+   if (ast == nullptr)
+      throw EvaluatorException("Empty tree!");
+   ExpressionAnalysis analysis;
+   AnalysisVisitor visitor(analysis);
+   analysis.depth = visitor.collect(ast);
+   return analysis;
+}
+
+double MEP_EXPORTS estimate_cycles(const ProgramView& program)
+{
+   double cycles = 0;
+   for (size_t i = 0; i < program.size(); ++i) {
+      const Program::Instr& instr = program.m_code[i];
+      cycles += instruction_cycles(instr.op, instr.count, instr.func);
+   }
+   return cycles;
+}
+
+} // ns
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <set>
+#include <string>
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/program.hpp>
+
+namespace mep {
+
+/* Static analysis : size, shape and estimated cost of an expression
+ Computed from the AST without evaluating it, to reject or throttle expensive user
+ formulas when they are submitted, or to balance batch work by expected cost :
+
+    ExpressionAnalysis analysis = analyze(ast);
+    if (analysis.cycles > budget) ... reject ...
+
+ The cost of one evaluation is the sum of the costs of the instructions of the
+ compiled form (see program.hpp), taken from the table mep_bench measures on the
+ reference machine (see cost_table.hpp). Cycles are Profiler cycles : time stamp
+ counter ticks on x86, so the estimate and the profile of a formula compare.
+*/
+
+static constexpr size_t nb_function_ids = FunctionId::Log10 + 1;
+
+struct MEP_EXPORTS ExpressionAnalysis {
+   size_t nb_nodes{ 0 };
+   size_t depth{ 0 };                         // height of the tree, 1 for a single leaf
+   size_t operations[Program::nb_opcodes]{};  // nodes by instruction kind (+x has none)
+   size_t functions[nb_function_ids]{};       // unary nodes by function, signs included
+   std::set<std::string> variables;           // distinct names
+   double cycles{ 0 };                        // estimated cost of one evaluation
+
+   // one line per item : nodes and depth, variables, operations, functions, cost
+   std::string report() const;
+};
+
+// iterative : safe on arbitrarily deep trees
+ExpressionAnalysis MEP_EXPORTS analyze(AST* ast);
+
+// estimated cycles of one evaluation of a compiled (specialized, stored, ...) program
+double MEP_EXPORTS estimate_cycles(const ProgramView& program);
+inline double estimate_cycles(const Program& program) { return estimate_cycles(program.view()); }
+
+} // ns
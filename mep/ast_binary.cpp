@@ -0,0 +1,419 @@
+#include <mep/ast_binary.hpp>
+#include <mep/lexer.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+
+namespace mep {
+
+static const char blob_magic[4] = { 'M', 'E', 'P', 'A' };
+static const uint32_t blob_byte_order = 0x01020304;
+static const uint32_t blob_version = 1;
+
+// to_ast() turns leaves into TerminalNodes : a number must print as a literal ("-1",
+// "inf" or "nan" would read as variables) and a string must read as one variable
+static bool is_literal(double value)
+{
+   return std::isfinite(value) && !std::signbit(value);
+}
+
+static bool is_variable_name(std::string_view name)
+{
+   Lexer lexer;
+   lexer.init(name);
+   Lexeme lex = lexer.next_lexeme();
+   return lex.tag == TokenType::T_TERM && lex.term_type == TermToken::Variable
+      && lex.offset == 0 && lex.length == name.size();
+}
+
+static uint32_t node_offset(uint32_t index)
+{
+   return static_cast<uint32_t>(sizeof(AstBlobHeader) + index * sizeof(AstBlobNode));
+}
+static uint32_t node_index(uint32_t offset)
+{
+   return static_cast<uint32_t>((offset - sizeof(AstBlobHeader)) / sizeof(AstBlobNode));
+}
+
+//----------------------------------------------------------------------------
+// writing
+
+// driven by walk_postorder : the operands are the node indexes of the children
+class AstBlobWriter : public IVisitor {
+   std::vector<AstBlobNode> m_nodes;
+   std::vector<uint32_t> m_children;   // n-ary children, as node indexes for now
+   std::vector<std::pair<size_t, size_t>> m_nary; // node index -> first child in m_children
+   std::vector<std::string> m_strings;
+   std::unordered_map<std::string, uint32_t> m_string_ids;
+   OperandStack<uint32_t> m_indexes;
+
+   uint32_t intern(const std::string& str)
+   {
+      auto search = m_string_ids.find(str);
+      if (search != m_string_ids.end()) return search->second;
+      uint32_t id = static_cast<uint32_t>(m_strings.size());
+      m_strings.push_back(str);
+      m_string_ids[str] = id;
+      return id;
+   }
+   void push(const AstBlobNode& node)
+   {
+      m_nodes.push_back(node);
+      m_indexes.push(static_cast<uint32_t>(m_nodes.size() - 1));
+   }
+   static AstBlobNode make(AstBlobNode::Kind kind, uint8_t op = 0)
+   {
+      AstBlobNode node;
+      std::memset(&node, 0, sizeof(node));
+      node.kind = kind;
+      node.op = op;
+      return node;
+   }
+   // null children are skipped by the walk
+   static void check_children(Node& node)
+   {
+      for (size_t i = 0; i < node.nb_children(); ++i) {
+         if (node.child(i) == nullptr)
+            throw MepException("Cannot serialize an empty tree");
+      }
+   }
+
+public:
+   // references are node indexes until finish() turns them into offsets
+   void write(Node* ast)
+   {
+      if (ast == nullptr)
+         throw MepException("Cannot serialize an empty tree");
+      m_indexes.collect(ast, *this);
+   }
+
+   void visit(TerminalNode& leaf) override
+   {
+      if (leaf.is_number()) {
+         AstBlobNode node = make(AstBlobNode::Number);
+         node.value = std::stod(leaf.m_value);
+         push(node);
+         return;
+      }
+      AstBlobNode node = make(AstBlobNode::Variable);
+      node.ref.a = intern(leaf.m_value);
+      push(node);
+   }
+   void visit(UnaryNode& unary) override
+   {
+      check_children(unary);
+      AstBlobNode node = make(AstBlobNode::Unary, static_cast<uint8_t>(unary.m_func));
+      node.ref.a = m_indexes.pop();
+      push(node);
+   }
+   void visit(NaryNode& nary) override
+   {
+      check_children(nary);
+      const size_t n = nary.m_children.size();
+      AstBlobNode node = make(AstBlobNode::Nary, static_cast<uint8_t>(nary.m_operator.m_operation));
+      node.count = static_cast<uint32_t>(n);
+      const uint32_t* children = m_indexes.top(n);
+      m_nary.emplace_back(m_nodes.size(), m_children.size());
+      m_children.insert(m_children.end(), children, children + n);
+      m_indexes.drop(n);
+      push(node);
+   }
+   void visit(BinaryNode& binary) override
+   {
+      check_children(binary);
+      Operator::Tag op = binary.m_operator.m_operation;
+      if (op < Operator::Add || op > Operator::Pow)
+         throw MepException("Cannot serialize unsupported operator");
+      AstBlobNode node = make(AstBlobNode::Binary, static_cast<uint8_t>(op));
+      node.ref.b = m_indexes.pop();
+      node.ref.a = m_indexes.pop();
+      push(node);
+   }
+
+   std::vector<char> finish()
+   {
+      const uint32_t nodes_offset = sizeof(AstBlobHeader);
+      auto offset_of = [&](uint32_t index) {
+         return static_cast<uint32_t>(nodes_offset + index * sizeof(AstBlobNode));
+      };
+      const uint32_t children_offset = offset_of(static_cast<uint32_t>(m_nodes.size()));
+      const uint32_t strings_offset = children_offset + static_cast<uint32_t>(m_children.size() * sizeof(uint32_t));
+
+      for (AstBlobNode& node : m_nodes) {
+         if (node.kind == AstBlobNode::Unary) {
+            node.ref.a = offset_of(node.ref.a);
+         } else if (node.kind == AstBlobNode::Binary) {
+            node.ref.a = offset_of(node.ref.a);
+            node.ref.b = offset_of(node.ref.b);
+         }
+      }
+      for (auto& nary : m_nary) {
+         m_nodes[nary.first].ref.a = children_offset + static_cast<uint32_t>(nary.second * sizeof(uint32_t));
+      }
+      for (uint32_t& child : m_children) child = offset_of(child);
+
+      std::vector<uint32_t> string_offsets{ 0 };
+      std::string chars;
+      for (const std::string& str : m_strings) {
+         chars += str;
+         string_offsets.push_back(static_cast<uint32_t>(chars.size()));
+      }
+
+      AstBlobHeader header;
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, blob_magic, sizeof(blob_magic));
+      header.byte_order = blob_byte_order;
+      header.version = blob_version;
+      header.root = offset_of(static_cast<uint32_t>(m_nodes.size() - 1));
+      header.nb_nodes = static_cast<uint32_t>(m_nodes.size());
+      header.strings_offset = strings_offset;
+      header.nb_strings = static_cast<uint32_t>(m_strings.size());
+      size_t size = strings_offset + string_offsets.size() * sizeof(uint32_t) + chars.size();
+      size = (size + 7) & ~static_cast<size_t>(7); // keeps blobs 8 bytes aligned when concatenated
+      header.size = static_cast<uint32_t>(size);
+
+      std::vector<char> out(size, 0);
+      std::memcpy(out.data(), &header, sizeof(header));
+      std::memcpy(out.data() + nodes_offset, m_nodes.data(), m_nodes.size() * sizeof(AstBlobNode));
+      if (!m_children.empty()) {
+         std::memcpy(out.data() + children_offset, m_children.data(), m_children.size() * sizeof(uint32_t));
+      }
+      std::memcpy(out.data() + strings_offset, string_offsets.data(), string_offsets.size() * sizeof(uint32_t));
+      std::memcpy(out.data() + strings_offset + string_offsets.size() * sizeof(uint32_t), chars.data(), chars.size());
+      return out;
+   }
+};
+
+std::vector<char> MEP_EXPORTS serialize_ast(AST* ast)
+{
+   AstBlobWriter writer;
+   writer.write(ast);
+   return writer.finish();
+}
+
+
+//----------------------------------------------------------------------------
+// reading
+
+size_t AstBlobView::NodeRef::nb_children() const
+{
+   switch (m_node->kind) {
+   case AstBlobNode::Unary: return 1;
+   case AstBlobNode::Binary: return 2;
+   case AstBlobNode::Nary: return m_node->count;
+   default: return 0;
+   }
+}
+
+AstBlobView::NodeRef AstBlobView::NodeRef::child(size_t i) const
+{
+   if (m_node->kind == AstBlobNode::Nary) {
+      return m_blob->node(m_blob->children(m_node->ref.a)[i]);
+   }
+   return m_blob->node(i == 0 ? m_node->ref.a : m_node->ref.b);
+}
+
+std::string_view AstBlobView::string(uint32_t index) const
+{
+   const AstBlobHeader& h = header();
+   const uint32_t* offsets = reinterpret_cast<const uint32_t*>(m_data + h.strings_offset);
+   const char* chars = reinterpret_cast<const char*>(offsets + h.nb_strings + 1);
+   return std::string_view(chars + offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+bool AstBlobView::validate() const
+{
+   if (m_data == nullptr || m_size < sizeof(AstBlobHeader)) return false;
+   if (reinterpret_cast<uintptr_t>(m_data) % alignof(double) != 0) return false;
+   const AstBlobHeader& h = header();
+   if (std::memcmp(h.magic, blob_magic, sizeof(blob_magic)) != 0
+       || h.byte_order != blob_byte_order || h.version != blob_version
+       || h.size > m_size || h.nb_nodes == 0) {
+      return false;
+   }
+   const uint64_t nodes_end = sizeof(AstBlobHeader) + uint64_t(h.nb_nodes) * sizeof(AstBlobNode);
+   if (nodes_end > h.strings_offset || h.strings_offset % 4 != 0
+       || h.strings_offset + (uint64_t(h.nb_strings) + 1) * sizeof(uint32_t) > h.size) {
+      return false;
+   }
+   if (h.root != nodes_end - sizeof(AstBlobNode)) return false;
+
+   const uint32_t* string_offsets = reinterpret_cast<const uint32_t*>(m_data + h.strings_offset);
+   const uint64_t chars_room = h.size - h.strings_offset - (uint64_t(h.nb_strings) + 1) * sizeof(uint32_t);
+   if (string_offsets[0] != 0) return false;
+   const char* chars = reinterpret_cast<const char*>(string_offsets + h.nb_strings + 1);
+   for (uint32_t i = 0; i < h.nb_strings; ++i) {
+      if (string_offsets[i] > string_offsets[i + 1] || string_offsets[i + 1] > chars_room) return false;
+      std::string_view name(chars + string_offsets[i], string_offsets[i + 1] - string_offsets[i]);
+      if (!is_variable_name(name)) return false;
+   }
+
+   // a reference must be a node located before the referencing one, and the only
+   // reference to it : a node shared by several parents would make a DAG, whose
+   // tree walk costs up to 2^n
+   std::vector<uint8_t> referenced(h.nb_nodes, 0);
+   auto is_node_before = [&](uint32_t offset, uint32_t self) {
+      if (offset < sizeof(AstBlobHeader) || offset >= self
+         || (offset - sizeof(AstBlobHeader)) % sizeof(AstBlobNode) != 0) {
+         return false;
+      }
+      uint8_t& seen = referenced[node_index(offset)];
+      if (seen) return false;
+      seen = 1;
+      return true;
+   };
+   for (uint32_t i = 0; i < h.nb_nodes; ++i) {
+      const uint32_t self = static_cast<uint32_t>(sizeof(AstBlobHeader) + i * sizeof(AstBlobNode));
+      const AstBlobNode& n = *reinterpret_cast<const AstBlobNode*>(m_data + self);
+      switch (n.kind) {
+      case AstBlobNode::Number:
+         if (!is_literal(n.value)) return false;
+         break;
+      case AstBlobNode::Variable:
+         if (n.ref.a >= h.nb_strings) return false;
+         break;
+      case AstBlobNode::Unary:
+         if (n.op > FunctionId::Log10 || !is_node_before(n.ref.a, self)) return false;
+         break;
+      case AstBlobNode::Binary:
+         if (n.op < Operator::Add || n.op > Operator::Pow) return false;
+         if (!is_node_before(n.ref.a, self) || !is_node_before(n.ref.b, self)) return false;
+         break;
+      case AstBlobNode::Nary: {
+         if (n.op != Operator::Add && n.op != Operator::Mul) return false;
+         if (n.count < 2 || n.ref.a % 4 != 0 || n.ref.a < nodes_end
+             || n.ref.a + uint64_t(n.count) * sizeof(uint32_t) > h.strings_offset) {
+            return false;
+         }
+         const uint32_t* kids = children(n.ref.a);
+         for (uint32_t k = 0; k < n.count; ++k) {
+            if (!is_node_before(kids[k], self)) return false;
+         }
+      } break;
+      default:
+         return false;
+      }
+   }
+   // every node but the root has exactly one parent : a tree
+   return std::count(referenced.begin(), referenced.end(), uint8_t(1)) == h.nb_nodes - 1;
+}
+
+// The nodes are in post order : one forward pass, each node reading the values (or
+// subtrees) of its children computed before it. No recursion on the tree depth.
+number_t AstBlobView::evaluate(const std::map<std::string, number_t>& vars) const
+{
+   const uint32_t nb_nodes = header().nb_nodes;
+   std::vector<number_t> values(nb_nodes);
+   auto value_of = [&](uint32_t offset) { return values[node_index(offset)]; };
+   for (uint32_t i = 0; i < nb_nodes; ++i) {
+      const AstBlobNode& n = raw_node(node_offset(i));
+      number_t& value = values[i];
+      switch (n.kind) {
+      case AstBlobNode::Number:
+         value = n.value;
+         break;
+      case AstBlobNode::Variable: {
+         auto search = vars.find(std::string(string(n.ref.a)));
+         value = (search != vars.end()) ? search->second : 1;
+      } break;
+      case AstBlobNode::Unary: {
+         const number_t x = value_of(n.ref.a);
+         const FunctionId func = static_cast<FunctionId>(n.op);
+         if (func == FunctionId::Identity) value = x;
+         else if (func == FunctionId::Negate) value = -x;
+         else value = call_math_function(func, x);
+      } break;
+      case AstBlobNode::Binary: {
+         const number_t v1 = value_of(n.ref.a);
+         const number_t v2 = value_of(n.ref.b);
+         switch (n.op) {
+         case Operator::Add: value = v1 + v2; break;
+         case Operator::Sub: value = v1 - v2; break;
+         case Operator::Mul: value = v1 * v2; break;
+         case Operator::Div: value = v1 / v2; break;
+         case Operator::Mod: value = std::fmod(v1, v2); break;
+         case Operator::Pow: value = std::pow(v1, v2); break;
+         default: throw EvaluatorException("Incorrect syntax tree!");
+         }
+      } break;
+      case AstBlobNode::Nary: {
+         const uint32_t* kids = children(n.ref.a);
+         number_t acc = value_of(kids[0]);
+         for (uint32_t k = 1; k < n.count; ++k) {
+            acc = (n.op == Operator::Mul) ? acc * value_of(kids[k]) : acc + value_of(kids[k]);
+         }
+         value = acc;
+      } break;
+      default:
+         throw EvaluatorException("Incorrect syntax tree!");
+      }
+   }
+   return values[nb_nodes - 1];
+}
+
+// Same forward pass : a parent takes the subtrees of its children, the last node
+// built is the root
+AST* AstBlobView::to_ast() const
+{
+   const uint32_t nb_nodes = header().nb_nodes;
+   std::vector<Node*> built(nb_nodes, nullptr);
+   auto take = [&](uint32_t offset) {
+      Node*& subtree = built[node_index(offset)];
+      Node* node = subtree;
+      subtree = nullptr;
+      return node;
+   };
+   try {
+      for (uint32_t i = 0; i < nb_nodes; ++i) {
+         const AstBlobNode& n = raw_node(node_offset(i));
+         switch (n.kind) {
+         case AstBlobNode::Number: {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.17g", n.value);
+            built[i] = new TerminalNode(buffer);
+         } break;
+         case AstBlobNode::Variable:
+            built[i] = new TerminalNode(std::string(string(n.ref.a)));
+            break;
+         case AstBlobNode::Unary: {
+            FunctionId func = static_cast<FunctionId>(n.op);
+            std::unique_ptr<Node> child(take(n.ref.a));
+            built[i] = new UnaryNode(func, child.get());
+            child.release();
+         } break;
+         case AstBlobNode::Binary: {
+            Operator op;
+            op.m_operation = static_cast<Operator::Tag>(n.op);
+            std::unique_ptr<Node> left(take(n.ref.a));
+            std::unique_ptr<Node> right(take(n.ref.b));
+            built[i] = new BinaryNode(op, left.get(), right.get());
+            left.release();
+            right.release();
+         } break;
+         case AstBlobNode::Nary: {
+            Operator op;
+            op.m_operation = static_cast<Operator::Tag>(n.op);
+            const uint32_t* kids = children(n.ref.a);
+            std::vector<Node*> subtrees;
+            subtrees.reserve(n.count);
+            for (uint32_t k = 0; k < n.count; ++k) subtrees.push_back(built[node_index(kids[k])]);
+            built[i] = new NaryNode(op, std::move(subtrees));
+            for (uint32_t k = 0; k < n.count; ++k) take(kids[k]);
+         } break;
+         default:
+            throw MepException("Incorrect binary tree");
+         }
+      }
+   } catch (...) {
+      for (Node* node : built) delete node;
+      throw;
+   }
+   return built[nb_nodes - 1];
+}
+
+} // ns
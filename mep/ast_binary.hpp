@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/parser.hpp>
+#include <mep/evaluator.hpp>
+
+namespace mep {
+
+/* Compact binary encoding of an AST
+ Position independent : every reference is a 32 bits offset from the start of the
+ blob, so it can be read in place from a memory mapped file or shared memory.
+
+    AstBlobHeader
+    AstBlobNode[]             post order : children always before their parent,
+                              the root is the last node
+    uint32_t children[]       operands of the n-ary nodes
+    uint32_t string_offsets[nb_strings + 1]
+    char     strings[]        identifiers, each stored once
+
+ Numbers are stored as raw IEEE 754 doubles (no precision loss, unlike
+ BeautifingVisitor), their original spelling is not kept : 007 reads back as 7.
+*/
+struct AstBlobHeader {
+   char     magic[4];        // "MEPA"
+   uint32_t byte_order;      // 0x01020304 as written
+   uint32_t version;
+   uint32_t size;            // whole blob
+   uint32_t root;            // offset of the root node
+   uint32_t nb_nodes;
+   uint32_t strings_offset;  // string_offsets table
+   uint32_t nb_strings;
+};
+
+struct AstBlobNode {
+   enum Kind : uint8_t { Number, Variable, Unary, Binary, Nary };
+   Kind     kind;
+   uint8_t  op;              // FunctionId (Unary) or Operator::Tag (Binary, Nary)
+   uint16_t reserved;
+   uint32_t count;           // number of children (Nary)
+   union {
+      double value;          // Number
+      struct {
+         uint32_t a;         // Variable : string index, Unary/Binary : first child offset,
+                             // Nary : offset of the children offsets array
+         uint32_t b;         // Binary : second child offset
+      } ref;
+   };
+};
+
+// Encodes the tree (left untouched)
+std::vector<char> MEP_EXPORTS serialize_ast(AST* ast);
+
+// Read only access to an encoded tree, nothing is copied
+class MEP_EXPORTS AstBlobView {
+   const char* m_data{ nullptr };
+   size_t m_size{ 0 };
+public:
+   class NodeRef {
+      const AstBlobView* m_blob;
+      const AstBlobNode* m_node;
+   public:
+      NodeRef(const AstBlobView* blob, const AstBlobNode* node) : m_blob(blob), m_node(node) {}
+      AstBlobNode::Kind kind() const { return m_node->kind; }
+      number_t value() const { return m_node->value; }
+      std::string_view name() const { return m_blob->string(m_node->ref.a); }
+      FunctionId function() const { return static_cast<FunctionId>(m_node->op); }
+      Operator::Tag operation() const { return static_cast<Operator::Tag>(m_node->op); }
+      size_t nb_children() const;
+      NodeRef child(size_t i) const;
+   };
+
+   AstBlobView() = default;
+   AstBlobView(const void* data, size_t size)
+      : m_data(static_cast<const char*>(data)), m_size(size)
+   {}
+
+   // full structural check : header, bounds, alignment, children before parents,
+   // a single parent per node (a tree, not a DAG), known operators and functions,
+   // leaves an AST can hold (finite non negative numbers, identifiers).
+   // Accessors assume a valid blob.
+   bool validate() const;
+
+   const AstBlobHeader& header() const { return *reinterpret_cast<const AstBlobHeader*>(m_data); }
+   NodeRef root() const { return node(header().root); }
+   NodeRef node(uint32_t offset) const { return NodeRef(this, reinterpret_cast<const AstBlobNode*>(m_data + offset)); }
+   std::string_view string(uint32_t index) const;
+   const AstBlobNode& raw_node(uint32_t offset) const { return *reinterpret_cast<const AstBlobNode*>(m_data + offset); }
+   const uint32_t* children(uint32_t offset) const { return reinterpret_cast<const uint32_t*>(m_data + offset); }
+
+   // evaluates in place, unknown variables default to 1 (as in EvaluteVisitor),
+   // one pass over the nodes whatever the depth
+   number_t evaluate(const std::map<std::string, number_t>& vars) const;
+   // rebuilds an AST, iteratively
+   AST* to_ast() const;
+};
+
+} // ns
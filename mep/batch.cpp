@@ -0,0 +1,148 @@
+#include <mep/batch.hpp>
+#include <mep/tracing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace mep {
+
+BatchEvaluator::BatchEvaluator(Program program)
+   : m_program(std::move(program))
+   , m_columns(m_program.nb_variables(), nullptr)
+   , m_params(m_program.nb_variables(), 1)
+{
+   if (m_program.empty())
+      throw EvaluatorException("Empty program");
+}
+
+void BatchEvaluator::bind_column(const std::string& var, const number_t* column)
+{
+   int slot = m_program.slot(var);
+   if (slot < 0) return;
+   if ((m_columns[slot] == nullptr) != (column == nullptr)) m_f_plan_valid = false;
+   m_columns[slot] = column;
+}
+
+void BatchEvaluator::bind_param(const std::string& var, number_t value)
+{
+   int slot = m_program.slot(var);
+   if (slot < 0) return;
+   if (m_columns[slot] != nullptr) m_f_plan_valid = false;
+   m_columns[slot] = nullptr;
+   m_params[slot] = value;
+}
+
+// split instructions between batch invariant and per row ones
+void BatchEvaluator::plan()
+{
+   m_varying.assign(m_program.size(), 0);
+   m_per_row.clear();
+   for (uint32_t i = 0; i < m_program.size(); ++i) {
+      const Program::Instr& instr = m_program.m_code[i];
+      bool varying = false;
+      if (instr.op == Program::Var) {
+         varying = m_columns[instr.arg] != nullptr;
+      } else if (instr.op != Program::Const) {
+         const uint32_t* ops = m_program.operands(instr);
+         for (uint32_t k = 0; k < instr.count && !varying; ++k) {
+            varying = m_varying[ops[k]] != 0;
+         }
+      }
+      m_varying[i] = varying;
+      if (varying) m_per_row.push_back(i);
+   }
+   m_nb_hoisted = m_program.size() - m_per_row.size();
+   m_f_plan_valid = true;
+}
+
+// lanes : block_size registers per instruction, the invariant ones being pre-filled
+// (never written here, so they stay valid from one block to the next)
+void BatchEvaluator::evaluate_block(std::vector<number_t>& lanes, size_t first_row, size_t nb_rows,
+                                    number_t* out) const
+{
+   number_t* regs = lanes.data();
+   for (uint32_t i : m_per_row) {
+      const Program::Instr& instr = m_program.m_code[i];
+      const uint32_t* ops = m_program.operands(instr);
+      number_t* dst = regs + i * block_size;
+      const number_t* a = (instr.count > 0) ? regs + ops[0] * block_size : nullptr;
+      const number_t* b = (instr.count > 1) ? regs + ops[1] * block_size : nullptr;
+      switch (instr.op) {
+      case Program::Var:
+         std::memcpy(dst, m_columns[instr.arg] + first_row, nb_rows * sizeof(number_t));
+         break;
+      case Program::Call:
+         if (instr.func == FunctionId::Negate) {
+            for (size_t r = 0; r < nb_rows; ++r) dst[r] = -a[r];
+         } else if (instr.func == FunctionId::Identity) {
+            for (size_t r = 0; r < nb_rows; ++r) dst[r] = a[r];
+         } else {
+            FunctionId func = static_cast<FunctionId>(instr.func);
+            for (size_t r = 0; r < nb_rows; ++r) dst[r] = call_math_function(func, a[r]);
+         }
+         break;
+      case Program::Add: for (size_t r = 0; r < nb_rows; ++r) dst[r] = a[r] + b[r]; break;
+      case Program::Sub: for (size_t r = 0; r < nb_rows; ++r) dst[r] = a[r] - b[r]; break;
+      case Program::Mul: for (size_t r = 0; r < nb_rows; ++r) dst[r] = a[r] * b[r]; break;
+      case Program::Div: for (size_t r = 0; r < nb_rows; ++r) dst[r] = a[r] / b[r]; break;
+      case Program::Mod: for (size_t r = 0; r < nb_rows; ++r) dst[r] = std::fmod(a[r], b[r]); break;
+      case Program::Pow: for (size_t r = 0; r < nb_rows; ++r) dst[r] = std::pow(a[r], b[r]); break;
+      case Program::Sum:
+      case Program::Product: {
+         std::copy(a, a + nb_rows, dst);
+         for (uint32_t k = 1; k < instr.count; ++k) {
+            const number_t* src = regs + ops[k] * block_size;
+            if (instr.op == Program::Sum) {
+               for (size_t r = 0; r < nb_rows; ++r) dst[r] += src[r];
+            } else {
+               for (size_t r = 0; r < nb_rows; ++r) dst[r] *= src[r];
+            }
+         }
+      } break;
+      default:
+         throw EvaluatorException("Invalid instruction");
+      }
+   }
+   const number_t* result = regs + (m_program.size() - 1) * block_size;
+   std::copy(result, result + nb_rows, out + first_row);
+}
+
+void BatchEvaluator::evaluate(size_t nb_rows, number_t* out, ThreadPool* pool)
+{
+   if (!m_f_plan_valid) plan();
+   const size_t n = m_program.size();
+
+   // invariant instructions : once per batch
+   std::vector<number_t> scalars(n);
+   for (size_t i = 0; i < n; ++i) {
+      if (!m_varying[i]) scalars[i] = m_program.compute(i, m_params.data(), scalars.data());
+   }
+   if (m_per_row.empty()) { // nothing depends on a column
+      std::fill(out, out + nb_rows, scalars[n - 1]);
+      return;
+   }
+   // broadcast them once, every thread starts from this image
+   std::vector<number_t> broadcast(n * block_size, 0);
+   for (size_t i = 0; i < n; ++i) {
+      if (!m_varying[i]) std::fill_n(broadcast.begin() + i * block_size, block_size, scalars[i]);
+   }
+
+   size_t nb_blocks = (nb_rows + block_size - 1) / block_size;
+   auto run_blocks = [&](size_t begin, size_t end) {
+      MEP_TRACE_SPAN("batch chunk", trace_id(m_program.m_code.data(), n * sizeof(Program::Instr)));
+      std::vector<number_t> lanes(broadcast);
+      for (size_t blk = begin; blk < end; ++blk) {
+         size_t first = blk * block_size;
+         evaluate_block(lanes, first, std::min(block_size, nb_rows - first), out);
+      }
+   };
+   if (pool && nb_blocks > 1) {
+      pool->parallel_for(nb_blocks, run_blocks, 16);
+   } else {
+      run_blocks(0, nb_blocks);
+   }
+}
+
+} // ns
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/program.hpp>
+#include <mep/thread_pool.hpp>
+
+namespace mep {
+
+/* Batch evaluation over columns of rows
+   row_x * exp(-k*t)
+ Variables are either bound to a column (one value per row) or to a batch parameter
+ (one value for the whole batch, unbound variables default to 1). Instructions
+ depending on parameters only are batch invariant : they are evaluated once per batch
+ and broadcast, the remaining instructions are evaluated row block by row block,
+ one instruction at a time over the whole block (tight, vectorizable loops).
+
+    BatchEvaluator batch(compile(ast));
+    batch.bind_column("row_x", xs.data());
+    batch.bind_param("k", 0.5);
+    batch.bind_param("t", 2);
+    batch.evaluate(xs.size(), out.data());
+*/
+class MEP_EXPORTS BatchEvaluator {
+public:
+   static constexpr size_t block_size = 128;
+private:
+   Program m_program;
+   std::vector<const number_t*> m_columns; // slot -> column (nullptr : parameter)
+   std::vector<number_t> m_params;         // slot -> parameter value
+   std::vector<uint8_t>  m_varying;        // instruction -> depends on a column
+   std::vector<uint32_t> m_per_row;        // varying instructions, in program order
+   size_t m_nb_hoisted{ 0 };
+   bool m_f_plan_valid{ false };
+
+   void plan();
+   void evaluate_block(std::vector<number_t>& lanes, size_t first_row, size_t nb_rows, number_t* out) const;
+public:
+   BatchEvaluator(Program program);
+
+   const Program& program() const { return m_program; }
+
+   // binding a variable the expression does not reference is a no-op
+   void bind_column(const std::string& var, const number_t* column);
+   void bind_param(const std::string& var, number_t value);
+
+   // out receives nb_rows values, chunks of rows are spread over pool when given
+   void evaluate(size_t nb_rows, number_t* out, ThreadPool* pool = nullptr);
+
+   // instructions evaluated once per batch / once per row (as of the last evaluate)
+   size_t nb_hoisted() const { return m_nb_hoisted; }
+   size_t nb_per_row() const { return m_per_row.size(); }
+};
+
+} // ns
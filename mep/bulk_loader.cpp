@@ -0,0 +1,73 @@
+#include <mep/bulk_loader.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <mep/mapped_file.hpp>
+
+
+namespace mep {
+
+static std::vector<std::string_view> split_lines(std::string_view text)
+{
+   std::vector<std::string_view> lines;
+   const char* begin = text.data();
+   const char* end = begin + text.size();
+   while (begin < end) {
+      const char* eol = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+      const char* line_end = eol ? eol : end;
+      std::string_view line(begin, line_end - begin);
+      if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+      lines.push_back(line);
+      begin = eol ? eol + 1 : end;
+   }
+   return lines;
+}
+
+static bool is_blank(std::string_view line)
+{
+   return std::all_of(line.begin(), line.end(), [](char c) { return ::isspace(static_cast<unsigned char>(c)); });
+}
+
+BulkLoadResult MEP_EXPORTS parse_expression_lines(std::string_view text, ThreadPool& pool)
+{
+   const std::vector<std::string_view> lines = split_lines(text);
+   BulkLoadResult result;
+   result.expressions.resize(lines.size());
+
+   const size_t grain = 256;
+   std::vector<std::vector<LineError>> chunk_errors((lines.size() + grain - 1) / grain);
+   pool.parallel_for(lines.size(), [&](size_t begin, size_t end) {
+      Parser parser; // per chunk : Parser is not thread safe
+      std::vector<LineError>& errors = chunk_errors[begin / grain];
+      std::string source;
+      for (size_t i = begin; i < end; ++i) {
+         if (is_blank(lines[i])) continue;
+         source.assign(lines[i].data(), lines[i].size());
+         // invalid lines are expected here : no exception on that path
+         Result<AST*> ast = parser.try_parse(source);
+         if (!ast) {
+            errors.push_back({ i + 1, ast.error().to_string() });
+            continue;
+         }
+         result.expressions[i] = std::make_shared<const Program>(compile(ast.value()));
+         delete ast.value();
+      }
+   }, grain);
+
+   for (auto& errors : chunk_errors) {
+      result.errors.insert(result.errors.end(), errors.begin(), errors.end());
+   }
+   return result;
+}
+
+BulkLoadResult MEP_EXPORTS load_expression_file(const std::string& path, ThreadPool& pool)
+{
+   MappedFile file;
+   if (!file.open(path))
+      throw MepException("Cannot read " + path);
+   return parse_expression_lines(std::string_view(file.data(), file.size()), pool);
+}
+
+} // ns
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/expr_cache.hpp>
+#include <mep/thread_pool.hpp>
+
+namespace mep {
+
+// Error found on one line of a bulk load
+struct LineError {
+   size_t line;          // 1 based
+   std::string message;
+};
+
+struct BulkLoadResult {
+   // one entry per line, nullptr for blank and invalid lines
+   std::vector<CompiledExpression> expressions;
+   // sorted by line
+   std::vector<LineError> errors;
+};
+
+/* Bulk loading of expression files, one formula per line
+ The file is memory mapped and split on line boundaries, chunks of lines are then
+ parsed and compiled in parallel, each worker with its own Parser.
+
+    ThreadPool pool;
+    BulkLoadResult result = load_expression_file("rules.txt", pool);
+*/
+BulkLoadResult MEP_EXPORTS parse_expression_lines(std::string_view text, ThreadPool& pool);
+// throws MepException if the file cannot be read
+BulkLoadResult MEP_EXPORTS load_expression_file(const std::string& path, ThreadPool& pool);
+
+} // ns
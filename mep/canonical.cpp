@@ -0,0 +1,317 @@
+#include <mep/canonical.hpp>
+#include <mep/instrumentation.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace mep {
+
+//----------------------------------------------------------------------------
+// hashing
+
+static uint64_t mix64(uint64_t x)
+{
+   // splitmix64 finalizer
+   x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+   x ^= x >> 27; x *= 0x94D049BB133111EBull;
+   x ^= x >> 31;
+   return x;
+}
+
+// two independent 64 bits lanes
+class HashBuilder {
+   uint64_t m_lo{ 0x243F6A8885A308D3ull };
+   uint64_t m_hi{ 0x13198A2E03707344ull };
+public:
+   void add(uint64_t v)
+   {
+      m_lo = mix64(m_lo ^ v) + 0x9E3779B97F4A7C15ull;
+      m_hi = mix64(m_hi + v * 0xD6E8FEB86659FD93ull) ^ (m_hi >> 29);
+   }
+   void add(const std::string& str)
+   {
+      add(str.size());
+      uint64_t word = 0;
+      for (size_t i = 0; i < str.size(); ++i) {
+         word = (word << 8) | static_cast<unsigned char>(str[i]);
+         if (i % 8 == 7) { add(word); word = 0; }
+      }
+      add(word);
+   }
+   void add(const Hash128& h) { add(h.lo); add(h.hi); }
+   Hash128 result() const { return Hash128{ m_lo, m_hi }; }
+};
+
+Hash128 MEP_EXPORTS hash_bytes(const void* data, size_t size)
+{
+   const unsigned char* bytes = static_cast<const unsigned char*>(data);
+   HashBuilder h;
+   h.add(size);
+   uint64_t word = 0;
+   for (size_t i = 0; i < size; ++i) {
+      word = (word << 8) | bytes[i];
+      if (i % 8 == 7) { h.add(word); word = 0; }
+   }
+   h.add(word);
+   return h.result();
+}
+
+enum HashTag : uint64_t { H_LEAF = 1, H_UNARY, H_BINARY, H_NARY };
+
+// hash of a node from the hashes of its children (Hash128{} for a null child)
+static Hash128 node_hash(Node& node, const Hash128* children)
+{
+   HashBuilder h;
+   if (TerminalNode* leaf = dynamic_cast<TerminalNode*>(&node)) {
+      h.add(H_LEAF);
+      h.add(leaf->m_value);
+   } else if (UnaryNode* unary = dynamic_cast<UnaryNode*>(&node)) {
+      h.add(H_UNARY);
+      h.add(static_cast<uint64_t>(unary->m_func));
+   } else if (NaryNode* nary = dynamic_cast<NaryNode*>(&node)) {
+      h.add(H_NARY);
+      h.add(static_cast<uint64_t>(nary->m_operator.m_operation));
+      h.add(nary->m_children.size());
+   } else if (BinaryNode* binary = dynamic_cast<BinaryNode*>(&node)) {
+      h.add(H_BINARY);
+      h.add(static_cast<uint64_t>(binary->m_operator.m_operation));
+   }
+   for (size_t i = 0; i < node.nb_children(); ++i) h.add(children[i]);
+   return h.result();
+}
+
+// driven by walk_postorder : the operands are the hashes of the children
+class StructuralHasher : public IVisitor {
+   OperandStack<Hash128> m_hashes;
+   std::vector<Hash128> m_children;
+
+   // null children are skipped by the walk
+   void close(Node& node)
+   {
+      size_t n = 0;
+      for (size_t i = 0; i < node.nb_children(); ++i) {
+         if (node.child(i)) ++n;
+      }
+      const Hash128* hashes = m_hashes.top(n);
+      m_children.clear();
+      for (size_t i = 0, k = 0; i < node.nb_children(); ++i) {
+         m_children.push_back(node.child(i) ? hashes[k++] : Hash128{});
+      }
+      m_hashes.drop(n);
+      m_hashes.push(node_hash(node, m_children.data()));
+   }
+public:
+   Hash128 collect(AST* root) { return m_hashes.collect(root, *this); }
+
+   void visit(TerminalNode& leaf) override { close(leaf); }
+   void visit(UnaryNode& unary) override { close(unary); }
+   void visit(BinaryNode& binary) override { close(binary); }
+   void visit(NaryNode& nary) override { close(nary); }
+};
+
+Hash128 MEP_EXPORTS structural_hash(AST* ast)
+{
+   if (ast == nullptr) return Hash128{};
+   StructuralHasher hasher;
+   return hasher.collect(ast);
+}
+
+bool MEP_EXPORTS structurally_equal(AST* a, AST* b)
+{
+   // pairs of subtrees left to compare, no recursion on the tree depth
+   std::vector<std::pair<Node*, Node*>> pending{ { a, b } };
+   while (!pending.empty()) {
+      Node* x = pending.back().first;
+      Node* y = pending.back().second;
+      pending.pop_back();
+      if (x == nullptr || y == nullptr) {
+         if (x != y) return false;
+         continue;
+      }
+      if (TerminalNode* lx = dynamic_cast<TerminalNode*>(x)) {
+         TerminalNode* ly = dynamic_cast<TerminalNode*>(y);
+         if (!ly || lx->m_value != ly->m_value) return false;
+         continue;
+      }
+      if (UnaryNode* ux = dynamic_cast<UnaryNode*>(x)) {
+         UnaryNode* uy = dynamic_cast<UnaryNode*>(y);
+         if (!uy || ux->m_func != uy->m_func) return false;
+      } else if (NaryNode* nx = dynamic_cast<NaryNode*>(x)) {
+         NaryNode* ny = dynamic_cast<NaryNode*>(y);
+         if (!ny || nx->m_operator.m_operation != ny->m_operator.m_operation) return false;
+         if (nx->m_children.size() != ny->m_children.size()) return false;
+      } else {
+         BinaryNode* bx = dynamic_cast<BinaryNode*>(x);
+         BinaryNode* by = dynamic_cast<BinaryNode*>(y);
+         if (!bx || !by || bx->m_operator.m_operation != by->m_operator.m_operation) return false;
+      }
+      for (size_t i = 0; i < x->nb_children(); ++i) {
+         pending.emplace_back(x->child(i), y->child(i));
+      }
+   }
+   return true;
+}
+
+
+//----------------------------------------------------------------------------
+// canonical form
+
+static bool is_commutative(Operator::Tag op)
+{
+   return op == Operator::Add || op == Operator::Mul;
+}
+
+static void normalize_literal(TerminalNode& leaf)
+{
+   if (!leaf.is_number()) return;
+   double value = std::stod(leaf.m_value);
+   if (!std::isfinite(value)) return; // "inf" would read back as a variable
+   char buffer[32];
+   std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+   MEP_MEM_STRING_FREE(leaf.m_value);
+   leaf.m_value = buffer;
+   MEP_MEM_STRING_ALLOC(leaf.m_value);
+}
+
+// driven by walk_postorder : the operands are the canonical forms of the children,
+// a node is rewritten once its children are canonical. The structural hashes of the
+// canonical subtrees are computed once, bottom up, to sort the operands of + and *
+class Canonicalizer : public IVisitor {
+   OperandStack<Node*> m_nodes;
+   std::unordered_map<Node*, Hash128> m_hashes; // canonical subtree -> structural hash
+   std::vector<Hash128> m_children;
+
+   // a new (or rewritten) canonical subtree, its children are hashed
+   void publish(Node* node)
+   {
+      m_children.clear();
+      for (size_t i = 0; i < node->nb_children(); ++i) {
+         Node* child = node->child(i);
+         m_children.push_back(child ? m_hashes[child] : Hash128{});
+      }
+      m_hashes[node] = node_hash(*node, m_children.data());
+      m_nodes.push(node);
+   }
+
+   // the canonical children in place of the originals, false when one is missing
+   // (null children are skipped by the walk, the node is then left as is)
+   bool update_children(UnaryNode& unary)
+   {
+      if (!unary.m_child) return false;
+      unary.m_child = m_nodes.pop();
+      return true;
+   }
+   bool update_children(BinaryNode& binary)
+   {
+      if (binary.m_right) binary.m_right = m_nodes.pop();
+      if (binary.m_left) binary.m_left = m_nodes.pop();
+      return binary.m_left && binary.m_right;
+   }
+   bool update_children(NaryNode& nary)
+   {
+      bool complete = true;
+      for (auto it = nary.m_children.rbegin(); it != nary.m_children.rend(); ++it) {
+         if (*it) *it = m_nodes.pop();
+         else complete = false;
+      }
+      return complete;
+   }
+
+   // one n-ary node for the canonical operands of a chain of op, with the operands
+   // sorted. A canonical chain of op is an n-ary node, its operands are spliced :
+   // canonicalizing an operand may expose one, as in -(-(a+b)) + c
+   Node* chain(Operator op, const std::vector<Node*>& operands)
+   {
+      std::vector<Node*> flat;
+      for (Node* operand : operands) {
+         NaryNode* nary = dynamic_cast<NaryNode*>(operand);
+         if (nary && nary->m_operator.m_operation == op.m_operation) {
+            flat.insert(flat.end(), nary->m_children.begin(), nary->m_children.end());
+            nary->m_children.clear();
+            m_hashes.erase(nary);
+            delete nary;
+         } else {
+            flat.push_back(operand);
+         }
+      }
+      std::vector<std::pair<Hash128, Node*>> keyed;
+      for (Node* operand : flat) keyed.emplace_back(m_hashes[operand], operand);
+      std::stable_sort(keyed.begin(), keyed.end(),
+         [](const std::pair<Hash128, Node*>& l, const std::pair<Hash128, Node*>& r) { return l.first < r.first; });
+      std::vector<Node*> sorted;
+      for (auto& entry : keyed) sorted.push_back(entry.second);
+      return new NaryNode(op, std::move(sorted));
+   }
+public:
+   AST* collect(AST* root) { return m_nodes.collect(root, *this); }
+
+   void visit(TerminalNode& leaf) override
+   {
+      normalize_literal(leaf);
+      publish(&leaf);
+   }
+   void visit(UnaryNode& unary) override
+   {
+      if (!update_children(unary)) {
+         publish(&unary);
+         return;
+      }
+      Node* child = unary.m_child;
+      if (unary.m_func == FunctionId::Identity) { // +x -> x
+         unary.m_child = nullptr;
+         delete &unary;
+         m_nodes.push(child);
+         return;
+      }
+      UnaryNode* inner = dynamic_cast<UnaryNode*>(child);
+      if (unary.m_func == FunctionId::Negate && inner && inner->m_func == FunctionId::Negate) {
+         Node* grandchild = inner->m_child; // -(-x) -> x
+         inner->m_child = nullptr;
+         unary.m_child = nullptr;
+         m_hashes.erase(inner);
+         delete inner;
+         delete &unary;
+         m_nodes.push(grandchild);
+         return;
+      }
+      publish(&unary);
+   }
+   void visit(BinaryNode& binary) override
+   {
+      if (!update_children(binary) || !is_commutative(binary.m_operator.m_operation)) {
+         publish(&binary);
+         return;
+      }
+      Node* node = chain(binary.m_operator, { binary.m_left, binary.m_right });
+      binary.m_left = binary.m_right = nullptr;
+      delete &binary;
+      publish(node);
+   }
+   void visit(NaryNode& nary) override
+   {
+      if (!update_children(nary)) {
+         publish(&nary);
+         return;
+      }
+      Node* node = chain(nary.m_operator, nary.m_children);
+      nary.m_children.clear();
+      delete &nary;
+      publish(node);
+   }
+};
+
+AST* MEP_EXPORTS canonicalize(AST* ast)
+{
+   MEP_PHASE_SCOPE(PH_OPTIMIZE);
+   if (ast == nullptr) return nullptr;
+   Canonicalizer canonicalizer;
+   return canonicalizer.collect(ast);
+}
+
+} // ns
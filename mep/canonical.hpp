@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/parser.hpp>
+
+namespace mep {
+
+// 128 bits structural hash
+struct Hash128 {
+   uint64_t lo{ 0 };
+   uint64_t hi{ 0 };
+   bool operator==(const Hash128& other) const { return lo == other.lo && hi == other.hi; }
+   bool operator!=(const Hash128& other) const { return !(*this == other); }
+   bool operator<(const Hash128& other) const { return hi < other.hi || (hi == other.hi && lo < other.lo); }
+};
+
+/* Canonical form
+ Rewrites the tree so that expressions equal up to commutativity and associativity of
+ + and *, redundant signs and literal spelling share the same tree :
+  - every chain of + (resp. *) becomes a single n-ary node, whatever the grouping
+       a + (b + c), (a + b) + c  ->  +(a, b, c)
+  - the operands of + and * are sorted (by structural hash)
+       y + x  ->  +(x, y)
+  - unary + (Identity) and double negation are dropped
+  - literals are re-spelled from their value : 007 -> 7
+ Parentheses never reach the AST, so (a*b) and a*b are already the same tree.
+ The canonical form is meant for deduplication : floating point evaluation of the
+ reordered operands may differ in the last bits from the original expression.
+*/
+
+// Rewrites the tree in place and returns the new root (ownership is transferred)
+AST* MEP_EXPORTS canonicalize(AST* ast);
+
+// Hash of the tree structure, meant for canonical trees
+Hash128 MEP_EXPORTS structural_hash(AST* ast);
+
+// Exact structural comparison (to confirm a hash match)
+bool MEP_EXPORTS structurally_equal(AST* a, AST* b);
+
+// Same 128 bits hash over raw bytes (source texts, serialized data)
+Hash128 MEP_EXPORTS hash_bytes(const void* data, size_t size);
+
+} // ns
+
+namespace std {
+template<> struct hash<mep::Hash128> {
+   size_t operator()(const mep::Hash128& h) const { return static_cast<size_t>(h.lo ^ (h.hi * 0x9E3779B97F4A7C15ull)); }
+};
+} // ns
@@ -0,0 +1,43 @@
+#pragma once
+
+// Cost table of the static cost model (see analysis.hpp) : median Profiler cycles
+// of each kind of instruction, generated by mep_bench --cost-table (see
+// bench/calibration.hpp). Regenerate it rather than edit it.
+
+namespace mep {
+namespace cost_table {
+
+// by Program::OpCode, Sum and Product also cost operand_cycles per operand
+static constexpr double opcode_cycles[] = {
+     16.7, // CONST
+     16.1, // VAR
+      0.0, // CALL (see call_cycles)
+     16.9, // ADD
+     17.2, // SUB
+     16.9, // MUL
+     17.2, // DIV
+     40.1, // MOD
+     53.1, // POW
+     12.9, // SUM
+     16.4, // PRODUCT
+};
+static constexpr double operand_cycles = 1.2;
+
+// Call, by FunctionId
+static constexpr double call_cycles[] = {
+      0.0, // Identity (no instruction)
+     11.2, // Negate
+     27.6, // abs
+     43.3, // sin
+     42.0, // cos
+     63.6, // tan
+     69.5, // asin
+     49.4, // acos
+     36.8, // atan
+     44.6, // exp
+     45.3, // log
+     57.6, // log10
+};
+
+} // ns
+} // ns
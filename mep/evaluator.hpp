@@ -14,33 +14,53 @@ public:
 };
 
 #if 1
-class Evaluator 
+class Evaluator : private IVisitor
 {
-   // traverse the AST tree and evaluate 
-   number_t evaluate_subtree(Node* ast)
+   // traverse the AST tree and evaluate, operands on an explicit stack
+   OperandStack<number_t> m_operands;
+
+   static void check(Node* child)
    {
-      if(ast == nullptr) 
+      if(child == nullptr) 
          throw EvaluatorException("Empty tree!");
-
-      if(ast->m_type == Node::N_VALUE) {
-          std::string v = dynamic_cast<TerminalNode*>(ast)->m_value;
-          return std::stod(v);
-      } else if(ast->m_type == Node::N_OPERATOR) {
-         OperatorNode* node = dynamic_cast<OperatorNode*>(ast);
-         if(node->m_operator.is_unary()) {
-            return -evaluate_subtree(dynamic_cast<UnaryNode*>(ast)->m_child);
-         } else { // assume binary
-            number_t v1 = evaluate_subtree(dynamic_cast<BinaryNode*>(ast)->m_left);
-            number_t v2 = evaluate_subtree(dynamic_cast<BinaryNode*>(ast)->m_right);
-            switch (node->m_operator.m_operation) {
-            case Operator::Add :  return v1 + v2;
-            case Operator::Sub :  return v1 - v2;
-            case Operator::Mul :  return v1 * v2;
-            case Operator::Div :  return v1 / v2;
-            }
-         }
+   }
+   void visit(TerminalNode& node) override
+   {
+      m_operands.push(std::stod(node.m_value));
+   }
+   void visit(UnaryNode& node) override
+   {
+      check(node.m_child);
+      number_t v = m_operands.pop();
+      if (node.m_func == FunctionId::Negate) {
+         m_operands.push(-v);
+      } else if (node.m_func == FunctionId::Identity) {
+         m_operands.push(v);
       } else {
-         
+         m_operands.push(call_math_function(node.m_func, v));
+      }
+   }
+   void visit(NaryNode& node) override
+   {
+      if (node.m_children.empty())
+         throw EvaluatorException("Incorrect syntax tree!");
+      for (Node* child : node.m_children) check(child);
+      const size_t n = node.m_children.size();
+      number_t acc = reduce_values(node.m_operator.m_operation, m_operands.top(n), n, false);
+      m_operands.drop(n);
+      m_operands.push(acc);
+   }
+   void visit(BinaryNode& node) override
+   {
+      check(node.m_left);
+      check(node.m_right);
+      number_t v2 = m_operands.pop();
+      number_t v1 = m_operands.pop();
+      switch (node.m_operator.m_operation) {
+      case Operator::Add :  m_operands.push(v1 + v2); return;
+      case Operator::Sub :  m_operands.push(v1 - v2); return;
+      case Operator::Mul :  m_operands.push(v1 * v2); return;
+      case Operator::Div :  m_operands.push(v1 / v2); return;
       }
       throw EvaluatorException("Incorrect syntax tree!");
    }
@@ -49,8 +69,8 @@ public:
    {
       if(ast == nullptr)
          throw EvaluatorException("Empty abstract syntax tree");
-      // recursive travering
-      return evaluate_subtree(ast);
+      // iterative traversing : no recursion on the tree depth
+      return m_operands.collect(ast, *this);
    }
 };
 #endif
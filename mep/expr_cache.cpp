@@ -0,0 +1,145 @@
+#include <mep/expr_cache.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+
+
+namespace mep {
+
+void ExpressionCache::normalize(std::string_view source, std::string& out)
+{
+   out.clear();
+   bool pending_space = false;
+   for (char c : source) {
+      if (::isspace(static_cast<unsigned char>(c))) {
+         pending_space = true;
+         continue;
+      }
+      if (pending_space && !out.empty() && ::isalnum(static_cast<unsigned char>(out.back()))
+          && ::isalnum(static_cast<unsigned char>(c))) {
+         out.push_back(' ');
+      }
+      pending_space = false;
+      out.push_back(c);
+   }
+}
+
+ExpressionCache::ExpressionCache()
+   : ExpressionCache(Limits())
+{
+}
+
+ExpressionCache::ExpressionCache(Limits limits)
+   : m_limits(limits)
+{
+   m_limits.nb_shards = std::max<size_t>(m_limits.nb_shards, 1);
+   for (size_t i = 0; i < m_limits.nb_shards; ++i) {
+      m_shards.push_back(std::make_unique<Shard>());
+   }
+}
+
+ExpressionCache::Shard& ExpressionCache::shard_of(std::string_view key)
+{
+   return *m_shards[std::hash<std::string_view>()(key) % m_shards.size()];
+}
+
+// shard must be locked
+CompiledExpression ExpressionCache::lookup(Shard& shard, std::string_view key, bool count_miss)
+{
+   auto search = shard.index.find(key);
+   if (search == shard.index.end()) {
+      if (count_miss) shard.misses++;
+      return nullptr;
+   }
+   shard.lru.splice(shard.lru.begin(), shard.lru, search->second);
+   shard.hits++;
+   return search->second->expr;
+}
+
+// shard must be locked
+void ExpressionCache::evict(Shard& shard)
+{
+   const size_t max_entries = std::max<size_t>(m_limits.max_entries / m_shards.size(), 1);
+   const size_t max_bytes = m_limits.max_bytes / m_shards.size();
+   // the most recent entry is always kept, even if larger than the budget
+   while (shard.lru.size() > 1 && (shard.lru.size() > max_entries || shard.bytes > max_bytes)) {
+      Entry& victim = shard.lru.back();
+      shard.index.erase(victim.key);
+      shard.bytes -= victim.bytes;
+      shard.lru.pop_back();
+      shard.evictions++;
+   }
+}
+
+CompiledExpression ExpressionCache::find(std::string_view source)
+{
+   thread_local std::string key;
+   normalize(source, key);
+   Shard& shard = shard_of(key);
+   std::lock_guard<std::mutex> lock(shard.mutex);
+   return lookup(shard, key, true);
+}
+
+CompiledExpression ExpressionCache::get(std::string_view source)
+{
+   thread_local std::string key;
+   normalize(source, key);
+   Shard& shard = shard_of(key);
+   {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (CompiledExpression expr = lookup(shard, key, true)) return expr;
+   }
+
+   // miss : compile outside of the lock
+   Parser parser;
+   AST* ast = parser.parse(key);
+   std::shared_ptr<Program> prog;
+   try {
+      prog = std::make_shared<Program>(compile(ast));
+   } catch (...) {
+      delete ast;
+      throw;
+   }
+   delete ast;
+
+   std::lock_guard<std::mutex> lock(shard.mutex);
+   // another thread may have inserted it meanwhile
+   auto search = shard.index.find(key);
+   if (search != shard.index.end()) {
+      return search->second->expr;
+   }
+   Entry entry{ key, prog, 0 };
+   entry.bytes = sizeof(Entry) + key.size() + prog->footprint();
+   shard.bytes += entry.bytes;
+   shard.lru.push_front(std::move(entry));
+   shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+   evict(shard);
+   return prog;
+}
+
+void ExpressionCache::clear()
+{
+   for (auto& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->index.clear();
+      shard->lru.clear();
+      shard->bytes = 0;
+   }
+}
+
+ExpressionCache::Stats ExpressionCache::stats() const
+{
+   Stats stats;
+   for (auto& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      stats.hits += shard->hits;
+      stats.misses += shard->misses;
+      stats.evictions += shard->evictions;
+      stats.entries += shard->lru.size();
+      stats.bytes += shard->bytes;
+   }
+   return stats;
+}
+
+} // ns
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/program.hpp>
+
+namespace mep {
+
+using CompiledExpression = std::shared_ptr<const Program>;
+
+/* Cache of compiled expressions keyed by their source text
+ Sources are normalized first : whitespace is dropped, except a single space between
+ two alphanumeric characters ("1 2" must not become "12"), so "x+y" and " x + y "
+ share the same entry.
+ The cache is split in shards (by hash of the normalized text), each one with its own
+ lock and LRU list. A hit does not allocate : the normalized text is built in a per
+ thread buffer and the returned handle is a shared_ptr copy.
+
+    ExpressionCache cache;
+    CompiledExpression expr = cache.get("x * exp(-k*t)"); // parses/compiles on miss
+    expr->evaluate(vars);
+*/
+class MEP_EXPORTS ExpressionCache {
+public:
+   struct Limits {
+      size_t max_entries{ 4096 };
+      size_t max_bytes{ 64 * 1024 * 1024 };
+      size_t nb_shards{ 16 };
+   };
+   struct Stats {
+      uint64_t hits{ 0 };
+      uint64_t misses{ 0 };
+      uint64_t evictions{ 0 };
+      size_t entries{ 0 };
+      size_t bytes{ 0 };
+   };
+private:
+   struct Entry {
+      std::string key;           // normalized source
+      CompiledExpression expr;
+      size_t bytes;
+   };
+   struct Shard {
+      std::mutex mutex;
+      std::list<Entry> lru;      // most recently used first
+      std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // views on Entry::key
+      size_t bytes{ 0 };
+      uint64_t hits{ 0 };
+      uint64_t misses{ 0 };
+      uint64_t evictions{ 0 };
+   };
+   Limits m_limits;
+   std::vector<std::unique_ptr<Shard>> m_shards;
+
+   Shard& shard_of(std::string_view key);
+   CompiledExpression lookup(Shard& shard, std::string_view key, bool count_miss);
+   void evict(Shard& shard);
+public:
+   ExpressionCache();
+   explicit ExpressionCache(Limits limits);
+
+   // compiled expression of source, parsed and compiled on miss
+   // (throws as Parser::parse on invalid input, failures are not cached)
+   CompiledExpression get(std::string_view source);
+   // nullptr on miss
+   CompiledExpression find(std::string_view source);
+
+   void clear();
+   Stats stats() const;
+
+   static void normalize(std::string_view source, std::string& out);
+};
+
+} // ns
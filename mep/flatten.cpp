@@ -0,0 +1,70 @@
+#include <mep/flatten.hpp>
+#include <mep/instrumentation.hpp>
+
+#include <algorithm>
+
+
+namespace mep {
+
+static bool is_flattenable(const Operator& op)
+{
+   return op.m_operation == Operator::Add || op.m_operation == Operator::Mul;
+}
+
+// the n-ary node replacing the left spine of binary, or binary when the chain is
+// too short. The operands are not flattened yet.
+static Node* flatten_spine(BinaryNode* binary, size_t min_operands)
+{
+   Operator op = binary->m_operator;
+   if (!is_flattenable(op)) return binary;
+
+   // walk down the left spine while the operator is the same,
+   // right operands are collected from the top so they come out reversed
+   std::vector<BinaryNode*> spine;
+   Node* node = binary;
+   while (BinaryNode* b = dynamic_cast<BinaryNode*>(node)) {
+      if (b->m_operator.m_operation != op.m_operation) break;
+      spine.push_back(b);
+      node = b->m_left;
+   }
+   if (spine.size() + 1 < std::max<size_t>(min_operands, 3)) return binary;
+
+   std::vector<Node*> operands;
+   operands.reserve(spine.size() + 1);
+   operands.push_back(node);
+   for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+      operands.push_back((*it)->m_right);
+      // detach before deletion so the operands survive
+      (*it)->m_left = nullptr;
+      (*it)->m_right = nullptr;
+      delete *it;
+   }
+
+   return new NaryNode(op, std::move(operands));
+}
+
+AST* MEP_EXPORTS flatten(AST* ast, size_t min_operands)
+{
+   MEP_PHASE_SCOPE(PH_OPTIMIZE);
+   // top down, no recursion on the tree depth : a node is replaced through the
+   // slot (parent link) holding it, then the slots of its children are scheduled
+   std::vector<Node**> slots{ &ast };
+   while (!slots.empty()) {
+      Node** slot = slots.back();
+      slots.pop_back();
+      if (BinaryNode* binary = dynamic_cast<BinaryNode*>(*slot)) {
+         *slot = flatten_spine(binary, min_operands);
+      }
+      if (UnaryNode* unary = dynamic_cast<UnaryNode*>(*slot)) {
+         slots.push_back(&unary->m_child);
+      } else if (NaryNode* nary = dynamic_cast<NaryNode*>(*slot)) {
+         for (Node*& child : nary->m_children) slots.push_back(&child);
+      } else if (BinaryNode* binary = dynamic_cast<BinaryNode*>(*slot)) {
+         slots.push_back(&binary->m_left);
+         slots.push_back(&binary->m_right);
+      }
+   }
+   return ast;
+}
+
+} // ns
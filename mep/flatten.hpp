@@ -0,0 +1,26 @@
+#pragma once
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/parser.hpp>
+
+namespace mep {
+
+/* Flattening pass
+ The parser builds strictly binary left-deep trees :
+    a + b + c + d   parses to   +(+(+(a,b),c),d)
+ the pass rewrites left-deep chains of the same associative operator (Add or Mul)
+ into a single n-ary node :
+    +(a, b, c, d)
+
+ Only the left spine is flattened : explicit grouping on the right as in a + (b + c)
+ is kept untouched, so a sequential reduction of the n-ary node gives bit for bit the
+ same result as the original tree. Pairwise reduction is then an evaluation option
+ (see EvaluteVisitor::pairwise).
+*/
+
+// Rewrites the tree in place and returns the new root (ownership is transferred),
+// chains with less than min_operands operands are left binary
+AST* MEP_EXPORTS flatten(AST* ast, size_t min_operands = 3);
+
+} // ns
@@ -0,0 +1,77 @@
+#include <mep/incremental.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace mep {
+
+IncrementalEvaluator::IncrementalEvaluator(Program program)
+   : m_program(std::move(program))
+   , m_vars(m_program.nb_variables(), 1)
+   , m_values(m_program.size(), 0)
+   , m_parent(m_program.size(), npos)
+   , m_var_uses(m_program.nb_variables())
+   , m_dirty(m_program.size(), 1)
+{
+   if (m_program.empty())
+      throw EvaluatorException("Empty program");
+
+   for (uint32_t i = 0; i < m_program.size(); ++i) {
+      const Program::Instr& instr = m_program.m_code[i];
+      if (instr.op == Program::Var) {
+         m_var_uses[instr.arg].push_back(i);
+      } else if (instr.op != Program::Const) {
+         const uint32_t* ops = m_program.operands(instr);
+         for (uint32_t k = 0; k < instr.count; ++k) {
+            m_parent[ops[k]] = i;
+         }
+      }
+   }
+   // first evaluate() is a full one
+   m_dirty_list.resize(m_program.size());
+   for (uint32_t i = 0; i < m_program.size(); ++i) m_dirty_list[i] = i;
+}
+
+void IncrementalEvaluator::mark_dirty(uint32_t instr)
+{
+   // stop at the first dirty ancestor : the rest of the path is already marked
+   while (instr != npos && !m_dirty[instr]) {
+      m_dirty[instr] = 1;
+      m_dirty_list.push_back(instr);
+      instr = m_parent[instr];
+   }
+}
+
+void IncrementalEvaluator::set(const std::string& var, number_t value)
+{
+   int s = m_program.slot(var);
+   if (s >= 0) set(static_cast<size_t>(s), value);
+}
+
+void IncrementalEvaluator::set(size_t slot, number_t value)
+{
+   if (slot >= m_vars.size())
+      throw EvaluatorException("Invalid variable slot");
+   // bitwise comparison : NaN == NaN, and -0 != +0
+   if (std::memcmp(&m_vars[slot], &value, sizeof(value)) == 0) return;
+   m_vars[slot] = value;
+   for (uint32_t use : m_var_uses[slot]) {
+      mark_dirty(use);
+   }
+}
+
+number_t IncrementalEvaluator::evaluate()
+{
+   // program order guarantees operands are recomputed before their users
+   std::sort(m_dirty_list.begin(), m_dirty_list.end());
+   for (uint32_t i : m_dirty_list) {
+      m_values[i] = m_program.compute(i, m_vars.data(), m_values.data());
+      m_dirty[i] = 0;
+   }
+   m_nb_recomputed = m_dirty_list.size();
+   m_dirty_list.clear();
+   return m_values.back();
+}
+
+} // ns
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/program.hpp>
+
+namespace mep {
+
+/* Incremental evaluation
+ Every instruction of the compiled expression caches its last value. Changing a
+ variable marks dirty the instructions on the path from its uses up to the root,
+ evaluate() then recomputes only those, in program order (operands first).
+ For an expression with n nodes where a single variable changes, the cost of
+ evaluate() is the depth of its uses instead of n.
+
+    IncrementalEvaluator eval(compile(ast));
+    eval.set("x", 2);
+    number_t v = eval.evaluate();  // full evaluation the first time
+    eval.set("y", 3);
+    v = eval.evaluate();           // only the path from y to the root
+*/
+class MEP_EXPORTS IncrementalEvaluator {
+   static constexpr uint32_t npos = UINT32_MAX;
+
+   Program m_program;
+   std::vector<number_t> m_vars;                 // slot -> current value
+   std::vector<number_t> m_values;               // instruction -> cached value
+   std::vector<uint32_t> m_parent;               // instruction -> user instruction (npos for the root)
+   std::vector<std::vector<uint32_t>> m_var_uses;// slot -> Var instructions reading it
+   std::vector<uint8_t>  m_dirty;                // instruction -> needs recompute
+   std::vector<uint32_t> m_dirty_list;           // dirty instructions (unsorted)
+   size_t m_nb_recomputed{ 0 };
+
+   void mark_dirty(uint32_t instr);
+public:
+   // unknown variables default to 1 (as in EvaluteVisitor)
+   IncrementalEvaluator(Program program);
+
+   const Program& program() const { return m_program; }
+
+   // slot of a variable, -1 if the expression does not reference it
+   int slot(const std::string& var) const { return m_program.slot(var); }
+
+   // setting a variable the expression does not reference is a no-op
+   void set(const std::string& var, number_t value);
+   void set(size_t slot, number_t value);
+   number_t get(size_t slot) const { return m_vars[slot]; }
+
+   // recomputes the dirty instructions only
+   number_t evaluate();
+
+   // number of instructions recomputed by the last evaluate()
+   size_t nb_recomputed() const { return m_nb_recomputed; }
+};
+
+} // ns
@@ -0,0 +1,277 @@
+#include <mep/instrumentation.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+
+namespace mep {
+
+namespace {
+
+// written by its thread only : relaxed load + store, no read-modify-write
+struct ThreadStats {
+   std::atomic<uint64_t> count[PH_NB_PHASES]{};
+   std::atomic<uint64_t> total_ns[PH_NB_PHASES]{};
+   std::atomic<uint64_t> buckets[PH_NB_PHASES][PhaseStats::nb_buckets]{};
+   std::atomic<uint64_t> events[EV_NB_EVENTS]{};
+};
+
+inline void bump(std::atomic<uint64_t>& value, uint64_t n)
+{
+   value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void add(InstrumentationSnapshot& sum, const ThreadStats& stats)
+{
+   for (int p = 0; p < PH_NB_PHASES; ++p) {
+      PhaseStats& phase = sum.phases[p];
+      phase.count += stats.count[p].load(std::memory_order_relaxed);
+      phase.total_ns += stats.total_ns[p].load(std::memory_order_relaxed);
+      for (unsigned b = 0; b < PhaseStats::nb_buckets; ++b) {
+         phase.buckets[b] += stats.buckets[p][b].load(std::memory_order_relaxed);
+      }
+   }
+   for (int e = 0; e < EV_NB_EVENTS; ++e) {
+      sum.events[e] += stats.events[e].load(std::memory_order_relaxed);
+   }
+}
+
+void subtract(InstrumentationSnapshot& sum, const InstrumentationSnapshot& origin)
+{
+   for (int p = 0; p < PH_NB_PHASES; ++p) {
+      PhaseStats& phase = sum.phases[p];
+      phase.count -= origin.phases[p].count;
+      phase.total_ns -= origin.phases[p].total_ns;
+      for (unsigned b = 0; b < PhaseStats::nb_buckets; ++b) {
+         phase.buckets[b] -= origin.phases[p].buckets[b];
+      }
+   }
+   for (int e = 0; e < EV_NB_EVENTS; ++e) {
+      sum.events[e] -= origin.events[e];
+   }
+}
+
+// Live threads, plus the totals of the exited ones. Never destroyed : threads may
+// exit after the static destructors
+struct Registry {
+   std::mutex mutex;
+   std::vector<ThreadStats*> threads;
+   InstrumentationSnapshot exited;
+   InstrumentationSnapshot origin; // totals at the last reset
+
+   // under mutex
+   InstrumentationSnapshot total() const
+   {
+      InstrumentationSnapshot sum = exited;
+      for (const ThreadStats* stats : threads) add(sum, *stats);
+      return sum;
+   }
+};
+
+Registry& registry()
+{
+   static Registry* instance = new Registry();
+   return *instance;
+}
+
+struct ThreadSlot {
+   ThreadStats* stats{ nullptr };
+
+   ~ThreadSlot()
+   {
+      if (!stats) return;
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      add(reg.exited, *stats);
+      reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(), stats));
+      delete stats;
+   }
+};
+
+ThreadStats& local_stats()
+{
+   thread_local ThreadSlot slot;
+   if (!slot.stats) {
+      std::unique_ptr<ThreadStats> stats(new ThreadStats());
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      reg.threads.push_back(stats.get());
+      slot.stats = stats.release();
+   }
+   return *slot.stats;
+}
+
+bool write_text(const std::string& path, const std::string& text)
+{
+   std::ofstream out(path, std::ios::binary | std::ios::trunc);
+   out << text;
+   return static_cast<bool>(out);
+}
+
+} // ns
+
+const char* MEP_EXPORTS phase_name(Phase phase)
+{
+   switch (phase) {
+   case PH_LEX: return "lex";
+   case PH_PARSE: return "parse";
+   case PH_OPTIMIZE: return "optimize";
+   case PH_COMPILE: return "compile";
+   case PH_EVALUATE: return "evaluate";
+   case PH_NB_PHASES: break;
+   }
+   return "unknown";
+}
+
+const char* MEP_EXPORTS event_name(Event event)
+{
+   switch (event) {
+   case EV_TOKENS: return "tokens";
+   case EV_NODES: return "nodes";
+   case EV_PARSE_ERRORS: return "parse_errors";
+   case EV_NB_EVENTS: break;
+   }
+   return "unknown";
+}
+
+unsigned PhaseStats::bucket_of(uint64_t ns)
+{
+   if (ns < sub_buckets) return static_cast<unsigned>(ns);
+   const uint64_t max_ns = (uint64_t(2) << max_exponent) - 1;
+   ns = std::min(ns, max_ns);
+   unsigned e = 63;
+   while (!(ns >> e)) --e; // highest bit, >= 4
+   unsigned sub = static_cast<unsigned>(ns >> (e - 4)) - sub_buckets;
+   return (e - 3) * sub_buckets + sub;
+}
+
+uint64_t PhaseStats::bucket_low(unsigned bucket)
+{
+   if (bucket < sub_buckets) return bucket;
+   unsigned e = bucket / sub_buckets + 3;
+   return uint64_t(sub_buckets + bucket % sub_buckets) << (e - 4);
+}
+
+uint64_t PhaseStats::bucket_high(unsigned bucket)
+{
+   return bucket + 1 < nb_buckets ? bucket_low(bucket + 1) : uint64_t(2) << max_exponent;
+}
+
+uint64_t PhaseStats::percentile_ns(double q) const
+{
+   if (count == 0) return 0;
+   uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(100.0, std::max(0.0, q)) / 100 * double(count)));
+   rank = std::max<uint64_t>(rank, 1);
+   uint64_t seen = 0;
+   for (unsigned b = 0; b < nb_buckets; ++b) {
+      seen += buckets[b];
+      if (seen >= rank) return bucket_high(b) - 1; // highest equivalent value
+   }
+   return bucket_high(nb_buckets - 1) - 1;
+}
+
+void MEP_EXPORTS record_phase(Phase phase, uint64_t ns)
+{
+   ThreadStats& stats = local_stats();
+   bump(stats.count[phase], 1);
+   bump(stats.total_ns[phase], ns);
+   bump(stats.buckets[phase][PhaseStats::bucket_of(ns)], 1);
+}
+
+void MEP_EXPORTS record_event(Event event, uint64_t n)
+{
+   bump(local_stats().events[event], n);
+}
+
+InstrumentationSnapshot MEP_EXPORTS instrumentation_snapshot()
+{
+   Registry& reg = registry();
+   std::lock_guard<std::mutex> lock(reg.mutex);
+   InstrumentationSnapshot snapshot = reg.total();
+   subtract(snapshot, reg.origin);
+   return snapshot;
+}
+
+void MEP_EXPORTS reset_instrumentation()
+{
+   Registry& reg = registry();
+   std::lock_guard<std::mutex> lock(reg.mutex);
+   reg.origin = reg.total();
+}
+
+std::string MEP_EXPORTS to_prometheus(const InstrumentationSnapshot& snapshot)
+{
+   // le bounds 1, 2.5, 5 x 10^k from 100ns to 10s
+   static const uint64_t bounds_ns[] = {
+      100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+      1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000,
+      500000000, 1000000000, 2500000000, 5000000000, 10000000000
+   };
+   std::ostringstream os;
+   os << "# HELP mep_phase_duration_seconds Duration of the mep phases\n"
+      << "# TYPE mep_phase_duration_seconds histogram\n";
+   for (int p = 0; p < PH_NB_PHASES; ++p) {
+      const PhaseStats& phase = snapshot.phases[p];
+      const char* name = phase_name(Phase(p));
+      uint64_t cumulated = 0;
+      unsigned b = 0;
+      for (uint64_t bound : bounds_ns) {
+         // histogram buckets entirely below the bound
+         while (b < PhaseStats::nb_buckets && PhaseStats::bucket_high(b) <= bound) {
+            cumulated += phase.buckets[b++];
+         }
+         os << "mep_phase_duration_seconds_bucket{phase=\"" << name << "\",le=\"" << double(bound) * 1e-9
+            << "\"} " << cumulated << "\n";
+      }
+      os << "mep_phase_duration_seconds_bucket{phase=\"" << name << "\",le=\"+Inf\"} " << phase.count << "\n"
+         << "mep_phase_duration_seconds_sum{phase=\"" << name << "\"} " << double(phase.total_ns) * 1e-9 << "\n"
+         << "mep_phase_duration_seconds_count{phase=\"" << name << "\"} " << phase.count << "\n";
+   }
+   os << "# HELP mep_events_total Events counted by mep\n"
+      << "# TYPE mep_events_total counter\n";
+   for (int e = 0; e < EV_NB_EVENTS; ++e) {
+      os << "mep_events_total{event=\"" << event_name(Event(e)) << "\"} " << snapshot.events[e] << "\n";
+   }
+   return os.str();
+}
+
+std::string MEP_EXPORTS to_json(const InstrumentationSnapshot& snapshot)
+{
+   std::ostringstream os;
+   os << "{\n  \"phases\": {\n";
+   for (int p = 0; p < PH_NB_PHASES; ++p) {
+      const PhaseStats& phase = snapshot.phases[p];
+      os << "    \"" << phase_name(Phase(p)) << "\": {\"count\": " << phase.count
+         << ", \"total_ns\": " << phase.total_ns
+         << ", \"mean_ns\": " << phase.mean_ns()
+         << ", \"p50_ns\": " << phase.percentile_ns(50)
+         << ", \"p90_ns\": " << phase.percentile_ns(90)
+         << ", \"p99_ns\": " << phase.percentile_ns(99)
+         << ", \"p999_ns\": " << phase.percentile_ns(99.9)
+         << ", \"max_ns\": " << phase.max_ns() << "}"
+         << (p + 1 < PH_NB_PHASES ? "," : "") << "\n";
+   }
+   os << "  },\n  \"events\": {";
+   for (int e = 0; e < EV_NB_EVENTS; ++e) {
+      os << (e ? ", " : "") << "\"" << event_name(Event(e)) << "\": " << snapshot.events[e];
+   }
+   os << "}\n}\n";
+   return os.str();
+}
+
+bool MEP_EXPORTS write_prometheus(const std::string& path)
+{
+   return write_text(path, to_prometheus(instrumentation_snapshot()));
+}
+
+bool MEP_EXPORTS write_json(const std::string& path)
+{
+   return write_text(path, to_json(instrumentation_snapshot()));
+}
+
+} // ns
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+/* Per phase latency instrumentation
+ Built with MEP_INSTRUMENTATION defined (cmake -DMEP_INSTRUMENTATION=ON), the library
+ times its phases and counts a few events. Otherwise the MEP_PHASE_SCOPE / MEP_EVENT
+ macros expand to nothing and the snapshots stay empty.
+ Each thread records in its own histograms (no lock, no shared cache line), a
+ snapshot sums the threads on demand. The histograms are log-linear (HDR style) :
+ 16 linear sub-buckets per power of two, i.e. a relative error below 6.25%.
+ Parsing pulls the tokens from the lexer on demand : the parse phase includes the
+ lexing, the lex phase only times the lexer only passes (validate, collect_variables).
+*/
+
+enum Phase {
+   PH_LEX,        // validate, collect_variables
+   PH_PARSE,      // Parser::parse, try_parse
+   PH_OPTIMIZE,   // flatten, canonicalize, specialize
+   PH_COMPILE,    // compile
+   PH_EVALUATE,   // Program / ProgramView evaluate, try_evaluate
+   PH_NB_PHASES
+};
+
+enum Event {
+   EV_TOKENS,        // lexed tokens
+   EV_NODES,         // AST nodes built by the parser
+   EV_PARSE_ERRORS,
+   EV_NB_EVENTS
+};
+
+const char* MEP_EXPORTS phase_name(Phase phase);
+const char* MEP_EXPORTS event_name(Event event);
+
+struct MEP_EXPORTS PhaseStats {
+   static constexpr unsigned sub_buckets = 16;
+   static constexpr unsigned max_exponent = 43; // longer durations (> 2h) are clamped
+   static constexpr unsigned nb_buckets = (max_exponent - 2) * sub_buckets;
+
+   uint64_t count{ 0 };
+   uint64_t total_ns{ 0 };
+   std::vector<uint64_t> buckets = std::vector<uint64_t>(nb_buckets, 0);
+
+   static unsigned bucket_of(uint64_t ns);
+   static uint64_t bucket_low(unsigned bucket);  // lowest duration of the bucket
+   static uint64_t bucket_high(unsigned bucket); // first duration of the next bucket
+
+   double mean_ns() const { return count ? double(total_ns) / count : 0; }
+   // q in [0, 100], 0 when empty
+   uint64_t percentile_ns(double q) const;
+   uint64_t max_ns() const { return percentile_ns(100); }
+};
+
+struct MEP_EXPORTS InstrumentationSnapshot {
+   PhaseStats phases[PH_NB_PHASES];
+   uint64_t events[EV_NB_EVENTS]{};
+};
+
+// sum of the threads since the start or the last reset_instrumentation()
+InstrumentationSnapshot MEP_EXPORTS instrumentation_snapshot();
+void MEP_EXPORTS reset_instrumentation();
+
+std::string MEP_EXPORTS to_prometheus(const InstrumentationSnapshot& snapshot);
+std::string MEP_EXPORTS to_json(const InstrumentationSnapshot& snapshot);
+// the current snapshot, false if the file cannot be written
+bool MEP_EXPORTS write_prometheus(const std::string& path);
+bool MEP_EXPORTS write_json(const std::string& path);
+
+// recording, used through the macros below
+void MEP_EXPORTS record_phase(Phase phase, uint64_t ns);
+void MEP_EXPORTS record_event(Event event, uint64_t n);
+
+class ScopedPhase {
+   Phase m_phase;
+   std::chrono::steady_clock::time_point m_start;
+public:
+   explicit ScopedPhase(Phase phase)
+      : m_phase(phase)
+      , m_start(std::chrono::steady_clock::now())
+   {}
+   ~ScopedPhase()
+   {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+      record_phase(m_phase, static_cast<uint64_t>(ns.count()));
+   }
+   ScopedPhase(const ScopedPhase&) = delete;
+   ScopedPhase& operator=(const ScopedPhase&) = delete;
+};
+
+#ifdef MEP_INSTRUMENTATION
+# define MEP_CONCAT_IMPL(a, b) a##b
+# define MEP_CONCAT(a, b) MEP_CONCAT_IMPL(a, b)
+# define MEP_PHASE_SCOPE(phase) ::mep::ScopedPhase MEP_CONCAT(mep_phase_scope_, __LINE__)(phase)
+# define MEP_EVENT(event, n) ::mep::record_event(event, n)
+#else
+# define MEP_PHASE_SCOPE(phase) ((void)0)
+# define MEP_EVENT(event, n) ((void)0)
+#endif
+
+} // ns
@@ -13,6 +13,7 @@ char Token::to_char() const
    case TokenType::T_LP: return '(';
    case TokenType::T_RP: return ')';
    case TokenType::T_EOF: return '\0';
+   case TokenType::T_ERROR: return '!';
    }
    return '?';
 }
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <stack>
 
 #include <mep/mep_export.h>
 #include <mep/math.hpp>
 #include <mep/AST.hpp>
+#include <mep/result.hpp>
 
 namespace mep {
 
@@ -35,16 +37,31 @@ enum TokenType {
    T_TERM,
    T_LP, T_RP,
    T_EOF,
+   T_ERROR,     // lexical error, see Lexer::error()
    T_UNDEFINED
 };
 
 class Token {
 public:
    TokenType tag;
+   size_t offset{ 0 }; // position in the source text
    Token() : tag(TokenType::T_UNDEFINED) {}
 
-   Token(Token* other) : tag(other->tag) {}
+   Token(Token* other) : tag(other->tag), offset(other->offset) {}
    virtual ~Token() {}
+
+   // accounted in MEM_TOKENS (see mem_stats.hpp)
+   static void* operator new(size_t size)
+   {
+      void* p = ::operator new(size);
+      MEP_MEM_ALLOC(MEM_TOKENS, size);
+      return p;
+   }
+   static void operator delete(void* p, [[maybe_unused]] size_t size)
+   {
+      MEP_MEM_FREE(MEM_TOKENS, size);
+      ::operator delete(p);
+   }
    void clear() { tag = TokenType::T_UNDEFINED; }
    bool is_term() const { return tag == T_TERM; }
    bool is_binary() const { return tag == T_BINARY_OP; }
@@ -67,6 +84,10 @@ public:
       : Token(std::move(base))
       , term_type(tt)
    {}
+   ~TermToken()
+   {
+      MEP_MEM_STRING_FREE(value);
+   }
 
 };
 
@@ -75,6 +96,7 @@ Token* make_term_token(Token* base, const TermToken::TermType& tt,  const std::s
 {
    TermToken* tok = new TermToken(base, tt);
    tok->value = value;
+   MEP_MEM_STRING_ALLOC(tok->value);
    return tok;
 }
 
@@ -113,130 +135,175 @@ std::ostream& operator<<(std::ostream& os, const mep::Token& tok);
 
 //////////////////////////////////////////////////////////////////////////////
 // Lexer
+// next_lexeme() scans the input without allocating, peek_token() builds
+// the Token objects used by the parser on top of it.
+// The look ahead token is owned by the lexer until it is consumed,
+// consumed tokens belong to the caller.
+// Never throws : lexical errors are reported as a T_ERROR token.
+
+// a token as a slice of the input
+struct Lexeme {
+   TokenType tag{ T_UNDEFINED };
+   size_t offset{ 0 };
+   size_t length{ 0 };
+   Operator op{};                 // T_UNARY_OP, T_BINARY_OP
+   TermToken::TermType term_type{ TermToken::Number }; // T_TERM
+};
+
 class Lexer {
-   bool m_f_debug{ false };
-   std::string input_;
-   Token* m_curr_token; // look ahead token : will return this untill it is consumed
-   bool m_curr_token_consumed;
+   std::string_view input_; // not owned : must outlive the parsing
+   size_t m_pos{ 0 };
+   Token* m_curr_token{ nullptr }; // look ahead token : will return this untill it is consumed
+   bool m_curr_token_consumed{ true };
+   TokenType m_prev_tag{ T_UNDEFINED }; // tag of the last token, decides unary or binary +-
+   ErrorKind m_error{ E_NONE };
+   size_t m_nb_tokens{ 0 };
 
 public:
-   Lexer()
-      : input_("")
-      , m_curr_token_consumed(true)
+   static constexpr size_t max_identifier = 64;
+
+   Lexer() {}
+   ~Lexer()
    {
-      
+      if (!m_curr_token_consumed) delete m_curr_token;
    }
-   void init(const std::string& input)
+   Lexer(const Lexer&) = delete;
+   Lexer& operator=(const Lexer&) = delete;
+
+   void init(std::string_view input)
    {
+      if (!m_curr_token_consumed) delete m_curr_token;
       input_ = input;
+      m_pos = 0;
       m_curr_token_consumed = true;
       m_curr_token = nullptr;
+      m_prev_tag = T_UNDEFINED;
+      m_error = E_NONE;
+      m_nb_tokens = 0;
    }
 
-   void debug(bool on_or_off)
+   // lexemes scanned since init (see instrumentation.hpp)
+   size_t nb_tokens() const { return m_nb_tokens; }
+   // position of the next character to be read
+   size_t offset() const { return m_pos; }
+   ErrorKind error() const { return m_error; }
+   std::string_view text(const Lexeme& lex) const { return input_.substr(lex.offset, lex.length); }
+
+   inline char current(size_t n = 0) const
    {
-      m_f_debug = on_or_off;
+      return (m_pos + n < input_.size()) ? input_[m_pos + n] : '\0';
    }
-   inline void consume(size_t n) { input_ = input_.substr(n); }
+   inline void consume(size_t n) { m_pos += n; }
 
-   std::string consume_number() {
+   size_t scan_number() const {
       size_t n = 1;
-      while (::isdigit(input_[n])) { n++; }
-      std::string number_str(input_.data(), n);
-      consume(n);
-      return number_str;
+      while (::isdigit(static_cast<unsigned char>(current(n)))) { n++; }
+      return n;
    }
-   std::string consume_identifier()
+   size_t scan_identifier() const
    {
       size_t n = 1;
-      while (::isalnum(input_[n])) { n++; }
-      if (n > 64) {
-         throw std::exception("Identifier too long");
-      }
-      std::string id(input_.data(), n);
-      consume(n);
-      return id;
+      while (::isalnum(static_cast<unsigned char>(current(n)))) { n++; }
+      return n;
    }
 
    void consume_token()
    {
       m_curr_token_consumed = true;
-      // m_curr_token = nullptr;
-      // m_curr_token = get_next_token();
    }
-   Token* peek_token()
+
+   Lexeme next_lexeme()
    {
-      if(!m_curr_token_consumed) {
-         return m_curr_token;
+      while (m_pos < input_.size() && ::isspace(static_cast<unsigned char>(input_[m_pos]))) {
+         consume(1);
       }
-      Token* tok = new Token();
-     
-      do {
-         if (input_.empty()) {
-            tok->tag = TokenType::T_EOF; break;
-         }
-         char c = input_[0];
-         switch (c) {
-         case ' ' : case '\t' : case '\n' : case '\r' : {
-            consume(1); 
-            continue;
+      Lexeme lex;
+      lex.offset = m_pos;
+      lex.length = 1;
+
+      char c = current();
+      if (m_pos >= input_.size()) {
+         lex.tag = TokenType::T_EOF;
+         lex.length = 0;
+      } else switch (c) {
+      case '+':
+      case '-':
+         if (m_prev_tag == TokenType::T_TERM || m_prev_tag == TokenType::T_RP) {
+            lex.tag = TokenType::T_BINARY_OP;
+            lex.op.m_operation = (c == '+') ? Operator::Add : Operator::Sub;
+         } else {
+            lex.tag = TokenType::T_UNARY_OP;
+            lex.op.m_operation = Operator::Apply;
+            lex.op.m_func = (c == '+') ? FunctionId::Identity : FunctionId::Negate;
          }
-         case '+':
-         case '-':        
-            consume(1);
-            if (m_curr_token && (m_curr_token->tag == TokenType::T_TERM || m_curr_token->tag == TokenType::T_RP)) {
-               tok->tag = TokenType::T_BINARY_OP;
-               tok = make_operator_token(tok, (c == '+') ? Operator::Add : Operator::Sub);
-            } else {
-               tok->tag = TokenType::T_UNARY_OP;
-               tok = make_operator_token(tok, (c == '+') ? FunctionId::Identity : FunctionId::Negate);               
-            }
-            break;
-         case '^':
-            consume(1);
-            tok->tag = TokenType::T_BINARY_OP;
-            tok = make_operator_token(tok, Operator::Pow);
-            break;
-         case '%': 
-            consume(1);
-            tok->tag = TokenType::T_BINARY_OP;
-            tok = make_operator_token(tok, Operator::Mod);
-            break;
-         case '&': case '|':
-            consume(1);
-            tok->tag = TokenType::T_BINARY_OP;
-            tok = make_operator_token(tok, (c == '&') ? Operator::And : Operator::Or);
-            break;
-         case '*': 
-         case '/': // fall through
-            consume(1);
-            tok->tag = TokenType::T_BINARY_OP;
-            tok = make_operator_token(tok, (c == '*') ? Operator::Mul : Operator::Div);                        
-            break;
-         case '(': tok->tag = TokenType::T_LP; consume(1); break;
-         case ')': tok->tag = TokenType::T_RP; consume(1); break;
-
-         default: {
-            if(::isdigit(c)) {
-               tok->tag = TokenType::T_TERM;
-               tok = make_term_token(tok, TermToken::Number, consume_number());             
+         break;
+      case '^':
+         lex.tag = TokenType::T_BINARY_OP;
+         lex.op.m_operation = Operator::Pow;
+         break;
+      case '%':
+         lex.tag = TokenType::T_BINARY_OP;
+         lex.op.m_operation = Operator::Mod;
+         break;
+      case '&': case '|':
+         lex.tag = TokenType::T_BINARY_OP;
+         lex.op.m_operation = (c == '&') ? Operator::And : Operator::Or;
+         break;
+      case '*':
+      case '/': // fall through
+         lex.tag = TokenType::T_BINARY_OP;
+         lex.op.m_operation = (c == '*') ? Operator::Mul : Operator::Div;
+         break;
+      case '(': lex.tag = TokenType::T_LP; break;
+      case ')': lex.tag = TokenType::T_RP; break;
+
+      default: {
+         if(::isdigit(static_cast<unsigned char>(c))) {
+            lex.tag = TokenType::T_TERM;
+            lex.term_type = TermToken::Number;
+            lex.length = scan_number();
+         } else {
+            lex.length = scan_identifier();
+            FunctionId fid;
+            if (lex.length > max_identifier) {
+               lex.tag = TokenType::T_ERROR;
+               m_error = E_IDENTIFIER_TOO_LONG;
+            } else if (mep_find_function(input_.substr(m_pos, lex.length), fid)) {
+               lex.tag = TokenType::T_UNARY_OP;
+               lex.op.m_operation = Operator::Apply;
+               lex.op.m_func = fid;
             } else {
-               std::string str = consume_identifier();
-               try {
-                  FunctionId fid = mep_lookup_function(str);
-                  tok->tag = TokenType::T_UNARY_OP;
-                  tok = make_operator_token(tok, fid);
-               } catch (MepFuntionNotSupported& e) {
-                  tok->tag = TokenType::T_TERM;
-                  tok = make_term_token(tok, TermToken::Variable, str);
-               }
+               lex.tag = TokenType::T_TERM;
+               lex.term_type = TermToken::Variable;
             }
-         } break;
          }
-      } while (tok->tag == TokenType::T_UNDEFINED);
+      } break;
+      }
+      consume(lex.length);
+      m_prev_tag = lex.tag;
+      ++m_nb_tokens;
+      return lex;
+   }
+
+   Token* peek_token()
+   {
+      if(!m_curr_token_consumed) {
+         return m_curr_token;
+      }
+      Lexeme lex = next_lexeme();
+      Token base;
+      base.tag = lex.tag;
+      base.offset = lex.offset;
+      Token* tok;
+      if (lex.tag == TokenType::T_TERM) {
+         tok = make_term_token(&base, lex.term_type, std::string(text(lex)));
+      } else if (lex.tag == TokenType::T_UNARY_OP || lex.tag == TokenType::T_BINARY_OP) {
+         tok = new OperatorToken(&base, lex.op);
+      } else {
+         tok = new Token(&base);
+      }
       m_curr_token = tok;
       m_curr_token_consumed = false;
-      if(m_f_debug) std::cout << tok;
       return tok;
    }
 };
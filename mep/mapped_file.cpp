@@ -0,0 +1,69 @@
+#include <mep/mapped_file.hpp>
+#include <mep/mem_stats.hpp>
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace mep {
+
+bool MappedFile::open(const std::string& path)
+{
+   close();
+#ifndef _WIN32
+   int fd = ::open(path.c_str(), O_RDONLY);
+   if (fd < 0) return false;
+   struct stat st;
+   if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+   }
+   m_size = static_cast<size_t>(st.st_size);
+   if (m_size > 0) {
+      void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr != MAP_FAILED) {
+         m_data = static_cast<const char*>(addr);
+         m_f_mapped = true;
+      }
+   } else {
+      m_f_mapped = true; // empty file : nothing to map
+   }
+   ::close(fd);
+   if (m_f_mapped) {
+      m_f_open = true;
+      MEP_MEM_ALLOC(MEM_ARENAS, m_size);
+      return true;
+   }
+#endif
+   std::ifstream in(path, std::ios::binary);
+   if (!in) return false;
+   m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+   m_size = m_buffer.size();
+   m_data = m_buffer.data();
+   m_f_open = true;
+   MEP_MEM_ALLOC(MEM_ARENAS, m_size);
+   return true;
+}
+
+void MappedFile::close()
+{
+   if (m_f_open) MEP_MEM_FREE(MEM_ARENAS, m_size);
+#ifndef _WIN32
+   if (m_f_mapped && m_data) {
+      ::munmap(const_cast<char*>(m_data), m_size);
+   }
+#endif
+   m_buffer.clear();
+   m_data = nullptr;
+   m_size = 0;
+   m_f_mapped = false;
+   m_f_open = false;
+}
+
+} // ns
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+// Read only view of a whole file, memory mapped when the platform allows it
+// (POSIX mmap), read into memory otherwise.
+class MEP_EXPORTS MappedFile {
+   const char* m_data{ nullptr };
+   size_t m_size{ 0 };
+   bool m_f_mapped{ false };
+   bool m_f_open{ false };
+   std::vector<char> m_buffer; // fallback when mapping is not available
+public:
+   MappedFile() = default;
+   ~MappedFile() { close(); }
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   // false if the file cannot be opened
+   bool open(const std::string& path);
+   void close();
+
+   bool is_open() const { return m_f_open; }
+   bool is_mapped() const { return m_f_mapped; }
+   const char* data() const { return m_data; }
+   size_t size() const { return m_size; }
+};
+
+} // ns
@@ -1,34 +1,46 @@
 #include <mep/math.hpp>
+#include <mep/evaluator.hpp>
 #include <functional>
 #include <map>
 
 
 namespace mep {
 
-FunctionId MEP_EXPORTS mep_lookup_function(const std::string& fname)
+bool MEP_EXPORTS mep_find_function(std::string_view fname, FunctionId& id)
 {
    if (fname == "abs") {
-      return FunctionId::Abs;
+      id = FunctionId::Abs;
    } else if (fname == "sin") {
-      return FunctionId::Sin;
+      id = FunctionId::Sin;
    } else if (fname == "cos") {
-      return FunctionId::Cos;
+      id = FunctionId::Cos;
    } else if (fname == "tan") {
-      return FunctionId::Tan;
+      id = FunctionId::Tan;
    } else if (fname == "asin") {
-      return FunctionId::Asin;
+      id = FunctionId::Asin;
    } else if (fname == "acos") {
-      return FunctionId::Acos;
+      id = FunctionId::Acos;
    } else if (fname == "atan") {
-      return FunctionId::Atan;
+      id = FunctionId::Atan;
    } else if (fname == "exp") {
-      return FunctionId::Exp;
+      id = FunctionId::Exp;
    } else if (fname == "log") {
-      return FunctionId::Log;
+      id = FunctionId::Log;
    } else if (fname == "log10") {
-      return FunctionId::Log10;
+      id = FunctionId::Log10;
+   } else {
+      return false;
    }
-   throw MepFuntionNotSupported();
+   return true;
+}
+
+FunctionId MEP_EXPORTS mep_lookup_function(const std::string& fname)
+{
+   FunctionId id;
+   if (!mep_find_function(fname, id)) {
+      throw MepFuntionNotSupported();
+   }
+   return id;
 }
 
 std::string MEP_EXPORTS mep_function_name(const FunctionId& id)
@@ -51,7 +63,8 @@ std::string MEP_EXPORTS mep_function_name(const FunctionId& id)
 
 using MathFunction = std::function<number_t(const number_t)>;
 
-std::map <FunctionId, MathFunction> function_map =
+// read only : shared by the evaluating threads
+const std::map <FunctionId, MathFunction> function_map =
 {
    {FunctionId::Identity,  [](const double& x)->double { return x; }},
    {FunctionId::Negate,    [](const double& x)->double { return -x; }},
@@ -70,9 +83,10 @@ std::map <FunctionId, MathFunction> function_map =
 
 number_t MEP_EXPORTS call_math_function(const FunctionId& id, const number_t& param)
 {
-   MathFunction func = function_map[id];
-
-   return func(param);
+   auto search = function_map.find(id);
+   if (search == function_map.end())
+      throw EvaluatorException("Unknown function");
+   return search->second(param);
 }
 
 } // ns
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <mep/mep_export.h>
 #include <string>
+#include <string_view>
 
 namespace mep {
 
@@ -23,7 +24,10 @@ enum FunctionId {
    Exp, Log, Log10
 };
 
+// throws MepFuntionNotSupported for unknown names
 FunctionId MEP_EXPORTS mep_lookup_function(const std::string& fname);
+// same, without exception : false for unknown names
+bool MEP_EXPORTS mep_find_function(std::string_view fname, FunctionId& id);
 std::string MEP_EXPORTS mep_function_name(const FunctionId& fname);
 
 } // ns
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <mep/mem_stats.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+
+namespace mep {
+
+namespace {
+
+// one block per thread, on its own cache lines
+struct alignas(64) ThreadCounters {
+   std::atomic<uint64_t> values[MEM_NB_CATEGORIES][4]{}; // allocations, frees, bytes allocated, bytes freed
+};
+
+enum { ALLOCATIONS, FREES, BYTES_ALLOCATED, BYTES_FREED };
+
+// Live threads, plus the totals of the exited ones. Never destroyed : nodes may be
+// freed after the static destructors
+struct Registry {
+   std::mutex mutex;
+   std::vector<ThreadCounters*> threads;
+   ThreadCounters exited; // also counts the threads past their thread_local destruction
+};
+
+Registry& registry()
+{
+   static Registry* instance = new Registry();
+   return *instance;
+}
+
+void merge(ThreadCounters& into, const ThreadCounters& from)
+{
+   for (int c = 0; c < MEM_NB_CATEGORIES; ++c) {
+      for (int k = 0; k < 4; ++k) {
+         into.values[c][k].fetch_add(from.values[c][k].load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+   }
+}
+
+// trivially destructible : still readable while the thread_local objects are destroyed
+thread_local ThreadCounters* t_counters = nullptr;
+thread_local bool t_exited = false;
+
+struct ThreadExit {
+   ~ThreadExit()
+   {
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      merge(reg.exited, *t_counters);
+      reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(), t_counters));
+      delete t_counters;
+      t_counters = nullptr;
+      t_exited = true;
+   }
+};
+
+void record(MemCategory category, int count, int bytes, size_t n)
+{
+   if (t_counters == nullptr) {
+      if (t_exited) { // shared, contended but rare
+         Registry& reg = registry();
+         reg.exited.values[category][count].fetch_add(1, std::memory_order_relaxed);
+         reg.exited.values[category][bytes].fetch_add(n, std::memory_order_relaxed);
+         return;
+      }
+      thread_local ThreadExit on_exit;
+      (void)on_exit;
+      ThreadCounters* counters = new ThreadCounters();
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      reg.threads.push_back(counters);
+      t_counters = counters;
+   }
+   // written by this thread only : relaxed load + store, no read-modify-write
+   std::atomic<uint64_t>& c = t_counters->values[category][count];
+   std::atomic<uint64_t>& b = t_counters->values[category][bytes];
+   c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   b.store(b.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // ns
+
+const char* MEP_EXPORTS mem_category_name(MemCategory category)
+{
+   switch (category) {
+   case MEM_TOKENS: return "tokens";
+   case MEM_AST_NODES: return "AST nodes";
+   case MEM_STRINGS: return "strings";
+   case MEM_ARENAS: return "arenas";
+   case MEM_CODE: return "code";
+   case MEM_NB_CATEGORIES: break;
+   }
+   return "unknown";
+}
+
+void MEP_EXPORTS record_alloc(MemCategory category, size_t bytes)
+{
+   record(category, ALLOCATIONS, BYTES_ALLOCATED, bytes);
+}
+
+void MEP_EXPORTS record_free(MemCategory category, size_t bytes)
+{
+   record(category, FREES, BYTES_FREED, bytes);
+}
+
+MemStats MEP_EXPORTS mem_stats()
+{
+   Registry& reg = registry();
+   std::lock_guard<std::mutex> lock(reg.mutex);
+   ThreadCounters sum;
+   merge(sum, reg.exited);
+   for (const ThreadCounters* counters : reg.threads) merge(sum, *counters);
+
+   MemStats stats;
+   for (int c = 0; c < MEM_NB_CATEGORIES; ++c) {
+      MemCounters& out = stats.categories[c];
+      out.allocations = sum.values[c][ALLOCATIONS].load(std::memory_order_relaxed);
+      out.frees = sum.values[c][FREES].load(std::memory_order_relaxed);
+      out.bytes_allocated = sum.values[c][BYTES_ALLOCATED].load(std::memory_order_relaxed);
+      out.bytes_freed = sum.values[c][BYTES_FREED].load(std::memory_order_relaxed);
+   }
+   return stats;
+}
+
+void MEP_EXPORTS show_mem_stats(std::ostream& os)
+{
+#ifndef MEP_MEM_STATS
+   os << "Allocation accounting disabled (build with MEP_MEM_STATS)" << std::endl;
+#endif
+   const MemStats stats = mem_stats();
+   os << std::left << std::setw(12) << "category" << std::right
+      << std::setw(14) << "allocated" << std::setw(14) << "freed" << std::setw(12) << "live"
+      << std::setw(16) << "bytes" << std::setw(16) << "live bytes" << std::endl;
+   auto show = [&](const char* name, const MemCounters& c) {
+      os << std::left << std::setw(12) << name << std::right
+         << std::setw(14) << c.allocations << std::setw(14) << c.frees << std::setw(12) << c.live_allocations()
+         << std::setw(16) << c.bytes_allocated << std::setw(16) << c.live_bytes() << std::endl;
+   };
+   for (int c = 0; c < MEM_NB_CATEGORIES; ++c) {
+      show(mem_category_name(MemCategory(c)), stats.categories[c]);
+   }
+   show("total", stats.total());
+}
+
+} // ns
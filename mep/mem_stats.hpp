@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+/* Allocation accounting
+ Built with MEP_MEM_STATS defined (cmake -DMEP_MEM_STATS=ON), the library counts its
+ allocations, frees and bytes by category. Otherwise the MEP_MEM_* macros expand to
+ nothing and mem_stats() stays empty.
+ Each thread counts in its own cache line aligned block, mem_stats() sums them on
+ demand : frees may be counted by another thread than the allocation.
+ Categories :
+    tokens     lexer tokens (Token operator new / delete)
+    AST nodes  Node operator new / delete
+    strings    heap part of the token and leaf names (short names are inline)
+    arenas     file images (MappedFile, mapped or read)
+    code       instruction, operand and constant arrays of the Programs
+*/
+
+enum MemCategory {
+   MEM_TOKENS,
+   MEM_AST_NODES,
+   MEM_STRINGS,
+   MEM_ARENAS,
+   MEM_CODE,
+   MEM_NB_CATEGORIES
+};
+
+const char* MEP_EXPORTS mem_category_name(MemCategory category);
+
+struct MemCounters {
+   uint64_t allocations{ 0 };
+   uint64_t frees{ 0 };
+   uint64_t bytes_allocated{ 0 };
+   uint64_t bytes_freed{ 0 };
+
+   int64_t live_allocations() const { return int64_t(allocations - frees); }
+   int64_t live_bytes() const { return int64_t(bytes_allocated - bytes_freed); }
+};
+
+struct MemStats {
+   MemCounters categories[MEM_NB_CATEGORIES];
+
+   const MemCounters& operator[](MemCategory category) const { return categories[category]; }
+   MemCounters total() const
+   {
+      MemCounters sum;
+      for (const MemCounters& c : categories) {
+         sum.allocations += c.allocations;
+         sum.frees += c.frees;
+         sum.bytes_allocated += c.bytes_allocated;
+         sum.bytes_freed += c.bytes_freed;
+      }
+      return sum;
+   }
+};
+
+// sum of all the threads since the start
+MemStats MEP_EXPORTS mem_stats();
+void MEP_EXPORTS show_mem_stats(std::ostream& os = std::cout);
+
+// recording, used through the macros below
+void MEP_EXPORTS record_alloc(MemCategory category, size_t bytes);
+void MEP_EXPORTS record_free(MemCategory category, size_t bytes);
+
+// heap bytes of a string, 0 when held inline (small string optimization)
+inline size_t string_heap_bytes(const std::string& s)
+{
+   static const size_t inline_capacity = std::string().capacity();
+   return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+#ifdef MEP_MEM_STATS
+# define MEP_MEM_ALLOC(category, bytes) ::mep::record_alloc(category, bytes)
+# define MEP_MEM_FREE(category, bytes) ::mep::record_free(category, bytes)
+# define MEP_MEM_STRING_ALLOC(s) \
+   do { if (size_t mep_n_ = ::mep::string_heap_bytes(s)) ::mep::record_alloc(::mep::MEM_STRINGS, mep_n_); } while (0)
+# define MEP_MEM_STRING_FREE(s) \
+   do { if (size_t mep_n_ = ::mep::string_heap_bytes(s)) ::mep::record_free(::mep::MEM_STRINGS, mep_n_); } while (0)
+#else
+# define MEP_MEM_ALLOC(category, bytes) ((void)0)
+# define MEP_MEM_FREE(category, bytes) ((void)0)
+# define MEP_MEM_STRING_ALLOC(s) ((void)0)
+# define MEP_MEM_STRING_FREE(s) ((void)0)
+#endif
+
+// std::allocator counting in a category, e.g. std::vector<T, TrackingAllocator<T, MEM_CODE>>
+template<class T, MemCategory C>
+struct TrackingAllocator {
+   using value_type = T;
+   template<class U> struct rebind { using other = TrackingAllocator<U, C>; };
+
+   TrackingAllocator() = default;
+   template<class U> TrackingAllocator(const TrackingAllocator<U, C>&) {}
+
+   T* allocate(size_t n)
+   {
+      T* p = std::allocator<T>().allocate(n);
+      MEP_MEM_ALLOC(C, n * sizeof(T));
+      return p;
+   }
+   void deallocate(T* p, size_t n)
+   {
+      MEP_MEM_FREE(C, n * sizeof(T));
+      std::allocator<T>().deallocate(p, n);
+   }
+
+   template<class U> bool operator==(const TrackingAllocator<U, C>&) const { return true; }
+   template<class U> bool operator!=(const TrackingAllocator<U, C>&) const { return false; }
+};
+
+} // ns
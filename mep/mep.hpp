@@ -6,6 +6,29 @@
 
 
 #include <mep/mep_export.h>
+#include <mep/result.hpp>
 #include <mep/lexer.hpp>
 #include <mep/parser.hpp>
 #include <mep/evaluator.hpp>
+#include <mep/flatten.hpp>
+#include <mep/program.hpp>
+#include <mep/incremental.hpp>
+#include <mep/thread_pool.hpp>
+#include <mep/workbook.hpp>
+#include <mep/batch.hpp>
+#include <mep/specialize.hpp>
+#include <mep/expr_cache.hpp>
+#include <mep/canonical.hpp>
+#include <mep/mapped_file.hpp>
+#include <mep/program_store.hpp>
+#include <mep/ast_binary.hpp>
+#include <mep/shared_store.hpp>
+#include <mep/registry.hpp>
+#include <mep/bulk_loader.hpp>
+#include <mep/validate.hpp>
+#include <mep/instrumentation.hpp>
+#include <mep/mem_stats.hpp>
+#include <mep/profiler.hpp>
+#include <mep/tracing.hpp>
+#include <mep/analysis.hpp>
+#include <mep/tiered.hpp>
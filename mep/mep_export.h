@@ -17,22 +17,4 @@ namespace mep {
 
 using MepException = std::runtime_error;
 
-//----------------------------------------------------------------------------
-
-struct MemTracker {
-   static int nb_created;
-   static int nb_destroyed;
-
-   MemTracker() {
-      ++nb_created; 
-   }
-   MemTracker(const MemTracker&) {
-      ++nb_created;
-   }
-protected:
-   ~MemTracker() { ++nb_destroyed; }
-public:
-   static void MEP_EXPORTS show_mem_stats();
-};
-
 } // ns
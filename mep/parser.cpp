@@ -11,6 +11,13 @@
 #include <mep.hpp>
 
 #include <mep/parser.hpp>
+#include <mep/instrumentation.hpp>
+#include <mep/tracing.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
 /*
 
 */
@@ -18,6 +25,21 @@
 
 namespace mep {
 
+Parser::~Parser()
+{
+   clear_stacks();
+   delete m_previous_token;
+}
+
+bool Parser::fail(ErrorKind kind, size_t offset)
+{
+   if (m_error.kind == E_NONE) { // keep the first error
+      m_error.kind = kind;
+      m_error.offset = offset;
+   }
+   return false;
+}
+
 Token* Parser::peek_token() 
 {
    return lexer.peek_token();
@@ -30,13 +52,22 @@ void Parser::consume_token(Token* tok)
    m_previous_token = tok;
 }
 
-void Parser::expect_token(TokenType tok_type)
+bool Parser::expect_token(TokenType tok_type)
 {
    Token* next = lexer.peek_token();
    if (next->tag != tok_type) {
-      throw ParserException("Expected token not found");
+      if (next->tag == TokenType::T_ERROR) {
+         return fail(lexer.error(), next->offset);
+      }
+      switch (tok_type) {
+      case TokenType::T_LP: return fail(E_EXPECTED_LP, next->offset);
+      case TokenType::T_RP: return fail(E_EXPECTED_RP, next->offset);
+      default: return fail(E_TRAILING_INPUT, next->offset);
+      }
    }
    lexer.consume_token();
+   delete next;
+   return true;
 }
 
 
@@ -53,76 +84,95 @@ AST* Parser::mk_binary(Operator& op, AST* left, AST* right) {
    return node;
 }
 
+void Parser::push_operand(AST* node, size_t nesting)
+{
+   m_var_stack.push({ node, nesting });
+   if (++m_nb_nodes > m_limits.max_nodes) {
+      fail(E_TOO_LARGE, m_offset);
+   }
+   if (nesting > m_limits.max_depth) {
+      fail(E_TOO_DEEP, m_offset);
+   }
+}
+
 
 Operator Parser::reduce_top_operator()
 {
    Operator top = m_op_stack.top(); m_op_stack.pop();
    if (top.is_binary()) {
-      AST* right = m_var_stack.top(); m_var_stack.pop();
-      AST* left = m_var_stack.top(); m_var_stack.pop();
-      m_var_stack.push(mk_binary(top, left, right));
+      Operand right = m_var_stack.top(); m_var_stack.pop();
+      Operand left = m_var_stack.top(); m_var_stack.pop();
+      push_operand(mk_binary(top, left.node, right.node), std::max(left.nesting, right.nesting));
    } else {
-      AST* child = m_var_stack.top(); m_var_stack.pop();
-      m_var_stack.push(mk_unary(top.m_func, child));
+      // a function nests by its parenthesis
+      Operand child = m_var_stack.top(); m_var_stack.pop();
+      push_operand(mk_unary(top.m_func, child.node), child.nesting + (top.is_sign() ? 1 : 0));
    }
 
    return m_op_stack.top();
 }
 
-void Parser::insert_operator_ontop(OperatorToken& tok)
+bool Parser::insert_operator_ontop(OperatorToken& tok)
 {
+   if (tok.op.m_operation == Operator::And || tok.op.m_operation == Operator::Or) {
+      return fail(E_UNSUPPORTED_OPERATOR, tok.offset);
+   }
    Operator top = m_op_stack.top();
    while( top.rank() >= tok.op.rank() ) { // precedence check
       top = reduce_top_operator();
    }
    m_op_stack.push(tok.op);
-
+   return true;
 }
 
 
-void Parser::parse_E()
+bool Parser::parse_E()
 {
-   parse_T();
-   
+   m_open = 0;
+   m_expect_term = true;
    while (true) {
       Token* tok = peek_token();
-      if (!tok->is_binary()) break;
-
-      OperatorToken* ot = dynamic_cast<OperatorToken*>(tok);
-      insert_operator_ontop(*ot);
-      consume_token(ot);
-      parse_T();
+      m_offset = tok->offset;
+      if (tok->tag == TokenType::T_ERROR) {
+         return fail(lexer.error(), tok->offset);
+      }
+      if (!m_expect_term && tok->tag == TokenType::T_EOF && m_open == 0) {
+         break;
+      }
+      bool ok = m_expect_term ? parse_T() : parse_B();
+      if (!ok || m_error.kind != E_NONE) return false; // limits are checked while reducing
    }
 
    Operator top = m_op_stack.top();
    while (top.m_operation != Operator::Nil) {
       top = reduce_top_operator();
    }
+   return m_error.kind == E_NONE;
 }
 
-void Parser::parse_T()
+// a term or the start of one : T --> v | "(" E ")" | U T | F "(" E ")"
+bool Parser::parse_T()
 {
    Token* tok = peek_token();
    if (tok->tag == TokenType::T_TERM) {
       TermToken* tt = dynamic_cast<TermToken*>(tok);
       consume_token(tok);
-      m_var_stack.push(mk_leaf(tt->value));
+      push_operand(mk_leaf(tt->value), 0);
+      m_expect_term = false;
    } else if (tok->tag == TokenType::T_LP) {
       consume_token(tok);
       m_op_stack.push(sentinel);
-      parse_E();
-      expect_token(TokenType::T_RP);
-      m_op_stack.pop(); // pop the sentinel
+      ++m_open;
    } else if (tok->tag == TokenType::T_UNARY_OP) {
       OperatorToken* ut = dynamic_cast<OperatorToken*>(tok);
       if(!ut->op.is_sign()) { // expect function call ala func(expr)
-         m_op_stack.push(sentinel);
+         // prefix operator : reduced once its argument is, the sentinel
+         // keeps it out of the argument expression
          m_op_stack.push(ut->op);
          consume_token(tok);
-         expect_token(TokenType::T_LP);
-         parse_E();
-         expect_token(TokenType::T_RP);
-         m_op_stack.pop(); // pop the sentinel
+         if (!expect_token(TokenType::T_LP)) return false;
+         m_op_stack.push(sentinel);
+         ++m_open;
       } else { // sign operators : handle special cases as --X, +-X, +-+X, -+X, etc.
          bool previous_is_sign = false;
          if(m_previous_token && m_previous_token->tag == TokenType::T_UNARY_OP) {
@@ -139,38 +189,239 @@ void Parser::parse_T()
                // insert_operator_ontop(tok.op);
                m_op_stack.push(ut->op);
             }
-            parse_T();
          } else {
             consume_token(ut);
-            insert_operator_ontop(*ut);
-            parse_T();
+            if (!insert_operator_ontop(*ut)) return false;
+         }
+      }
+   } else {
+      return fail(E_UNEXPECTED_TOKEN, tok->offset);
+   }
+   return true;
+}
+
+// after a term : B T, the end of a parenthesised E, or the end of the input
+bool Parser::parse_B()
+{
+   Token* tok = peek_token();
+   if (tok->is_binary()) {
+      OperatorToken* ot = dynamic_cast<OperatorToken*>(tok);
+      if (!insert_operator_ontop(*ot)) return false;
+      consume_token(ot);
+      m_expect_term = true;
+   } else if (tok->tag == TokenType::T_RP && m_open > 0) {
+      Operator top = m_op_stack.top();
+      while (top.m_operation != Operator::Nil) {
+         top = reduce_top_operator();
       }
+      if (!expect_token(TokenType::T_RP)) return false;
+      m_op_stack.pop(); // pop the sentinel
+      --m_open;
+      if (++m_var_stack.top().nesting > m_limits.max_depth) {
+         return fail(E_TOO_DEEP, m_offset);
       }
    } else {
-      throw ParserException("error");
+      return fail(m_open > 0 ? E_EXPECTED_RP : E_TRAILING_INPUT, tok->offset);
    }
+   return true;
 }
 
+void Parser::clear_stacks()
+{
+   // partial trees left by a failed parse
+   while (!m_var_stack.empty()) {
+      delete m_var_stack.top().node;
+      m_var_stack.pop();
+   }
+   m_op_stack = std::stack<Operator>();
+}
 
-AST* Parser::parse(const std::string& input)
+void Parser::reset(const std::string& input)
 {
-   // prepare
    lexer.init(input);
-   // lexer.debug(true);
+   m_error = Error();
+   m_nb_nodes = 0;
 
-   m_op_stack = std::stack<Operator>(); // TODO : properly clean
+   clear_stacks();
    m_op_stack.push(sentinel);
    if (m_previous_token) delete m_previous_token;
    m_previous_token = nullptr;
+}
+
+Result<AST*> Parser::try_parse(const std::string& input)
+{
+   MEP_PHASE_SCOPE(PH_PARSE);
+   MEP_TRACE_SPAN("parse", current_trace_id(trace_id(input)));
+   reset(input);
+   const bool parsed = parse_E() && expect_token(TokenType::T_EOF);
+   MEP_EVENT(EV_TOKENS, lexer.nb_tokens());
+   if (!parsed) {
+      MEP_EVENT(EV_PARSE_ERRORS, 1);
+      clear_stacks();
+      return m_error;
+   }
+   MEP_EVENT(EV_NODES, m_nb_nodes);
+   AST* ast = m_var_stack.top().node;
+   m_var_stack.pop();
+   return ast;
+}
+
+AST* Parser::parse(const std::string& input)
+{
+   Result<AST*> res = try_parse(input);
+   if (!res) {
+      throw ParserException(res.error().to_string());
+   }
+   return res.value();
+}
 
-   m_var_stack = std::stack<AST*>(); // TODO : properly clean
 
-   // start
-   parse_E();
-   expect_token(TokenType::T_EOF);
-   return m_var_stack.top();
+const char* MEP_EXPORTS error_message(ErrorKind kind)
+{
+   switch (kind) {
+   case E_NONE: return "No error";
+   case E_UNEXPECTED_TOKEN: return "Unexpected token";
+   case E_EXPECTED_LP: return "Expected '('";
+   case E_EXPECTED_RP: return "Expected ')'";
+   case E_TRAILING_INPUT: return "Expected end of input";
+   case E_UNSUPPORTED_OPERATOR: return "Unsupported operator";
+   case E_IDENTIFIER_TOO_LONG: return "Identifier too long";
+   case E_INVALID_NUMBER: return "Invalid number";
+   case E_INVALID_TREE: return "Invalid expression tree";
+   case E_TOO_DEEP: return "Expression too deeply nested";
+   case E_TOO_LARGE: return "Expression too large";
+   }
+   return "Unknown error";
+}
+
+Result<AST*> MEP_EXPORTS try_parse(const std::string& input, const ParserLimits& limits)
+{
+   Parser parser(limits);
+   return parser.try_parse(input);
 }
 
+namespace {
+
+// EvaluteVisitor counterpart reporting errors instead of throwing,
+// driven by walk_postorder (null children are skipped by the walk)
+class CheckedEvaluator : public IVisitor {
+   const std::map<std::string, number_t>& m_vars;
+   OperandStack<number_t> m_operands;
+
+   // false (and error set) when a child is missing : its value was not pushed
+   bool complete(Node& node)
+   {
+      size_t missing = 0;
+      for (size_t i = 0; i < node.nb_children(); ++i) {
+         if (node.child(i) == nullptr) ++missing;
+      }
+      if (missing == 0) return true;
+      error = E_INVALID_TREE;
+      m_operands.drop(node.nb_children() - missing);
+      m_operands.push(0);
+      return false;
+   }
+public:
+   ErrorKind error{ E_NONE };
+
+   explicit CheckedEvaluator(const std::map<std::string, number_t>& vars) : m_vars(vars) {}
 
+   number_t collect(Node* node)
+   {
+      if (!node) {
+         error = E_INVALID_TREE;
+         return 0;
+      }
+      return m_operands.collect(node, *this);
+   }
+
+   void visit(TerminalNode& node) override
+   {
+      number_t result = 0;
+      if (node.m_value.empty()) {
+         error = E_INVALID_TREE;
+      } else if (node.is_number()) {
+         errno = 0;
+         char* end = nullptr;
+         result = std::strtod(node.m_value.c_str(), &end);
+         if (errno == ERANGE || *end != '\0') error = E_INVALID_NUMBER;
+      } else {
+         auto search = m_vars.find(node.m_value);
+         result = (search != m_vars.end()) ? search->second : 1;
+      }
+      m_operands.push(result);
+   }
+   void visit(UnaryNode& node) override
+   {
+      if (!complete(node)) return;
+      number_t value = m_operands.pop();
+      if (node.m_func == FunctionId::Negate) {
+         m_operands.push(-value);
+      } else if (node.m_func == FunctionId::Identity) {
+         m_operands.push(value);
+      } else {
+         m_operands.push(::mep::call_math_function(node.m_func, value));
+      }
+   }
+   void visit(BinaryNode& node) override
+   {
+      if (!complete(node)) return;
+      number_t v2 = m_operands.pop();
+      number_t v1 = m_operands.pop();
+      number_t result = 0;
+      switch (node.m_operator.m_operation) {
+      case Operator::Add: result = v1 + v2; break;
+      case Operator::Sub: result = v1 - v2; break;
+      case Operator::Mul: result = v1 * v2; break;
+      case Operator::Div: result = v1 / v2; break;
+      case Operator::Mod: result = std::fmod(v1, v2); break;
+      case Operator::Pow: result = std::pow(v1, v2); break;
+      default: error = E_UNSUPPORTED_OPERATOR; break;
+      }
+      m_operands.push(result);
+   }
+   void visit(NaryNode& node) override
+   {
+      if (!complete(node)) return;
+      const size_t n = node.m_children.size();
+      Operator::Tag op = node.m_operator.m_operation;
+      number_t result = 0;
+      if (op != Operator::Add && op != Operator::Mul) {
+         error = E_UNSUPPORTED_OPERATOR;
+      } else if (n == 0) {
+         error = E_INVALID_TREE;
+      } else {
+         result = reduce_values(op, m_operands.top(n), n, false);
+      }
+      m_operands.drop(n);
+      m_operands.push(result);
+   }
+};
+
+} // ns
+
+Result<number_t> MEP_EXPORTS try_evaluate(AST* ast, const std::map<std::string, number_t>& variables)
+{
+   MEP_PHASE_SCOPE(PH_EVALUATE);
+   CheckedEvaluator eval(variables);
+   number_t value = eval.collect(ast);
+   if (eval.error != E_NONE) {
+      Error error;
+      error.kind = eval.error;
+      return error;
+   }
+   return value;
+}
+
+Result<number_t> MEP_EXPORTS try_evaluate(const std::string& input, const std::map<std::string, number_t>& variables)
+{
+   Result<AST*> ast = try_parse(input);
+   if (!ast) {
+      return ast.error();
+   }
+   Result<number_t> value = try_evaluate(ast.value(), variables);
+   delete ast.value();
+   return value;
+}
 
-} // ns
\ No newline at end of file
+} // ns
@@ -3,11 +3,13 @@
 #include <string>
 #include <iostream>
 #include <stack>
+#include <map>
 
 #include <mep/mep_export.h>
 #include <mep/math.hpp>
 #include <mep/lexer.hpp>
 #include <mep/AST.hpp>
+#include <mep/result.hpp>
 
 namespace mep {
 // Abstart Syntax Tree
@@ -126,6 +128,10 @@ Token routines
    error("Unexpected);
  }
 
+ The implementation is iterative : instead of recursing, parse_E loops over the
+ tokens alternating parse_T (term expected) and parse_B (operator expected), the open
+ parenthesis being kept as sentinels on the operator stack. Deeply nested input
+ costs stack memory, not call stack.
 */
 
 class MEP_EXPORTS ParserException : public std::exception {
@@ -135,37 +141,84 @@ public:
    {}
 };
 
+// Limits for untrusted input, exceeding them is a parse error.
+// The AST passes do not recurse, the limits only bound the work per formula.
+// max_depth is the nesting of parenthesis and signs : ((x)), -+x and sin(cos(x))
+// are 2 deep, -(-x) is 3. Chains of binary operators do not nest, a + b + c ...
+// is 0 deep.
+struct ParserLimits {
+   size_t max_depth{ 1000 };     // nesting (E_TOO_DEEP)
+   size_t max_nodes{ 100000 };   // nodes of the AST (E_TOO_LARGE)
+};
+
+// The parsing routines record the first error and return false instead of throwing,
+// parse() turns that error into a ParserException, try_parse() returns it.
 class MEP_EXPORTS Parser {
+   // operand with the nesting of its tree (see ParserLimits)
+   struct Operand {
+      AST* node;
+      size_t nesting;
+   };
+
    Lexer lexer;
-   bool m_f_debug{ false };
 
    std::stack<Operator> m_op_stack; // operator (sentinel guarded) stack
-   std::stack<AST*> m_var_stack;     // operands stack (formed as an AST tree)
+   std::stack<Operand> m_var_stack;  // operands stack (formed as an AST tree)
    Operator sentinel{};
    Token* m_previous_token{nullptr};
+   Error m_error;
+   ParserLimits m_limits;
+   size_t m_nb_nodes{ 0 };
+   size_t m_open{ 0 };          // open parenthesis (sentinels on the operator stack)
+   bool m_expect_term{ true };
+   size_t m_offset{ 0 };        // of the token being parsed
+
+   bool fail(ErrorKind kind, size_t offset);
+   void reset(const std::string& input);
+   void clear_stacks();
+   void push_operand(AST* node, size_t nesting);
 public:
    Parser()
    {
 
    }
+   explicit Parser(const ParserLimits& limits) : m_limits(limits) {}
+   ~Parser();
+   Parser(const Parser&) = delete;
+   Parser& operator=(const Parser&) = delete;
+
+   const ParserLimits& limits() const { return m_limits; }
+   void limits(const ParserLimits& limits) { m_limits = limits; }
   
    Token* peek_token();
    void consume_token(Token* tok);
-   void expect_token(TokenType tok);
+   bool expect_token(TokenType tok);
 
-   void insert_operator_ontop(OperatorToken& tok);
+   bool insert_operator_ontop(OperatorToken& tok);
    Operator reduce_top_operator();
 
    AST* mk_leaf(const std::string& var);
    AST* mk_unary(FunctionId& func, AST* child);
    AST* mk_binary(Operator& op, AST* left, AST* right);
 
-   void parse_T();
-   void parse_E();
+   bool parse_T();
+   bool parse_B();
+   bool parse_E();
 
+   // throws ParserException
    AST* parse(const std::string& input);
+   // never throws (but std::bad_alloc) : the AST, owned by the caller, or the error
+   Result<AST*> try_parse(const std::string& input);
+   // error of the last parse
+   const Error& error() const { return m_error; }
 };
 
+// Exception free entry points
+Result<AST*> MEP_EXPORTS try_parse(const std::string& input, const ParserLimits& limits = ParserLimits());
+// unknown variables evaluate to 1, as with EvaluteVisitor
+Result<number_t> MEP_EXPORTS try_evaluate(AST* ast, const std::map<std::string, number_t>& variables = {});
+Result<number_t> MEP_EXPORTS try_evaluate(const std::string& input, const std::map<std::string, number_t>& variables = {});
+
 
 } // ns
 
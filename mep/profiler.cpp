@@ -0,0 +1,186 @@
+#include <mep/profiler.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MEP_HAS_RDTSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define MEP_HAS_RDTSC
+#endif
+
+
+namespace mep {
+
+namespace {
+
+inline uint64_t read_ticks()
+{
+#ifdef MEP_HAS_RDTSC
+   return __rdtsc();
+#else
+   return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// BeautifingVisitor text, subexpressions followed by their share
+class AnnotatingPrinter : public BeautifingVisitor {
+   std::unordered_map<Node*, double> m_percents;
+   double m_min_percent;
+protected:
+   void annotate(Node& node, std::string& out) override
+   {
+      if (node.nb_children() == 0) return; // leaves : the operator says it all
+      auto it = m_percents.find(&node);
+      if (it == m_percents.end() || it->second < m_min_percent) return;
+      const double percent = it->second;
+      std::ostringstream os;
+      os << '[' << std::fixed << std::setprecision(1) << percent << "%]";
+      out += os.str();
+   }
+public:
+   AnnotatingPrinter(std::unordered_map<Node*, double>&& percents, double min_percent)
+      : m_percents(std::move(percents))
+      , m_min_percent(min_percent)
+   {
+      m_f_annotate = true;
+   }
+};
+
+} // ns
+
+Profiler::Profiler(AST* ast)
+   : m_ast(ast)
+{
+   m_program = compile(ast, m_origins);
+   for (size_t i = 0; i < m_origins.size(); ++i) m_index[m_origins[i]] = i;
+   m_counters.resize(m_program.size());
+   m_regs.resize(m_program.size());
+
+   // cost of the measure itself, the smallest of a few
+   m_overhead = ~uint64_t(0);
+   for (int i = 0; i < 1000; ++i) {
+      uint64_t start = read_ticks();
+      uint64_t stop = read_ticks();
+      m_overhead = std::min(m_overhead, stop - start);
+   }
+}
+
+number_t Profiler::evaluate(const number_t* vars)
+{
+   if (m_program.empty())
+      throw EvaluatorException("Empty program");
+   const ProgramView view = m_program.view();
+   number_t* regs = m_regs.data();
+   for (size_t i = 0; i < view.size(); ++i) {
+      uint64_t start = read_ticks();
+      regs[i] = view.compute(i, vars, regs);
+      uint64_t elapsed = read_ticks() - start;
+      Counter& counter = m_counters[i];
+      ++counter.executions;
+      counter.cycles += elapsed > m_overhead ? elapsed - m_overhead : 0;
+   }
+   return regs[view.size() - 1];
+}
+
+number_t Profiler::evaluate(const std::map<std::string, number_t>& vars)
+{
+   std::vector<number_t> values(m_program.nb_variables(), 1);
+   for (size_t i = 0; i < values.size(); ++i) {
+      auto search = vars.find(m_program.m_variables[i]);
+      if (search != vars.end()) values[i] = search->second;
+   }
+   return evaluate(values.data());
+}
+
+void Profiler::reset()
+{
+   std::fill(m_counters.begin(), m_counters.end(), Counter());
+}
+
+uint64_t Profiler::total_cycles() const
+{
+   uint64_t total = 0;
+   for (const Counter& counter : m_counters) total += counter.cycles;
+   return total;
+}
+
+// the operands of an instruction are located before it : one forward pass
+std::vector<uint64_t> Profiler::inclusive_cycles() const
+{
+   std::vector<uint64_t> inclusive(m_program.size());
+   for (size_t i = 0; i < m_program.size(); ++i) {
+      const Program::Instr& instr = m_program.m_code[i];
+      inclusive[i] = m_counters[i].cycles;
+      if (instr.op != Program::Const && instr.op != Program::Var) {
+         const uint32_t* ops = m_program.operands(instr);
+         for (uint32_t k = 0; k < instr.count; ++k) inclusive[i] += inclusive[ops[k]];
+      }
+   }
+   return inclusive;
+}
+
+double Profiler::percent(Node* node) const
+{
+   auto it = m_index.find(node);
+   if (it == m_index.end()) return -1;
+   const uint64_t total = total_cycles();
+   return total ? 100.0 * double(inclusive_cycles()[it->second]) / double(total) : 0;
+}
+
+double Profiler::self_percent(Node* node) const
+{
+   auto it = m_index.find(node);
+   if (it == m_index.end()) return -1;
+   const uint64_t total = total_cycles();
+   return total ? 100.0 * double(m_counters[it->second].cycles) / double(total) : 0;
+}
+
+std::string Profiler::annotate(double min_percent) const
+{
+   const std::vector<uint64_t> inclusive = inclusive_cycles();
+   const double total = double(std::max<uint64_t>(1, total_cycles()));
+   std::unordered_map<Node*, double> percents;
+   for (size_t i = 0; i < m_origins.size(); ++i) {
+      percents[m_origins[i]] = 100.0 * double(inclusive[i]) / total;
+   }
+   AnnotatingPrinter printer(std::move(percents), min_percent);
+   return printer.collect(m_ast);
+}
+
+std::string Profiler::report() const
+{
+   const std::vector<uint64_t> inclusive = inclusive_cycles();
+   const double total = double(std::max<uint64_t>(1, total_cycles()));
+   std::ostringstream os;
+   os << std::left << std::setw(6) << "#" << std::setw(26) << "instruction" << std::right
+      << std::setw(12) << "executions" << std::setw(14) << "cycles"
+      << std::setw(9) << "self %" << std::setw(9) << "total %" << "\n";
+   for (size_t i = 0; i < m_program.size(); ++i) {
+      const Program::Instr& instr = m_program.m_code[i];
+      std::ostringstream text;
+      text << opcode_name(instr.op);
+      if (instr.op == Program::Const) {
+         text << ' ' << m_program.m_consts[instr.arg];
+      } else if (instr.op == Program::Var) {
+         text << ' ' << m_program.m_variables[instr.arg];
+      } else {
+         if (instr.op == Program::Call) text << ' ' << mep_function_name(FunctionId(instr.func));
+         const uint32_t* ops = m_program.operands(instr);
+         for (uint32_t k = 0; k < instr.count; ++k) text << " #" << ops[k];
+      }
+      os << std::left << std::setw(6) << ("#" + std::to_string(i)) << std::setw(26) << text.str() << std::right
+         << std::setw(12) << m_counters[i].executions << std::setw(14) << m_counters[i].cycles
+         << std::fixed << std::setprecision(1)
+         << std::setw(9) << 100.0 * double(m_counters[i].cycles) / total
+         << std::setw(9) << 100.0 * double(inclusive[i]) / total << "\n";
+   }
+   return os.str();
+}
+
+} // ns
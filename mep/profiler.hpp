@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/program.hpp>
+
+namespace mep {
+
+/* Per node evaluation profiler
+ Evaluates the compiled form of an AST (one instruction per node) counting the
+ executions and the cycles of every instruction, to find the expensive
+ subexpressions of a slow formula :
+
+    Profiler profiler(ast);
+    for (...) profiler.evaluate(vars);
+    std::cout << profiler.annotate();     // ((x * y)[3.1%] + (a ^ b)[91.4%])[100.0%]
+
+ The annotation is the BeautifingVisitor text, each subexpression followed by its
+ inclusive share of the evaluation time.
+ Cycles are time stamp counter ticks on x86 (constant rate, not the core clock),
+ nanoseconds elsewhere ; the cost of reading the counter is measured once and
+ subtracted. Profiling is several times slower than Program::evaluate.
+*/
+class MEP_EXPORTS Profiler {
+public:
+   struct Counter {
+      uint64_t executions{ 0 };
+      uint64_t cycles{ 0 };
+   };
+
+   // ast (not owned) must outlive the profiler
+   explicit Profiler(AST* ast);
+
+   const Program& program() const { return m_program; }
+
+   // vars is indexed by slot (see Program)
+   number_t evaluate(const number_t* vars);
+   // unknown variables default to 1
+   number_t evaluate(const std::map<std::string, number_t>& vars);
+   void reset();
+
+   const Counter& counter(size_t instr) const { return m_counters[instr]; }
+   uint64_t total_cycles() const;
+   // share of the evaluation cycles spent in the subtree of node (inclusive) or in
+   // node itself, in percent ; -1 when node compiled to no instruction
+   double percent(Node* node) const;
+   double self_percent(Node* node) const;
+
+   // subexpressions costing less than min_percent are not annotated
+   std::string annotate(double min_percent = 1.0) const;
+   // one line per instruction : executions, cycles, self and inclusive shares
+   std::string report() const;
+
+private:
+   AST* m_ast;
+   Program m_program;
+   std::vector<Node*> m_origins;                // instruction -> AST node
+   std::unordered_map<Node*, size_t> m_index;   // AST node -> instruction
+   std::vector<Counter> m_counters;
+   std::vector<number_t> m_regs;
+   uint64_t m_overhead{ 0 };                    // cycles of an empty measure
+
+   std::vector<uint64_t> inclusive_cycles() const;
+};
+
+} // ns
@@ -0,0 +1,235 @@
+#include <mep/program.hpp>
+#include <mep/instrumentation.hpp>
+#include <mep/tracing.hpp>
+
+#include <cmath>
+#include <unordered_map>
+
+
+namespace mep {
+
+int Program::slot(const std::string& name) const
+{
+   for (size_t i = 0; i < m_variables.size(); ++i) {
+      if (m_variables[i] == name) return static_cast<int>(i);
+   }
+   return -1;
+}
+
+const char* MEP_EXPORTS opcode_name(Program::OpCode op)
+{
+   switch (op) {
+   case Program::Const: return "CONST";
+   case Program::Var: return "VAR";
+   case Program::Call: return "CALL";
+   case Program::Add: return "ADD";
+   case Program::Sub: return "SUB";
+   case Program::Mul: return "MUL";
+   case Program::Div: return "DIV";
+   case Program::Mod: return "MOD";
+   case Program::Pow: return "POW";
+   case Program::Sum: return "SUM";
+   case Program::Product: return "PRODUCT";
+   }
+   return "?";
+}
+
+size_t Program::footprint() const
+{
+   size_t bytes = sizeof(Program)
+      + m_code.capacity() * sizeof(Instr)
+      + m_operands.capacity() * sizeof(uint32_t)
+      + m_consts.capacity() * sizeof(number_t)
+      + m_variables.capacity() * sizeof(std::string);
+   for (const std::string& name : m_variables) bytes += name.capacity();
+   return bytes;
+}
+
+number_t ProgramView::compute(size_t i, const number_t* vars, const number_t* regs) const
+{
+   using Instr = Program::Instr;
+   const Instr& instr = m_code[i];
+   const uint32_t* ops = operands(instr);
+   switch (instr.op) {
+   case Program::Const: return m_consts[instr.arg];
+   case Program::Var:   return vars[instr.arg];
+   case Program::Call: {
+      number_t x = regs[ops[0]];
+      switch (instr.func) {
+      case FunctionId::Identity: return x;
+      case FunctionId::Negate:   return -x;
+      }
+      return call_math_function(static_cast<FunctionId>(instr.func), x);
+   }
+   case Program::Add: return regs[ops[0]] + regs[ops[1]];
+   case Program::Sub: return regs[ops[0]] - regs[ops[1]];
+   case Program::Mul: return regs[ops[0]] * regs[ops[1]];
+   case Program::Div: return regs[ops[0]] / regs[ops[1]];
+   case Program::Mod: return std::fmod(regs[ops[0]], regs[ops[1]]);
+   case Program::Pow: return std::pow(regs[ops[0]], regs[ops[1]]);
+   case Program::Sum: {
+      number_t acc = regs[ops[0]];
+      for (uint32_t k = 1; k < instr.count; ++k) acc += regs[ops[k]];
+      return acc;
+   }
+   case Program::Product: {
+      number_t acc = regs[ops[0]];
+      for (uint32_t k = 1; k < instr.count; ++k) acc *= regs[ops[k]];
+      return acc;
+   }
+   }
+   throw EvaluatorException("Invalid instruction");
+}
+
+number_t ProgramView::evaluate(const number_t* vars, number_t* regs) const
+{
+   MEP_PHASE_SCOPE(PH_EVALUATE);
+   if (m_nb_code == 0)
+      throw EvaluatorException("Empty program");
+   for (size_t i = 0; i < m_nb_code; ++i) {
+      regs[i] = compute(i, vars, regs);
+   }
+   return regs[m_nb_code - 1];
+}
+
+number_t Program::evaluate(const std::vector<number_t>& vars) const
+{
+   if (vars.size() < m_variables.size())
+      throw EvaluatorException("Missing variable values");
+   std::vector<number_t> regs(m_code.size());
+   return evaluate(vars.data(), regs.data());
+}
+
+number_t Program::evaluate(const std::map<std::string, number_t>& vars) const
+{
+   std::vector<number_t> values(m_variables.size(), 1);
+   for (size_t i = 0; i < m_variables.size(); ++i) {
+      auto search = vars.find(m_variables[i]);
+      if (search != vars.end()) values[i] = search->second;
+   }
+   return evaluate(values);
+}
+
+
+//----------------------------------------------------------------------------
+// AST -> Program
+
+// driven by walk_postorder : the operands are the instructions of the children
+class Compiler : public IVisitor {
+   Program& m_prog;
+   std::vector<Node*>* m_origins;
+   OperandStack<uint32_t> m_indexes;
+   std::unordered_map<std::string, uint32_t> m_slots; // m_prog.m_variables indexes
+
+   uint32_t emit(Program::OpCode op, uint32_t arg, uint32_t count = 0, uint8_t func = 0)
+   {
+      Program::Instr instr{ op, func, 0, count, arg };
+      m_prog.m_code.push_back(instr);
+      return static_cast<uint32_t>(m_prog.m_code.size() - 1);
+   }
+   // consumes the n operands on top of the stack
+   uint32_t emit_operator(Program::OpCode op, size_t n, uint8_t func = 0)
+   {
+      uint32_t first = static_cast<uint32_t>(m_prog.m_operands.size());
+      const uint32_t* operands = m_indexes.top(n);
+      m_prog.m_operands.insert(m_prog.m_operands.end(), operands, operands + n);
+      m_indexes.drop(n);
+      return emit(op, first, static_cast<uint32_t>(n), func);
+   }
+   uint32_t variable_slot(const std::string& name)
+   {
+      auto inserted = m_slots.emplace(name, static_cast<uint32_t>(m_prog.m_variables.size()));
+      if (inserted.second) m_prog.m_variables.push_back(name);
+      return inserted.first->second;
+   }
+   // the children recorded theirs : the last instruction, if any, is this node's
+   void record(Node& node, uint32_t index)
+   {
+      m_indexes.push(index);
+      if (m_origins && m_origins->size() < m_prog.m_code.size()) m_origins->push_back(&node);
+   }
+   // null children are skipped by the walk
+   static void check_children(const Node& node)
+   {
+      for (size_t i = 0; i < node.nb_children(); ++i) {
+         if (node.child(i) == nullptr)
+            throw EvaluatorException("Empty tree!");
+      }
+   }
+
+   static Program::OpCode binary_opcode(const Operator& op)
+   {
+      switch (op.m_operation) {
+      case Operator::Add: return Program::Add;
+      case Operator::Sub: return Program::Sub;
+      case Operator::Mul: return Program::Mul;
+      case Operator::Div: return Program::Div;
+      case Operator::Mod: return Program::Mod;
+      case Operator::Pow: return Program::Pow;
+      }
+      throw EvaluatorException("Unsupported operator");
+   }
+public:
+   Compiler(Program& prog, std::vector<Node*>* origins = nullptr) : m_prog(prog), m_origins(origins) {}
+
+   // iterative : safe on arbitrarily deep trees
+   uint32_t compile(Node* root)
+   {
+      if (root == nullptr)
+         throw EvaluatorException("Empty tree!");
+      return m_indexes.collect(root, *this);
+   }
+
+   void visit(TerminalNode& leaf) override
+   {
+      if (leaf.is_number()) {
+         m_prog.m_consts.push_back(std::stod(leaf.m_value));
+         record(leaf, emit(Program::Const, static_cast<uint32_t>(m_prog.m_consts.size() - 1)));
+      } else {
+         record(leaf, emit(Program::Var, variable_slot(leaf.m_value)));
+      }
+   }
+   void visit(UnaryNode& unary) override
+   {
+      check_children(unary);
+      if (unary.m_func == FunctionId::Identity) { // +x == x
+         record(unary, m_indexes.pop());
+      } else {
+         record(unary, emit_operator(Program::Call, 1, static_cast<uint8_t>(unary.m_func)));
+      }
+   }
+   void visit(BinaryNode& binary) override
+   {
+      check_children(binary);
+      record(binary, emit_operator(binary_opcode(binary.m_operator), 2));
+   }
+   void visit(NaryNode& nary) override
+   {
+      check_children(nary);
+      bool is_mul = nary.m_operator.m_operation == Operator::Mul;
+      record(nary, emit_operator(is_mul ? Program::Product : Program::Sum, nary.m_children.size()));
+   }
+};
+
+Program MEP_EXPORTS compile(AST* ast)
+{
+   MEP_PHASE_SCOPE(PH_COMPILE);
+   MEP_TRACE_SPAN("compile", current_trace_id());
+   Program prog;
+   Compiler compiler(prog);
+   compiler.compile(ast);
+   return prog;
+}
+
+Program MEP_EXPORTS compile(AST* ast, std::vector<Node*>& origins)
+{
+   MEP_PHASE_SCOPE(PH_COMPILE);
+   MEP_TRACE_SPAN("compile", current_trace_id());
+   origins.clear();
+   Program prog;
+   Compiler compiler(prog, &origins);
+   compiler.compile(ast);
+   return prog;
+}
+
+} // ns
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/mem_stats.hpp>
+#include <mep/AST.hpp>
+#include <mep/parser.hpp>
+#include <mep/evaluator.hpp>
+
+namespace mep {
+
+/* Compiled expression
+ The AST is linearized in post order : one instruction per node, the operands of an
+ instruction are always located before it, the last instruction is the root.
+    x * y + sin(z)
+ compiles to
+    #0 VAR   slot 0      (x)
+    #1 VAR   slot 1      (y)
+    #2 MUL   #0 #1
+    #3 VAR   slot 2      (z)
+    #4 CALL  sin #3
+    #5 ADD   #2 #4
+ Evaluating is a single forward loop, each instruction writing its own register.
+ Variables are resolved once at compile time into slots (index in m_variables).
+*/
+class ProgramView;
+
+class MEP_EXPORTS Program {
+public:
+   enum OpCode : uint8_t {
+      Const, Var,                   // leaves
+      Call,                         // unary function application (and sign)
+      Add, Sub, Mul, Div, Mod, Pow, // binary operators
+      Sum, Product                  // n-ary operators (see NaryNode)
+   };
+   static constexpr size_t nb_opcodes = Product + 1;
+   struct Instr {
+      OpCode   op;
+      uint8_t  func;      // FunctionId (Call only)
+      uint16_t reserved;
+      uint32_t count;     // number of operands
+      uint32_t arg;       // Const : index in m_consts, Var : variable slot,
+                          // operators : index of the first operand in m_operands
+   };
+
+   // arrays accounted in MEM_CODE (see mem_stats.hpp)
+   template<class T> using code_vector = std::vector<T, TrackingAllocator<T, MEM_CODE>>;
+
+   code_vector<Instr>       m_code;
+   code_vector<uint32_t>    m_operands;  // instruction indexes of the operands
+   code_vector<number_t>    m_consts;    // constant pool
+   std::vector<std::string> m_variables; // slot -> variable name
+
+   size_t size() const { return m_code.size(); }
+   bool empty() const { return m_code.empty(); }
+   size_t nb_variables() const { return m_variables.size(); }
+   const uint32_t* operands(const Instr& instr) const { return m_operands.data() + instr.arg; }
+
+   // approximate heap memory used, in bytes
+   size_t footprint() const;
+
+   // slot of a variable, -1 if the expression does not reference it
+   int slot(const std::string& name) const;
+
+   // non owning view, valid until the program is modified
+   ProgramView view() const;
+
+   // computes instruction i, its operands being already stored in regs
+   number_t compute(size_t i, const number_t* vars, const number_t* regs) const;
+
+   // vars is indexed by slot, regs is a scratch area of size() registers
+   number_t evaluate(const number_t* vars, number_t* regs) const;
+   number_t evaluate(const std::vector<number_t>& vars) const;
+   // unknown variables default to 1 (as in EvaluteVisitor)
+   number_t evaluate(const std::map<std::string, number_t>& vars) const;
+};
+
+// Program laid out in externally owned memory (e.g. a memory mapped file, see
+// program_store.hpp) : evaluates in place, without copying the arrays.
+// Variable names are not part of the view.
+class MEP_EXPORTS ProgramView {
+public:
+   const Program::Instr* m_code{ nullptr };
+   const uint32_t*       m_operands{ nullptr };
+   const number_t*       m_consts{ nullptr };
+   uint32_t m_nb_code{ 0 };
+   uint32_t m_nb_variables{ 0 };
+
+   size_t size() const { return m_nb_code; }
+   bool empty() const { return m_nb_code == 0; }
+   size_t nb_variables() const { return m_nb_variables; }
+   const uint32_t* operands(const Program::Instr& instr) const { return m_operands + instr.arg; }
+
+   number_t compute(size_t i, const number_t* vars, const number_t* regs) const;
+   number_t evaluate(const number_t* vars, number_t* regs) const;
+};
+
+inline ProgramView Program::view() const
+{
+   ProgramView view;
+   view.m_code = m_code.data();
+   view.m_operands = m_operands.data();
+   view.m_consts = m_consts.data();
+   view.m_nb_code = static_cast<uint32_t>(m_code.size());
+   view.m_nb_variables = static_cast<uint32_t>(m_variables.size());
+   return view;
+}
+
+inline number_t Program::compute(size_t i, const number_t* vars, const number_t* regs) const
+{
+   return view().compute(i, vars, regs);
+}
+
+inline number_t Program::evaluate(const number_t* vars, number_t* regs) const
+{
+   return view().evaluate(vars, regs);
+}
+
+// "ADD", "CALL", ...
+const char* MEP_EXPORTS opcode_name(Program::OpCode op);
+
+// Compiles an AST (left untouched) into its linear form
+Program MEP_EXPORTS compile(AST* ast);
+// origins[i] : AST node of instruction i (+x compiles to no instruction)
+Program MEP_EXPORTS compile(AST* ast, std::vector<Node*>& origins);
+
+} // ns
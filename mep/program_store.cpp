@@ -0,0 +1,336 @@
+#include <mep/program_store.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <mep/expr_cache.hpp>
+
+
+namespace mep {
+
+static const char store_magic[4] = { 'M', 'E', 'P', 'C' };
+static const uint32_t store_byte_order = 0x01020304;
+
+static size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+static Hash128 source_hash(std::string_view normalized)
+{
+   return hash_bytes(normalized.data(), normalized.size());
+}
+
+
+//----------------------------------------------------------------------------
+
+std::string_view StoredProgram::variable(size_t slot) const
+{
+   return std::string_view(m_names + m_name_offsets[slot], m_name_offsets[slot + 1] - m_name_offsets[slot]);
+}
+
+int StoredProgram::slot(std::string_view name) const
+{
+   for (size_t i = 0; i < nb_variables(); ++i) {
+      if (variable(i) == name) return static_cast<int>(i);
+   }
+   return -1;
+}
+
+Program StoredProgram::to_program() const
+{
+   Program prog;
+   prog.m_code.assign(m_view.m_code, m_view.m_code + m_view.m_nb_code);
+   size_t nb_operands = 0, nb_consts = 0;
+   for (const Program::Instr& instr : prog.m_code) {
+      if (instr.op == Program::Const) {
+         nb_consts = std::max<size_t>(nb_consts, instr.arg + 1);
+      } else if (instr.op != Program::Var) {
+         nb_operands = std::max<size_t>(nb_operands, instr.arg + instr.count);
+      }
+   }
+   prog.m_operands.assign(m_view.m_operands, m_view.m_operands + nb_operands);
+   prog.m_consts.assign(m_view.m_consts, m_view.m_consts + nb_consts);
+   for (size_t i = 0; i < nb_variables(); ++i) {
+      prog.m_variables.emplace_back(variable(i));
+   }
+   return prog;
+}
+
+
+//----------------------------------------------------------------------------
+// writing
+
+void ProgramStoreWriter::add(std::string_view source, const Program& program)
+{
+   std::string key;
+   ExpressionCache::normalize(source, key);
+   auto inserted = m_index.emplace(key, m_entries.size());
+   if (!inserted.second) {
+      m_entries[inserted.first->second].second = program;
+      return;
+   }
+   m_entries.emplace_back(std::move(key), program);
+}
+
+// appends raw bytes, padded to 8
+static void append(std::vector<char>& out, const void* data, size_t size)
+{
+   const char* bytes = static_cast<const char*>(data);
+   out.insert(out.end(), bytes, bytes + size);
+   out.resize(align8(out.size()), 0);
+}
+
+static std::vector<char> serialize_entry(const std::string& source, const Program& prog)
+{
+   StoreEntryHeader header{};
+   std::vector<char> out(sizeof(StoreEntryHeader), 0);
+   header.nb_code = static_cast<uint32_t>(prog.m_code.size());
+   header.nb_operands = static_cast<uint32_t>(prog.m_operands.size());
+   header.nb_consts = static_cast<uint32_t>(prog.m_consts.size());
+   header.nb_variables = static_cast<uint32_t>(prog.m_variables.size());
+
+   header.code_offset = static_cast<uint32_t>(out.size());
+   append(out, prog.m_code.data(), prog.m_code.size() * sizeof(Program::Instr));
+   header.operands_offset = static_cast<uint32_t>(out.size());
+   append(out, prog.m_operands.data(), prog.m_operands.size() * sizeof(uint32_t));
+   header.consts_offset = static_cast<uint32_t>(out.size());
+   append(out, prog.m_consts.data(), prog.m_consts.size() * sizeof(number_t));
+
+   header.names_offset = static_cast<uint32_t>(out.size());
+   std::vector<uint32_t> name_offsets{ 0 };
+   std::string names;
+   for (const std::string& name : prog.m_variables) {
+      names += name;
+      name_offsets.push_back(static_cast<uint32_t>(names.size()));
+   }
+   out.insert(out.end(), reinterpret_cast<const char*>(name_offsets.data()),
+              reinterpret_cast<const char*>(name_offsets.data() + name_offsets.size()));
+   append(out, names.data(), names.size());
+
+   header.source_offset = static_cast<uint32_t>(out.size());
+   header.source_size = static_cast<uint32_t>(source.size());
+   append(out, source.data(), source.size());
+
+   header.checksum = hash_bytes(out.data() + sizeof(StoreEntryHeader), out.size() - sizeof(StoreEntryHeader));
+   std::memcpy(out.data(), &header, sizeof(header));
+   return out;
+}
+
+std::vector<char> ProgramStoreWriter::serialize() const
+{
+   std::vector<std::pair<Hash128, size_t>> order;
+   for (size_t i = 0; i < m_entries.size(); ++i) {
+      order.emplace_back(source_hash(m_entries[i].first), i);
+   }
+   std::sort(order.begin(), order.end());
+
+   StoreHeader header{};
+   std::memcpy(header.magic, store_magic, sizeof(store_magic));
+   header.byte_order = store_byte_order;
+   header.format_version = ProgramStore::format_version;
+   header.nb_entries = static_cast<uint32_t>(m_entries.size());
+   std::strncpy(header.lib_version, MEP_VERSION_STRING, sizeof(header.lib_version) - 1);
+   header.index_offset = align8(sizeof(StoreHeader));
+
+   std::vector<StoreIndexEntry> index(order.size());
+   std::vector<char> body;
+   size_t body_offset = align8(header.index_offset + index.size() * sizeof(StoreIndexEntry));
+   for (size_t i = 0; i < order.size(); ++i) {
+      const auto& entry = m_entries[order[i].second];
+      std::vector<char> bytes = serialize_entry(entry.first, entry.second);
+      index[i].source_hash = order[i].first;
+      index[i].offset = body_offset + body.size();
+      index[i].size = bytes.size();
+      body.insert(body.end(), bytes.begin(), bytes.end());
+   }
+   header.file_size = body_offset + body.size();
+
+   std::vector<char> file;
+   append(file, &header, sizeof(header));
+   append(file, index.data(), index.size() * sizeof(StoreIndexEntry));
+   file.insert(file.end(), body.begin(), body.end());
+   return file;
+}
+
+void ProgramStoreWriter::write(const std::string& path) const
+{
+   std::vector<char> file = serialize();
+   // readers mapping the previous file keep their pages : write aside and rename
+   std::string tmp = path + ".tmp";
+   {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      out.write(file.data(), static_cast<std::streamsize>(file.size()));
+      if (!out)
+         throw MepException("Cannot write " + tmp);
+   }
+   std::remove(path.c_str()); // rename does not replace on Windows
+   if (std::rename(tmp.c_str(), path.c_str()) != 0)
+      throw MepException("Cannot rename " + tmp + " to " + path);
+}
+
+
+//----------------------------------------------------------------------------
+// reading
+
+ProgramStore::Status ProgramStore::open(const std::string& path)
+{
+   close();
+   if (!m_file.open(path)) return NotFound;
+   return attach(m_file.data(), m_file.size());
+}
+
+ProgramStore::Status ProgramStore::attach(const void* image, size_t size)
+{
+   m_states.reset();
+   m_index = nullptr;
+   m_header = nullptr;
+   const char* data = static_cast<const char*>(image);
+   if (data == nullptr || size < sizeof(StoreHeader) || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+      close();
+      return BadFormat;
+   }
+   const StoreHeader* header = reinterpret_cast<const StoreHeader*>(data);
+   if (std::memcmp(header->magic, store_magic, sizeof(store_magic)) != 0
+       || header->byte_order != store_byte_order
+       || header->file_size != size) {
+      close();
+      return BadFormat;
+   }
+   char version[sizeof(header->lib_version)] = {};
+   std::strncpy(version, MEP_VERSION_STRING, sizeof(version) - 1);
+   if (header->format_version != format_version
+       || std::memcmp(header->lib_version, version, sizeof(version)) != 0) {
+      close();
+      return VersionMismatch;
+   }
+   if (header->index_offset > size
+       || header->nb_entries > (size - header->index_offset) / sizeof(StoreIndexEntry)) {
+      close();
+      return BadFormat;
+   }
+   m_data = data;
+   m_size = size;
+   m_header = header;
+   m_index = reinterpret_cast<const StoreIndexEntry*>(data + header->index_offset);
+   m_states.reset(new std::atomic<uint8_t>[header->nb_entries]);
+   for (size_t i = 0; i < header->nb_entries; ++i) m_states[i] = Unchecked;
+   return Ok;
+}
+
+void ProgramStore::close()
+{
+   m_states.reset();
+   m_index = nullptr;
+   m_header = nullptr;
+   m_data = nullptr;
+   m_size = 0;
+   m_file.close();
+}
+
+bool ProgramStore::validate(size_t entry) const
+{
+   const StoreIndexEntry& idx = m_index[entry];
+   const size_t file_size = m_size;
+   if (idx.offset % 8 != 0 || idx.offset > file_size || idx.size > file_size - idx.offset
+       || idx.size < sizeof(StoreEntryHeader)) {
+      return false;
+   }
+   const char* base = m_data + idx.offset;
+   const StoreEntryHeader* header = reinterpret_cast<const StoreEntryHeader*>(base);
+   auto fits = [&](uint64_t offset, uint64_t count, uint64_t item) {
+      return offset % 8 == 0 && offset <= idx.size && count <= (idx.size - offset) / item;
+   };
+   if (header->nb_code == 0
+       || !fits(header->code_offset, header->nb_code, sizeof(Program::Instr))
+       || !fits(header->operands_offset, header->nb_operands, sizeof(uint32_t))
+       || !fits(header->consts_offset, header->nb_consts, sizeof(number_t))
+       || !fits(header->names_offset, header->nb_variables + 1ull, sizeof(uint32_t))
+       || !fits(header->source_offset, header->source_size, 1)) {
+      return false;
+   }
+   Hash128 checksum = hash_bytes(base + sizeof(StoreEntryHeader), idx.size - sizeof(StoreEntryHeader));
+   if (checksum != header->checksum) return false;
+
+   // instructions only reference earlier instructions and existing slots/constants
+   const Program::Instr* code = reinterpret_cast<const Program::Instr*>(base + header->code_offset);
+   const uint32_t* operands = reinterpret_cast<const uint32_t*>(base + header->operands_offset);
+   for (uint32_t i = 0; i < header->nb_code; ++i) {
+      const Program::Instr& instr = code[i];
+      switch (instr.op) {
+      case Program::Const:
+         if (instr.arg >= header->nb_consts) return false;
+         break;
+      case Program::Var:
+         if (instr.arg >= header->nb_variables) return false;
+         break;
+      case Program::Call:
+      case Program::Add: case Program::Sub: case Program::Mul:
+      case Program::Div: case Program::Mod: case Program::Pow:
+      case Program::Sum: case Program::Product: {
+         uint32_t expected = (instr.op == Program::Call) ? 1 : 2;
+         if (instr.op == Program::Sum || instr.op == Program::Product) {
+            if (instr.count < 2) return false;
+         } else if (instr.count != expected) {
+            return false;
+         }
+         if (instr.op == Program::Call && instr.func > FunctionId::Log10) return false;
+         if (instr.arg > header->nb_operands || instr.count > header->nb_operands - instr.arg) return false;
+         for (uint32_t k = 0; k < instr.count; ++k) {
+            if (operands[instr.arg + k] >= i) return false;
+         }
+      } break;
+      default:
+         return false;
+      }
+   }
+   const uint32_t* name_offsets = reinterpret_cast<const uint32_t*>(base + header->names_offset);
+   const size_t names_room = idx.size - header->names_offset - (header->nb_variables + 1ull) * sizeof(uint32_t);
+   for (uint32_t v = 0; v < header->nb_variables; ++v) {
+      if (name_offsets[v] > name_offsets[v + 1] || name_offsets[v + 1] > names_room) return false;
+   }
+   return true;
+}
+
+void ProgramStore::read_entry(size_t entry, StoredProgram& out) const
+{
+   const char* base = m_data + m_index[entry].offset;
+   const StoreEntryHeader* header = reinterpret_cast<const StoreEntryHeader*>(base);
+   out.m_view.m_code = reinterpret_cast<const Program::Instr*>(base + header->code_offset);
+   out.m_view.m_operands = reinterpret_cast<const uint32_t*>(base + header->operands_offset);
+   out.m_view.m_consts = reinterpret_cast<const number_t*>(base + header->consts_offset);
+   out.m_view.m_nb_code = header->nb_code;
+   out.m_view.m_nb_variables = header->nb_variables;
+   out.m_name_offsets = reinterpret_cast<const uint32_t*>(base + header->names_offset);
+   out.m_names = reinterpret_cast<const char*>(out.m_name_offsets + header->nb_variables + 1);
+   out.m_source = std::string_view(base + header->source_offset, header->source_size);
+}
+
+bool ProgramStore::find(std::string_view source, StoredProgram& out) const
+{
+   if (!is_open()) return false;
+   thread_local std::string key;
+   ExpressionCache::normalize(source, key);
+   Hash128 hash = source_hash(key);
+
+   const StoreIndexEntry* end = m_index + m_header->nb_entries;
+   const StoreIndexEntry* it = std::lower_bound(m_index, end, hash,
+      [](const StoreIndexEntry& e, const Hash128& h) { return e.source_hash < h; });
+   for (; it != end && it->source_hash == hash; ++it) {
+      size_t entry = static_cast<size_t>(it - m_index);
+      uint8_t state = m_states[entry].load(std::memory_order_acquire);
+      if (state == Unchecked) {
+         state = validate(entry) ? Valid : Invalid;
+         m_states[entry].store(state, std::memory_order_release);
+      }
+      if (state != Valid) continue;
+      StoredProgram candidate;
+      read_entry(entry, candidate);
+      if (candidate.m_source == key) {
+         out = candidate;
+         return true;
+      }
+   }
+   return false;
+}
+
+} // ns
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/canonical.hpp>
+#include <mep/mapped_file.hpp>
+#include <mep/program.hpp>
+
+#ifndef MEP_VERSION_STRING
+# define MEP_VERSION_STRING "0.1.0"
+#endif
+
+namespace mep {
+
+/* On disk store of compiled expressions
+ Written once (ProgramStoreWriter), then memory mapped on the next start (ProgramStore) :
+ programs are evaluated in place from the mapping, nothing is deserialized.
+
+ Layout (native byte order, checked at open, every offset 8 bytes aligned) :
+    StoreHeader
+    StoreIndexEntry[nb_entries]   sorted by source hash
+    entries :
+       StoreEntryHeader
+       Program::Instr[nb_code]
+       uint32_t operands[nb_operands]
+       number_t consts[nb_consts]
+       uint32_t name_offsets[nb_variables + 1]  then the names characters
+       source characters (normalized, see ExpressionCache::normalize)
+
+ Invalidation :
+  - a file written by another format or library version is ignored as a whole
+  - entries are keyed by the hash of their normalized source and keep the source
+    itself, so a changed formula simply misses
+ Entries are validated lazily (bounds, operand order, checksum) on first access.
+*/
+struct StoreHeader {
+   char     magic[4];          // "MEPC"
+   uint32_t byte_order;        // 0x01020304 as written
+   uint32_t format_version;
+   uint32_t nb_entries;
+   char     lib_version[16];   // MEP_VERSION_STRING, zero padded
+   uint64_t file_size;
+   uint64_t index_offset;
+};
+
+struct StoreIndexEntry {
+   Hash128  source_hash;
+   uint64_t offset;            // StoreEntryHeader, from the file start
+   uint64_t size;              // whole entry
+};
+
+struct StoreEntryHeader {
+   uint32_t nb_code;
+   uint32_t nb_operands;
+   uint32_t nb_consts;
+   uint32_t nb_variables;
+   uint32_t code_offset;       // offsets from the entry start
+   uint32_t operands_offset;
+   uint32_t consts_offset;
+   uint32_t names_offset;
+   uint32_t source_offset;
+   uint32_t source_size;
+   Hash128  checksum;          // of the entry bytes following this header
+};
+
+// Compiled expression living in a ProgramStore mapping (valid as long as the store)
+class MEP_EXPORTS StoredProgram {
+public:
+   ProgramView m_view;
+   const uint32_t* m_name_offsets{ nullptr };
+   const char* m_names{ nullptr };
+   std::string_view m_source;
+
+   const ProgramView& view() const { return m_view; }
+   size_t nb_variables() const { return m_view.nb_variables(); }
+   std::string_view variable(size_t slot) const;
+   // -1 if the expression does not reference it
+   int slot(std::string_view name) const;
+
+   number_t evaluate(const number_t* vars, number_t* regs) const { return m_view.evaluate(vars, regs); }
+   // owning copy
+   Program to_program() const;
+};
+
+class MEP_EXPORTS ProgramStoreWriter {
+   std::vector<std::pair<std::string, Program>> m_entries; // normalized source, program
+   std::unordered_map<std::string, size_t> m_index;        // normalized source -> entry
+public:
+   // the last program added for a given (normalized) source wins
+   void add(std::string_view source, const Program& program);
+   size_t size() const { return m_entries.size(); }
+   // the store image, as written to disk
+   std::vector<char> serialize() const;
+   // written to a temporary file then renamed, throws MepException on I/O error
+   void write(const std::string& path) const;
+};
+
+class MEP_EXPORTS ProgramStore {
+public:
+   enum Status {
+      Ok,
+      NotFound,          // no such file
+      BadFormat,         // not a store, truncated or foreign byte order
+      VersionMismatch    // written by another format or library version
+   };
+   static constexpr uint32_t format_version = 1;
+private:
+   enum EntryState : uint8_t { Unchecked, Valid, Invalid };
+   MappedFile m_file;
+   const char* m_data{ nullptr };
+   size_t m_size{ 0 };
+   const StoreHeader* m_header{ nullptr };
+   const StoreIndexEntry* m_index{ nullptr };
+   std::unique_ptr<std::atomic<uint8_t>[]> m_states; // entry -> EntryState
+
+   bool validate(size_t entry) const;
+   void read_entry(size_t entry, StoredProgram& out) const;
+public:
+   Status open(const std::string& path);
+   // uses an image already in memory (8 bytes aligned, e.g. a shared memory
+   // segment), which must outlive the store
+   Status attach(const void* data, size_t size);
+   void close();
+   bool is_open() const { return m_header != nullptr; }
+   size_t size() const { return m_header ? m_header->nb_entries : 0; }
+
+   // false if source is not in the store or its entry is corrupted
+   bool find(std::string_view source, StoredProgram& out) const;
+};
+
+} // ns
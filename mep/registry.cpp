@@ -0,0 +1,131 @@
+#include <mep/registry.hpp>
+#include <mep/tracing.hpp>
+
+#include <algorithm>
+
+
+namespace mep {
+
+std::unique_ptr<ExpressionSet> ExpressionSet::compile(const Definitions& definitions)
+{
+   auto set = std::make_unique<ExpressionSet>();
+   Parser parser;
+   for (const auto& definition : definitions) {
+      AST* ast = parser.parse(definition.second);
+      try {
+         set->m_programs[definition.first] = mep::compile(ast);
+      } catch (...) {
+         delete ast;
+         throw;
+      }
+      delete ast;
+   }
+   return set;
+}
+
+const Program* ExpressionSet::find(const std::string& name) const
+{
+   auto search = m_programs.find(name);
+   return (search != m_programs.end()) ? &search->second : nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+
+ExpressionRegistry::Reader::Reader(ExpressionRegistry& registry)
+   : m_registry(registry)
+   , m_slot(nullptr)
+{
+   for (ReaderSlot& slot : registry.m_slots) {
+      bool expected = false;
+      if (slot.in_use.compare_exchange_strong(expected, true)) {
+         m_slot = &slot;
+         return;
+      }
+   }
+   throw MepException("Too many registry readers");
+}
+
+ExpressionRegistry::Reader::~Reader()
+{
+   m_slot->epoch.store(0);
+   m_slot->in_use.store(false);
+}
+
+ExpressionRegistry::ReadGuard ExpressionRegistry::Reader::read()
+{
+   // announce first, then load : a writer retiring the set we load
+   // necessarily sees our announcement (sequentially consistent order)
+   m_slot->epoch.store(m_registry.m_epoch.load());
+   return ReadGuard(m_slot, m_registry.m_current.load());
+}
+
+ExpressionRegistry::~ExpressionRegistry()
+{
+   if (m_compiler) m_compiler.reset(); // joins pending reloads
+   delete m_current.load();
+   for (auto& retired : m_retired) delete retired.second;
+}
+
+uint64_t ExpressionRegistry::publish(std::unique_ptr<ExpressionSet> set)
+{
+   std::lock_guard<std::mutex> lock(m_writer_mutex);
+   uint64_t version = m_next_version++;
+   set->m_version = version;
+   const ExpressionSet* previous = m_current.exchange(set.release());
+   m_version.store(version);
+   // readers announcing this epoch or a later one cannot see previous
+   uint64_t retire_epoch = m_epoch.fetch_add(1) + 1;
+   if (previous) m_retired.emplace_back(retire_epoch, previous);
+   reclaim_locked();
+   return version;
+}
+
+uint64_t ExpressionRegistry::reload(const ExpressionSet::Definitions& definitions)
+{
+   MEP_TRACE_SPAN("reload", m_version.load());
+   return publish(ExpressionSet::compile(definitions));
+}
+
+std::future<uint64_t> ExpressionRegistry::reload_async(ExpressionSet::Definitions definitions)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_writer_mutex);
+      if (!m_compiler) m_compiler = std::make_unique<ThreadPool>(1);
+   }
+   auto task = std::make_shared<std::packaged_task<uint64_t()>>(
+      [this, definitions = std::move(definitions)]() { return reload(definitions); });
+   std::future<uint64_t> result = task->get_future();
+   m_compiler->submit([task]() { (*task)(); });
+   return result;
+}
+
+void ExpressionRegistry::reclaim_locked()
+{
+   uint64_t oldest = UINT64_MAX; // oldest epoch announced by an active reader
+   for (ReaderSlot& slot : m_slots) {
+      uint64_t epoch = slot.epoch.load();
+      if (epoch != 0) oldest = std::min(oldest, epoch);
+   }
+   auto it = std::remove_if(m_retired.begin(), m_retired.end(),
+      [oldest](const std::pair<uint64_t, const ExpressionSet*>& retired) {
+         if (retired.first > oldest) return false;
+         delete retired.second;
+         return true;
+      });
+   m_retired.erase(it, m_retired.end());
+}
+
+void ExpressionRegistry::reclaim()
+{
+   std::lock_guard<std::mutex> lock(m_writer_mutex);
+   reclaim_locked();
+}
+
+size_t ExpressionRegistry::nb_retired()
+{
+   std::lock_guard<std::mutex> lock(m_writer_mutex);
+   return m_retired.size();
+}
+
+} // ns
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/program.hpp>
+#include <mep/thread_pool.hpp>
+
+namespace mep {
+
+// Immutable set of named compiled expressions (one version of the rules)
+class MEP_EXPORTS ExpressionSet {
+public:
+   using Definitions = std::vector<std::pair<std::string, std::string>>; // name, source
+
+   uint64_t m_version{ 0 };
+   std::unordered_map<std::string, Program> m_programs;
+
+   // throws as Parser::parse on the first invalid source
+   static std::unique_ptr<ExpressionSet> compile(const Definitions& definitions);
+
+   // nullptr if unknown
+   const Program* find(const std::string& name) const;
+   size_t size() const { return m_programs.size(); }
+   uint64_t version() const { return m_version; }
+};
+
+/* Hot reloadable registry of expression sets (read-copy-update)
+ Readers access the current set through an atomic pointer, a reload builds a whole new
+ set aside and publishes it with a single pointer swap. Readers never lock nor wait.
+ Old sets are reclaimed with epoch based reclamation : a reader announces the global
+ epoch in its own slot while it holds a set, a retired set is deleted once no reader
+ slot announces an epoch older than its retirement.
+
+    ExpressionRegistry registry;
+    registry.reload({ {"price", "x * exp(-k*t)"} });
+    // evaluator thread
+    ExpressionRegistry::Reader reader(registry);   // once per thread
+    {
+       auto set = reader.read();                   // no lock
+       set->find("price")->evaluate(vars);
+    }                                              // released
+*/
+class MEP_EXPORTS ExpressionRegistry {
+public:
+   static constexpr size_t max_readers = 256;
+private:
+   struct alignas(64) ReaderSlot {
+      std::atomic<uint64_t> epoch{ 0 };   // 0 : not reading
+      std::atomic<bool> in_use{ false };
+   };
+   ReaderSlot m_slots[max_readers];
+   std::atomic<const ExpressionSet*> m_current{ nullptr };
+   std::atomic<uint64_t> m_epoch{ 1 };
+   std::atomic<uint64_t> m_version{ 0 };  // of the current set
+
+   std::mutex m_writer_mutex;             // writers only
+   std::vector<std::pair<uint64_t, const ExpressionSet*>> m_retired; // retire epoch, set
+   uint64_t m_next_version{ 1 };
+   std::unique_ptr<ThreadPool> m_compiler;
+
+   void reclaim_locked();
+public:
+   // RAII guard : the set stays alive until destruction
+   class ReadGuard {
+      ReaderSlot* m_slot;
+      const ExpressionSet* m_set;
+   public:
+      ReadGuard(ReaderSlot* slot, const ExpressionSet* set) : m_slot(slot), m_set(set) {}
+      ReadGuard(ReadGuard&& other) noexcept : m_slot(other.m_slot), m_set(other.m_set) { other.m_slot = nullptr; }
+      ReadGuard(const ReadGuard&) = delete;
+      ReadGuard& operator=(const ReadGuard&) = delete;
+      ~ReadGuard() { if (m_slot) m_slot->epoch.store(0, std::memory_order_release); }
+
+      // nullptr before the first publication
+      const ExpressionSet* get() const { return m_set; }
+      const ExpressionSet* operator->() const { return m_set; }
+      explicit operator bool() const { return m_set != nullptr; }
+   };
+
+   // Registration of a reader thread (lock free), one guard at a time per reader
+   class MEP_EXPORTS Reader {
+      ExpressionRegistry& m_registry;
+      ReaderSlot* m_slot;
+   public:
+      // throws MepException when max_readers are already registered
+      explicit Reader(ExpressionRegistry& registry);
+      ~Reader();
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
+      ReadGuard read();
+   };
+
+   ExpressionRegistry() = default;
+   ~ExpressionRegistry();
+   ExpressionRegistry(const ExpressionRegistry&) = delete;
+   ExpressionRegistry& operator=(const ExpressionRegistry&) = delete;
+
+   // publishes set (its version is assigned here), returns the version
+   uint64_t publish(std::unique_ptr<ExpressionSet> set);
+   // compiles and publishes, the current set is kept on error
+   uint64_t reload(const ExpressionSet::Definitions& definitions);
+   // same, compiled on a background thread
+   std::future<uint64_t> reload_async(ExpressionSet::Definitions definitions);
+
+   // deletes the retired sets no reader can still hold
+   void reclaim();
+   // retired sets not reclaimed yet
+   size_t nb_retired();
+   uint64_t version() const { return m_version.load(); }
+};
+
+} // ns
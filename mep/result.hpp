@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+// Error kinds reported by the exception free entry points (try_parse, try_evaluate)
+enum ErrorKind {
+   E_NONE = 0,
+   E_UNEXPECTED_TOKEN,      // a term, '(' or a function was expected
+   E_EXPECTED_LP,           // function name not followed by '('
+   E_EXPECTED_RP,           // unbalanced parenthesis
+   E_TRAILING_INPUT,        // end of input expected
+   E_UNSUPPORTED_OPERATOR,  // & |
+   E_IDENTIFIER_TOO_LONG,
+   E_INVALID_NUMBER,        // literal out of range
+   E_INVALID_TREE,          // evaluation of an incomplete or unknown tree
+   E_TOO_DEEP,              // ParserLimits::max_depth exceeded
+   E_TOO_LARGE              // ParserLimits::max_nodes exceeded
+};
+
+const char* MEP_EXPORTS error_message(ErrorKind kind);
+
+struct Error {
+   static constexpr size_t npos = static_cast<size_t>(-1);
+   ErrorKind kind{ E_NONE };
+   size_t offset{ npos };   // in the source text, npos when not related to a position
+
+   std::string to_string() const
+   {
+      std::string str = error_message(kind);
+      if (offset != npos) str += " at offset " + std::to_string(offset);
+      return str;
+   }
+};
+
+// Either a value or an error, in the spirit of std::expected
+template<class T>
+class Result {
+   T m_value{};
+   Error m_error;
+public:
+   Result(T value) : m_value(value) {}
+   Result(Error error) : m_error(error) {}
+
+   bool ok() const { return m_error.kind == E_NONE; }
+   explicit operator bool() const { return ok(); }
+   // meaningful only if ok()
+   const T& value() const { return m_value; }
+   T value_or(T fallback) const { return ok() ? m_value : fallback; }
+   const Error& error() const { return m_error; }
+};
+
+} // ns
@@ -0,0 +1,202 @@
+#include <mep/shared_store.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace mep {
+
+namespace {
+
+struct SharedControl {
+   std::atomic<uint64_t> generation; // 0 : nothing published yet
+};
+
+std::string control_name(const std::string& name)
+{
+   return "/" + name;
+}
+
+std::string segment_name(const std::string& name, uint64_t generation)
+{
+   return "/" + name + "." + std::to_string(generation);
+}
+
+#ifndef _WIN32
+// maps a whole shared memory object, nullptr if it does not exist
+void* map_segment(const std::string& name, bool writable, size_t& size)
+{
+   int fd = ::shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+   if (fd < 0) return nullptr;
+   struct stat st;
+   if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return nullptr;
+   }
+   size = static_cast<size_t>(st.st_size);
+   void* addr = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   return (addr == MAP_FAILED) ? nullptr : addr;
+}
+
+void* create_segment(const std::string& name, size_t size)
+{
+   int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+   if (fd < 0)
+      throw MepException("Cannot create shared memory " + name);
+   if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      ::close(fd);
+      throw MepException("Cannot size shared memory " + name);
+   }
+   void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (addr == MAP_FAILED)
+      throw MepException("Cannot map shared memory " + name);
+   return addr;
+}
+#endif
+
+} // ns
+
+
+//----------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+SharedStorePublisher::SharedStorePublisher(const std::string& name)
+   : m_name(name)
+{
+   size_t size = 0;
+   m_control = map_segment(control_name(name), true, size);
+   if (m_control == nullptr) {
+      m_control = create_segment(control_name(name), sizeof(SharedControl));
+      new (m_control) SharedControl{ {0} };
+   }
+}
+
+SharedStorePublisher::~SharedStorePublisher()
+{
+   if (m_control) ::munmap(m_control, sizeof(SharedControl));
+}
+
+uint64_t SharedStorePublisher::generation() const
+{
+   return static_cast<const SharedControl*>(m_control)->generation.load(std::memory_order_acquire);
+}
+
+uint64_t SharedStorePublisher::publish(const ProgramStoreWriter& writer)
+{
+   SharedControl* control = static_cast<SharedControl*>(m_control);
+   const uint64_t previous = control->generation.load(std::memory_order_acquire);
+   const uint64_t next = previous + 1;
+
+   std::vector<char> image = writer.serialize();
+   const std::string name = segment_name(m_name, next);
+   ::shm_unlink(name.c_str()); // leftover of a crashed publisher
+   void* segment = create_segment(name, image.size());
+   std::memcpy(segment, image.data(), image.size());
+   ::munmap(segment, image.size());
+
+   // the segment is complete : make it visible
+   control->generation.store(next, std::memory_order_release);
+   if (previous != 0) {
+      // mapped by readers until they refresh, the name only goes away
+      ::shm_unlink(segment_name(m_name, previous).c_str());
+   }
+   return next;
+}
+
+void SharedStorePublisher::unlink(const std::string& name)
+{
+   size_t size = 0;
+   void* control = map_segment(control_name(name), false, size);
+   if (control) {
+      uint64_t generation = static_cast<const SharedControl*>(control)->generation.load();
+      ::munmap(control, size);
+      if (generation != 0) ::shm_unlink(segment_name(name, generation).c_str());
+   }
+   ::shm_unlink(control_name(name).c_str());
+}
+
+
+SharedStoreReader::SharedStoreReader(const std::string& name)
+   : m_name(name)
+{
+}
+
+SharedStoreReader::~SharedStoreReader()
+{
+   unmap();
+   if (m_control) ::munmap(const_cast<void*>(m_control), sizeof(SharedControl));
+}
+
+void SharedStoreReader::unmap()
+{
+   m_store.close();
+   if (m_segment) ::munmap(m_segment, m_segment_size);
+   m_segment = nullptr;
+   m_segment_size = 0;
+}
+
+bool SharedStoreReader::refresh()
+{
+   if (m_control == nullptr) {
+      size_t size = 0;
+      m_control = map_segment(control_name(m_name), false, size);
+      if (m_control == nullptr) return false; // nothing published yet
+   }
+   const SharedControl* control = static_cast<const SharedControl*>(m_control);
+   while (true) {
+      uint64_t generation = control->generation.load(std::memory_order_acquire);
+      if (generation == 0 || generation == m_generation) return false;
+
+      size_t size = 0;
+      void* segment = map_segment(segment_name(m_name, generation), false, size);
+      if (segment == nullptr) {
+         // superseded (and unlinked) meanwhile : retry with the newer one
+         if (control->generation.load(std::memory_order_acquire) != generation) continue;
+         return false; // removed
+      }
+
+      unmap();
+      m_segment = segment;
+      m_segment_size = size;
+      m_generation = generation;
+      if (m_store.attach(m_segment, m_segment_size) != ProgramStore::Ok)
+         throw MepException("Invalid shared store segment " + segment_name(m_name, generation));
+      return true;
+   }
+}
+
+#else // _WIN32
+
+SharedStorePublisher::SharedStorePublisher(const std::string& name)
+   : m_name(name)
+{
+   throw MepException("Shared memory store not supported on this platform");
+}
+SharedStorePublisher::~SharedStorePublisher() {}
+uint64_t SharedStorePublisher::generation() const { return 0; }
+uint64_t SharedStorePublisher::publish(const ProgramStoreWriter&) { return 0; }
+void SharedStorePublisher::unlink(const std::string&) {}
+
+SharedStoreReader::SharedStoreReader(const std::string& name)
+   : m_name(name)
+{
+   throw MepException("Shared memory store not supported on this platform");
+}
+SharedStoreReader::~SharedStoreReader() {}
+void SharedStoreReader::unmap() {}
+bool SharedStoreReader::refresh() { return false; }
+
+#endif
+
+} // ns
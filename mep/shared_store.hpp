@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <mep/mep_export.h>
+#include <mep/program_store.hpp>
+
+namespace mep {
+
+/* Program store shared between processes
+ The rule set is compiled once by a publisher process into a POSIX shared memory
+ segment holding a ProgramStore image (position independent), every worker process
+ maps it read only and evaluates from it : a single copy in memory whatever the number
+ of workers.
+
+    /<name>          control segment : current generation number
+    /<name>.<gen>    store image of a generation
+
+ Publishing writes a whole new generation segment, then atomically swaps the
+ generation number. Workers call refresh() to switch to the latest generation; the
+ previous segment name is unlinked by the publisher, its memory is released once the
+ last worker has unmapped it.
+ POSIX only (throws MepException on other platforms), one publisher at a time.
+*/
+class MEP_EXPORTS SharedStorePublisher {
+   std::string m_name;
+   void* m_control{ nullptr };
+public:
+   // name : shared memory object name, without leading '/'
+   explicit SharedStorePublisher(const std::string& name);
+   ~SharedStorePublisher();
+   SharedStorePublisher(const SharedStorePublisher&) = delete;
+   SharedStorePublisher& operator=(const SharedStorePublisher&) = delete;
+
+   // returns the generation number now visible to readers
+   uint64_t publish(const ProgramStoreWriter& writer);
+   uint64_t generation() const;
+
+   // removes the control and current generation segments
+   static void unlink(const std::string& name);
+};
+
+class MEP_EXPORTS SharedStoreReader {
+   std::string m_name;
+   const void* m_control{ nullptr };
+   void* m_segment{ nullptr };
+   size_t m_segment_size{ 0 };
+   uint64_t m_generation{ 0 };
+   ProgramStore m_store;
+
+   void unmap();
+public:
+   explicit SharedStoreReader(const std::string& name);
+   ~SharedStoreReader();
+   SharedStoreReader(const SharedStoreReader&) = delete;
+   SharedStoreReader& operator=(const SharedStoreReader&) = delete;
+
+   // maps the latest published generation if it changed, true if it did
+   // (StoredPrograms found in the previous generation are invalidated)
+   bool refresh();
+
+   uint64_t generation() const { return m_generation; }
+   const ProgramStore& store() const { return m_store; }
+};
+
+} // ns
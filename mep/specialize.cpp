@@ -0,0 +1,241 @@
+#include <mep/specialize.hpp>
+#include <mep/instrumentation.hpp>
+
+#include <cstring>
+
+
+namespace mep {
+
+// operands are located before their users : with root as the last live
+// instruction, the compacted program ends with it
+static void strip_dead_code(Program& prog, size_t root)
+{
+   const size_t n = root + 1;
+   std::vector<uint8_t> live(n, 0);
+   live[root] = 1;
+   for (size_t i = n; i-- > 0; ) {
+      if (!live[i]) continue;
+      const Program::Instr& instr = prog.m_code[i];
+      if (instr.op == Program::Const || instr.op == Program::Var) continue;
+      const uint32_t* ops = prog.operands(instr);
+      for (uint32_t k = 0; k < instr.count; ++k) live[ops[k]] = 1;
+   }
+
+   Program out;
+   std::vector<uint32_t> renum(n, 0);
+   std::vector<int> var_renum(prog.nb_variables(), -1);
+   for (size_t i = 0; i < n; ++i) {
+      if (!live[i]) continue;
+      Program::Instr instr = prog.m_code[i];
+      if (instr.op == Program::Const) {
+         out.m_consts.push_back(prog.m_consts[instr.arg]);
+         instr.arg = static_cast<uint32_t>(out.m_consts.size() - 1);
+      } else if (instr.op == Program::Var) {
+         if (var_renum[instr.arg] < 0) {
+            var_renum[instr.arg] = static_cast<int>(out.m_variables.size());
+            out.m_variables.push_back(prog.m_variables[instr.arg]);
+         }
+         instr.arg = static_cast<uint32_t>(var_renum[instr.arg]);
+      } else {
+         const uint32_t* ops = prog.operands(instr);
+         uint32_t first = static_cast<uint32_t>(out.m_operands.size());
+         for (uint32_t k = 0; k < instr.count; ++k) out.m_operands.push_back(renum[ops[k]]);
+         instr.arg = first;
+      }
+      renum[i] = static_cast<uint32_t>(out.m_code.size());
+      out.m_code.push_back(instr);
+   }
+   prog = std::move(out);
+}
+
+void MEP_EXPORTS strip_dead_code(Program& prog)
+{
+   if (prog.empty()) return;
+   strip_dead_code(prog, prog.size() - 1);
+}
+
+
+//----------------------------------------------------------------------------
+
+// Value of an instruction of the source program during partial evaluation
+struct PartialValue {
+   bool is_const{ false };
+   number_t value{ 0 };
+   uint32_t index{ 0 };  // instruction in the residual program (when !is_const)
+};
+
+class Specializer {
+   const Program& m_src;
+   const std::map<std::string, number_t>& m_fixed;
+   Program m_out;
+   std::vector<PartialValue> m_values;
+   std::vector<int> m_var_slot; // source slot -> residual slot
+
+   static bool same(number_t v, number_t c) { return std::memcmp(&v, &c, sizeof(v)) == 0; }
+
+   uint32_t emit(Program::Instr instr)
+   {
+      m_out.m_code.push_back(instr);
+      return static_cast<uint32_t>(m_out.m_code.size() - 1);
+   }
+   // constants are only emitted when a residual instruction needs them
+   uint32_t materialize(const PartialValue& v)
+   {
+      if (!v.is_const) return v.index;
+      m_out.m_consts.push_back(v.value);
+      return emit({ Program::Const, 0, 0, 0, static_cast<uint32_t>(m_out.m_consts.size() - 1) });
+   }
+   PartialValue residual(Program::OpCode op, uint8_t func, const std::vector<PartialValue>& operands)
+   {
+      std::vector<uint32_t> indexes;
+      for (const PartialValue& v : operands) indexes.push_back(materialize(v));
+      uint32_t first = static_cast<uint32_t>(m_out.m_operands.size());
+      m_out.m_operands.insert(m_out.m_operands.end(), indexes.begin(), indexes.end());
+      PartialValue result;
+      result.index = emit({ op, func, 0, static_cast<uint32_t>(indexes.size()), first });
+      return result;
+   }
+   static PartialValue constant(number_t value)
+   {
+      PartialValue v;
+      v.is_const = true;
+      v.value = value;
+      return v;
+   }
+   static number_t fold(Program::OpCode op, uint8_t func, const std::vector<PartialValue>& operands)
+   {
+      // evaluate a one instruction program over the constant operands
+      Program prog;
+      for (const PartialValue& v : operands) {
+         prog.m_consts.push_back(v.value);
+         prog.m_code.push_back({ Program::Const, 0, 0, 0, static_cast<uint32_t>(prog.m_consts.size() - 1) });
+         prog.m_operands.push_back(static_cast<uint32_t>(prog.m_code.size() - 1));
+      }
+      prog.m_code.push_back({ op, func, 0, static_cast<uint32_t>(operands.size()), 0 });
+      std::vector<number_t> regs(prog.size());
+      return prog.evaluate(nullptr, regs.data());
+   }
+
+   PartialValue specialize_operator(size_t i)
+   {
+      const Program::Instr& instr = m_src.m_code[i];
+      const uint32_t* ops = m_src.operands(instr);
+      std::vector<PartialValue> operands;
+      bool all_const = true;
+      for (uint32_t k = 0; k < instr.count; ++k) {
+         operands.push_back(m_values[ops[k]]);
+         all_const = all_const && operands.back().is_const;
+      }
+      if (all_const) return constant(fold(instr.op, instr.func, operands));
+
+      const PartialValue& a = operands[0];
+      const PartialValue& b = operands.back();
+      auto is = [](const PartialValue& v, number_t c) { return v.is_const && same(v.value, c); };
+      switch (instr.op) {
+      case Program::Call:
+         if (instr.func == FunctionId::Identity) return a;
+         if (instr.func == FunctionId::Negate) { // -(-x)
+            const Program::Instr& child = m_out.m_code[a.index];
+            if (child.op == Program::Call && child.func == FunctionId::Negate) {
+               PartialValue v;
+               v.index = m_out.operands(child)[0];
+               return v;
+            }
+         }
+         break;
+      case Program::Add:
+         if (is(b, 0)) return a;
+         if (is(a, 0)) return b;
+         break;
+      case Program::Sub:
+         if (is(b, 0)) return a;
+         break;
+      case Program::Mul:
+         if (is(b, 1)) return a;
+         if (is(a, 1)) return b;
+         break;
+      case Program::Div:
+         if (is(b, 1)) return a;
+         break;
+      case Program::Pow:
+         if (is(b, 1)) return a;
+         if (is(b, 0)) return constant(1);
+         break;
+      case Program::Sum:
+      case Program::Product: {
+         bool is_sum = instr.op == Program::Sum;
+         // fold the leading constants only : keeps the evaluation order
+         std::vector<PartialValue> kept;
+         size_t k = 0;
+         if (operands[0].is_const) {
+            number_t acc = operands[0].value;
+            for (k = 1; k < operands.size() && operands[k].is_const; ++k) {
+               acc = is_sum ? acc + operands[k].value : acc * operands[k].value;
+            }
+            if (!same(acc, is_sum ? 0.0 : 1.0)) kept.push_back(constant(acc));
+         }
+         for (; k < operands.size(); ++k) {
+            if (!is(operands[k], is_sum ? 0.0 : 1.0)) kept.push_back(operands[k]);
+         }
+         if (kept.size() == 1) return kept[0];
+         Program::OpCode op = instr.op;
+         if (kept.size() == 2) op = is_sum ? Program::Add : Program::Mul;
+         return residual(op, 0, kept);
+      }
+      default:
+         break;
+      }
+      return residual(instr.op, instr.func, operands);
+   }
+
+public:
+   Specializer(const Program& src, const std::map<std::string, number_t>& fixed)
+      : m_src(src), m_fixed(fixed)
+   {}
+
+   Program run()
+   {
+      if (m_src.empty())
+         throw EvaluatorException("Empty program");
+      m_values.resize(m_src.size());
+      m_var_slot.assign(m_src.nb_variables(), -1);
+      for (size_t i = 0; i < m_src.size(); ++i) {
+         const Program::Instr& instr = m_src.m_code[i];
+         if (instr.op == Program::Const) {
+            m_values[i] = constant(m_src.m_consts[instr.arg]);
+         } else if (instr.op == Program::Var) {
+            const std::string& name = m_src.m_variables[instr.arg];
+            auto search = m_fixed.find(name);
+            if (search != m_fixed.end()) {
+               m_values[i] = constant(search->second);
+            } else {
+               if (m_var_slot[instr.arg] < 0) {
+                  m_var_slot[instr.arg] = static_cast<int>(m_out.m_variables.size());
+                  m_out.m_variables.push_back(name);
+               }
+               m_values[i].index = emit({ Program::Var, 0, 0, 0, static_cast<uint32_t>(m_var_slot[instr.arg]) });
+            }
+         } else {
+            m_values[i] = specialize_operator(i);
+         }
+      }
+      // the root may have been simplified to an earlier instruction
+      uint32_t root = materialize(m_values.back());
+      strip_dead_code(m_out, root);
+      return std::move(m_out);
+   }
+};
+
+Program MEP_EXPORTS specialize(const Program& program, const std::map<std::string, number_t>& fixed)
+{
+   MEP_PHASE_SCOPE(PH_OPTIMIZE);
+   Specializer specializer(program, fixed);
+   return specializer.run();
+}
+
+Program MEP_EXPORTS specialize(AST* ast, const std::map<std::string, number_t>& fixed)
+{
+   return specialize(compile(ast), fixed);
+}
+
+} // ns
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <mep/mep_export.h>
+#include <mep/program.hpp>
+
+namespace mep {
+
+/* Partial evaluation
+ Substitutes the fixed variables by their value, then folds constants and applies
+ the algebraic identities that give the same result bit for bit, but for the sign
+ of a zero (-0 + 0 is +0, the rewrite returns -0) :
+    x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1, x ^ 1  ->  x
+    x ^ 0  ->  1
+    -(-x)  ->  x
+ x * 0 is left alone (x could be inf or NaN). In n-ary sums/products, only the
+ leading constant operands are folded together so the evaluation order is kept,
+ and a leading 0 / 1 is dropped (same sign of zero caveat for the sums).
+
+    Program residual = specialize(compile(ast), { {"k", 0.5}, {"t", 2} });
+    residual.evaluate({ {"x", 3} });
+
+ The residual program only references the remaining variables (in order of first use)
+*/
+Program MEP_EXPORTS specialize(const Program& program, const std::map<std::string, number_t>& fixed);
+Program MEP_EXPORTS specialize(AST* ast, const std::map<std::string, number_t>& fixed);
+
+// Removes the instructions, constants and variables the root does not depend on
+void MEP_EXPORTS strip_dead_code(Program& program);
+
+} // ns
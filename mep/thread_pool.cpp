@@ -0,0 +1,107 @@
+#include <mep/thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+
+namespace mep {
+
+ThreadPool::ThreadPool(size_t nb_threads)
+{
+   if (nb_threads == 0) {
+      nb_threads = std::max(1u, std::thread::hardware_concurrency());
+   }
+   m_workers.reserve(nb_threads);
+   for (size_t i = 0; i < nb_threads; ++i) {
+      m_workers.emplace_back([this] { worker_loop(); });
+   }
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+   }
+   m_cv.notify_all();
+   for (std::thread& worker : m_workers) {
+      worker.join();
+   }
+}
+
+void ThreadPool::worker_loop()
+{
+   while (true) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_cv.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+         if (m_tasks.empty()) return; // stopping and drained
+         task = std::move(m_tasks.front());
+         m_tasks.pop();
+      }
+      task();
+   }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push(std::move(task));
+   }
+   m_cv.notify_one();
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t, size_t)>& body, size_t grain)
+{
+   if (n == 0) return;
+   grain = std::max<size_t>(grain, 1);
+   size_t nb_chunks = (n + grain - 1) / grain;
+   if (nb_chunks == 1) {
+      body(0, n);
+      return;
+   }
+
+   // shared with the helpers : a helper starting late finds no chunk left and leaves
+   struct State {
+      std::atomic<size_t> next{ 0 };
+      std::atomic<size_t> nb_done{ 0 };
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::exception_ptr error;
+   };
+   auto state = std::make_shared<State>();
+
+   auto run_chunks = [state, &body, n, grain, nb_chunks]() {
+      size_t chunk;
+      while ((chunk = state->next.fetch_add(1)) < nb_chunks) {
+         size_t begin = chunk * grain;
+         try {
+            body(begin, std::min(n, begin + grain));
+         } catch (...) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->error) state->error = std::current_exception();
+         }
+         if (state->nb_done.fetch_add(1) + 1 == nb_chunks) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->cv.notify_all();
+         }
+      }
+   };
+
+   size_t nb_helpers = std::min(m_workers.size(), nb_chunks - 1);
+   for (size_t i = 0; i < nb_helpers; ++i) {
+      submit(run_chunks);
+   }
+   run_chunks();
+
+   // body is only referenced while chunks remain, all are done once nb_done == nb_chunks
+   std::unique_lock<std::mutex> lock(state->mutex);
+   state->cv.wait(lock, [&] { return state->nb_done.load() == nb_chunks; });
+   if (state->error) std::rethrow_exception(state->error);
+}
+
+} // ns
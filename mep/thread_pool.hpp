@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+// Fixed size pool of worker threads fed from a single FIFO queue
+class MEP_EXPORTS ThreadPool {
+   std::vector<std::thread> m_workers;
+   std::queue<std::function<void()>> m_tasks;
+   std::mutex m_mutex;
+   std::condition_variable m_cv;
+   bool m_stop{ false };
+
+   void worker_loop();
+public:
+   // nb_threads == 0 : one worker per hardware thread
+   explicit ThreadPool(size_t nb_threads = 0);
+   ~ThreadPool();
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   size_t size() const { return m_workers.size(); }
+
+   // fire and forget
+   void submit(std::function<void()> task);
+
+   // Runs body(begin, end) over [0, n) split in chunks of `grain` items, the calling
+   // thread takes part in the work. Blocks until every chunk is done, the first
+   // exception thrown by body is rethrown here.
+   void parallel_for(size_t n, const std::function<void(size_t, size_t)>& body, size_t grain = 1);
+};
+
+} // ns
@@ -0,0 +1,164 @@
+#include <mep/tiered.hpp>
+#include <mep/flatten.hpp>
+#include <mep/parser.hpp>
+#include <mep/specialize.hpp>
+#include <mep/tracing.hpp>
+#include <mep/validate.hpp>
+
+
+namespace mep {
+
+namespace {
+
+// never destroyed : an expression may be released after the static destructors
+ThreadPool& background_compiler()
+{
+   static ThreadPool* pool = new ThreadPool(1);
+   return *pool;
+}
+
+// registers, then the variables reordered for the program (per thread, reused)
+thread_local std::vector<number_t> t_scratch;
+
+} // ns
+
+Expression::Expression(const std::string& source)
+   : Expression(source, Policy())
+{
+}
+
+Expression::Expression(const std::string& source, const Policy& policy)
+   : m_source(source)
+   , m_policy(policy)
+{
+   m_ast.reset(Parser().parse(m_source));
+   Result<std::vector<std::string_view>> names = collect_variables(m_source);
+   if (names) {
+      for (std::string_view name : names.value()) m_variables.emplace_back(name);
+   }
+   if (m_policy.start != TREE) {
+      publish(build(BYTECODE));
+   }
+}
+
+Expression::~Expression()
+{
+   wait();
+}
+
+Expression::Tier Expression::tier() const
+{
+   const Compiled* current = m_current.load(std::memory_order_acquire);
+   return current ? current->tier : TREE;
+}
+
+void Expression::wait() const
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_cv.wait(lock, [this] { return !m_f_compiling; });
+}
+
+number_t Expression::evaluate(const number_t* values)
+{
+   const Compiled* current = m_current.load(std::memory_order_acquire);
+   if (current == nullptr || current->tier != OPTIMIZED) {
+      const uint64_t calls = m_calls.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (calls == m_policy.bytecode_after || calls == m_policy.optimize_after) schedule();
+   }
+   if (current == nullptr) {
+      EvaluteVisitor evaluator;
+      for (size_t i = 0; i < m_variables.size(); ++i) evaluator.set(m_variables[i], values[i]);
+      return evaluator.collect(m_ast.get());
+   }
+   const Program& program = current->program;
+   const size_t nb_slots = current->same_slots ? 0 : current->slots.size();
+   if (t_scratch.size() < program.size() + nb_slots) t_scratch.resize(program.size() + nb_slots);
+   number_t* regs = t_scratch.data();
+   if (current->same_slots) return program.evaluate(values, regs);
+   number_t* vars = regs + program.size();
+   for (size_t i = 0; i < nb_slots; ++i) vars[i] = values[current->slots[i]];
+   return program.evaluate(vars, regs);
+}
+
+number_t Expression::evaluate(const std::map<std::string, number_t>& vars)
+{
+   std::vector<number_t> values(m_variables.size(), 1);
+   for (size_t i = 0; i < values.size(); ++i) {
+      auto search = vars.find(m_variables[i]);
+      if (search != vars.end()) values[i] = search->second;
+   }
+   return evaluate(values.data());
+}
+
+// tier for the evaluations counted so far
+Expression::Tier Expression::wanted() const
+{
+   const uint64_t calls = m_calls.load(std::memory_order_relaxed);
+   if (calls >= m_policy.optimize_after) return OPTIMIZED;
+   if (calls >= m_policy.bytecode_after || m_policy.start != TREE) return BYTECODE;
+   return TREE;
+}
+
+std::unique_ptr<Expression::Compiled> Expression::build(Tier tier) const
+{
+   std::unique_ptr<Compiled> form(new Compiled{ tier, Program(), {}, true });
+   if (tier == BYTECODE) {
+      form->program = compile(m_ast.get());
+   } else {
+      // the tree interpreter may be running on m_ast : flatten a copy
+      std::unique_ptr<AST> ast(flatten(Parser().parse(m_source)));
+      form->program = specialize(ast.get(), {});
+   }
+   for (const std::string& name : form->program.m_variables) {
+      uint32_t index = 0;
+      while (index < m_variables.size() && m_variables[index] != name) ++index;
+      if (index == m_variables.size())
+         throw EvaluatorException("Unknown variable " + name);
+      form->same_slots = form->same_slots && index == form->slots.size();
+      form->slots.push_back(index);
+   }
+   return form;
+}
+
+void Expression::publish(std::unique_ptr<Compiled> form)
+{
+   const Compiled* current = form.get();
+   m_forms[form->tier - 1] = std::move(form);
+   m_current.store(current, std::memory_order_release);
+}
+
+void Expression::schedule()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_f_compiling || m_f_failed) return; // promote() checks the count again before leaving
+      m_f_compiling = true;
+   }
+   ThreadPool& pool = m_policy.pool ? *m_policy.pool : background_compiler();
+   pool.submit([this] { promote(); });
+}
+
+void Expression::promote()
+{
+   MEP_TRACE_SPAN("promote", trace_id(m_source));
+   while (true) {
+      Tier target;
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         target = wanted();
+         if (m_f_failed || target <= tier()) {
+            m_f_compiling = false;
+            m_cv.notify_all();
+            return;
+         }
+      }
+      try {
+         publish(build(target));
+      } catch (...) {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_f_failed = true;
+      }
+   }
+}
+
+} // ns
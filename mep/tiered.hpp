@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/AST.hpp>
+#include <mep/program.hpp>
+#include <mep/thread_pool.hpp>
+
+namespace mep {
+
+/* Tiered execution
+ An Expression starts on the tree interpreter (a one-off formula only pays its parse)
+ and counts its evaluations. Past the thresholds of its policy it is promoted in the
+ background, on a thread pool :
+    TREE        EvaluteVisitor on the AST
+    BYTECODE    compiled Program (see program.hpp)
+    OPTIMIZED   flattened, compiled then specialized : constants folded, identities
+                removed (see specialize.hpp)
+ The new form is published with an atomic pointer swap : callers keep the same handle,
+ the evaluations in flight end on the form they started with. Once OPTIMIZED the
+ evaluations are no longer counted.
+
+    Expression expr("x * exp(-k*t)");
+    for (...) expr.evaluate({ {"x", x}, {"k", k}, {"t", t} });
+
+ Evaluating is thread safe. The forms are only released with the expression.
+*/
+class MEP_EXPORTS Expression {
+public:
+   enum Tier { TREE, BYTECODE, OPTIMIZED };
+   struct Policy {
+      Tier start{ TREE };                // BYTECODE : compiled by the constructor
+      uint64_t bytecode_after{ 100 };    // evaluations
+      uint64_t optimize_after{ 10000 };
+      ThreadPool* pool{ nullptr };       // background compiler, nullptr : a shared one thread pool
+   };
+
+   // throws ParserException
+   explicit Expression(const std::string& source);
+   Expression(const std::string& source, const Policy& policy);
+   // waits for a pending promotion
+   ~Expression();
+   Expression(const Expression&) = delete;
+   Expression& operator=(const Expression&) = delete;
+
+   const std::string& source() const { return m_source; }
+   // distinct variables, in order of first use
+   const std::vector<std::string>& variables() const { return m_variables; }
+
+   // values indexed as variables()
+   number_t evaluate(const number_t* values);
+   // unknown variables default to 1
+   number_t evaluate(const std::map<std::string, number_t>& vars);
+
+   Tier tier() const;
+   uint64_t nb_evaluations() const { return m_calls.load(std::memory_order_relaxed); }
+   // blocks until no promotion is pending
+   void wait() const;
+
+private:
+   struct Compiled {
+      Tier tier;
+      Program program;
+      std::vector<uint32_t> slots;   // program slot -> index in variables()
+      bool same_slots;
+   };
+
+   std::string m_source;
+   std::unique_ptr<AST> m_ast;
+   std::vector<std::string> m_variables;
+   Policy m_policy;
+   std::unique_ptr<Compiled> m_forms[2];          // BYTECODE, OPTIMIZED
+   std::atomic<const Compiled*> m_current{ nullptr };
+   std::atomic<uint64_t> m_calls{ 0 };
+
+   mutable std::mutex m_mutex;                    // promotion state
+   mutable std::condition_variable m_cv;
+   bool m_f_compiling{ false };
+   bool m_f_failed{ false };                      // a form could not be built, stay as is
+
+   Tier wanted() const;
+   std::unique_ptr<Compiled> build(Tier tier) const;
+   void publish(std::unique_ptr<Compiled> form);
+   void schedule();
+   void promote();
+};
+
+} // ns
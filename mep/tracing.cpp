@@ -0,0 +1,215 @@
+#include <mep/tracing.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+
+namespace mep {
+
+namespace {
+
+struct Span {
+   std::atomic<const char*> name{ nullptr };
+   std::atomic<uint64_t> start{ 0 };
+   std::atomic<uint64_t> end{ 0 };
+   std::atomic<uint64_t> id{ 0 };
+};
+
+// Single writer ring (the owner thread), drained under the registry mutex.
+// begun / committed frame the writes as a sequence lock : a span the writer
+// may be overwriting while it is copied is discarded by the reader.
+struct TraceBuffer {
+   uint32_t tid{ 0 };
+   std::atomic<bool> exited{ false };
+   std::atomic<uint64_t> begun{ 0 };
+   std::atomic<uint64_t> committed{ 0 };
+   uint64_t drained{ 0 };
+   Span spans[trace_buffer_spans];
+};
+
+struct Registry {
+   std::mutex mutex;
+   std::vector<TraceBuffer*> buffers;
+   uint32_t next_tid{ 1 };
+};
+
+// never destroyed : threads may record after the static destructors
+Registry& registry()
+{
+   static Registry* instance = new Registry();
+   return *instance;
+}
+
+std::atomic<bool> g_enabled{ false };
+const std::chrono::steady_clock::time_point g_origin = std::chrono::steady_clock::now();
+
+// trivially destructible : still readable while the thread_local objects are destroyed
+thread_local TraceBuffer* t_buffer = nullptr;
+thread_local bool t_exited = false;
+thread_local uint64_t t_current_id = 0;
+
+struct ThreadExit {
+   ~ThreadExit()
+   {
+      t_buffer->exited.store(true, std::memory_order_release);
+      t_buffer = nullptr;
+      t_exited = true;
+   }
+};
+
+TraceBuffer* local_buffer()
+{
+   if (t_buffer == nullptr && !t_exited) {
+      thread_local ThreadExit on_exit;
+      (void)on_exit;
+      TraceBuffer* buffer = new TraceBuffer();
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      buffer->tid = reg.next_tid++;
+      reg.buffers.push_back(buffer);
+      t_buffer = buffer;
+   }
+   return t_buffer;
+}
+
+struct Event {
+   const char* name;
+   uint64_t start;
+   uint64_t end;
+   uint64_t id;
+   uint32_t tid;
+};
+
+// under the registry mutex
+void drain(TraceBuffer& buffer, std::vector<Event>& events)
+{
+   const uint64_t committed = buffer.committed.load(std::memory_order_acquire);
+   uint64_t first = std::max(buffer.drained, committed > trace_buffer_spans ? committed - trace_buffer_spans : 0);
+   const size_t base = events.size();
+   for (uint64_t i = first; i < committed; ++i) {
+      const Span& span = buffer.spans[i % trace_buffer_spans];
+      events.push_back({ span.name.load(std::memory_order_relaxed), span.start.load(std::memory_order_relaxed),
+         span.end.load(std::memory_order_relaxed), span.id.load(std::memory_order_relaxed), buffer.tid });
+   }
+   std::atomic_thread_fence(std::memory_order_acquire);
+   // the spans [begun - size, ...) may have been overwritten during the copy
+   const uint64_t begun = buffer.begun.load(std::memory_order_relaxed);
+   const uint64_t valid = begun > trace_buffer_spans ? begun - trace_buffer_spans : 0;
+   if (first < valid) {
+      const size_t stale = static_cast<size_t>(std::min(valid, committed) - first);
+      events.erase(events.begin() + base, events.begin() + base + stale);
+   }
+   buffer.drained = committed;
+}
+
+void write_event(std::string& out, const Event& e, bool& first)
+{
+   char line[256];
+   std::snprintf(line, sizeof(line),
+      "%s\n  {\"name\": \"%s\", \"cat\": \"mep\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+      "\"pid\": 1, \"tid\": %u, \"args\": {\"expr\": \"%016llx\"}}",
+      first ? "" : ",", e.name, double(e.start) / 1000, double(e.end - e.start) / 1000,
+      e.tid, static_cast<unsigned long long>(e.id));
+   out += line;
+   first = false;
+}
+
+} // ns
+
+void MEP_EXPORTS start_tracing()
+{
+   g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void MEP_EXPORTS stop_tracing()
+{
+   g_enabled.store(false, std::memory_order_relaxed);
+}
+
+bool MEP_EXPORTS tracing_enabled()
+{
+   return g_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t MEP_EXPORTS trace_clock_ns()
+{
+   return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - g_origin).count());
+}
+
+uint64_t MEP_EXPORTS current_trace_id()
+{
+   return t_current_id;
+}
+
+uint64_t MEP_EXPORTS current_trace_id(uint64_t id)
+{
+   t_current_id = id;
+   return id;
+}
+
+void MEP_EXPORTS record_span(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t id)
+{
+   TraceBuffer* buffer = local_buffer();
+   if (buffer == nullptr) return; // thread exiting
+   const uint64_t i = buffer->begun.load(std::memory_order_relaxed);
+   buffer->begun.store(i + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   Span& span = buffer->spans[i % trace_buffer_spans];
+   span.name.store(name, std::memory_order_relaxed);
+   span.start.store(start_ns, std::memory_order_relaxed);
+   span.end.store(end_ns, std::memory_order_relaxed);
+   span.id.store(id, std::memory_order_relaxed);
+   buffer->committed.store(i + 1, std::memory_order_release);
+}
+
+std::string MEP_EXPORTS chrome_trace()
+{
+   std::vector<Event> events;
+   std::vector<uint32_t> tids;
+   {
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      for (auto it = reg.buffers.begin(); it != reg.buffers.end(); ) {
+         TraceBuffer* buffer = *it;
+         const bool exited = buffer->exited.load(std::memory_order_acquire);
+         const size_t before = events.size();
+         drain(*buffer, events);
+         if (events.size() > before || !exited) tids.push_back(buffer->tid);
+         if (exited) { // nothing more to come
+            delete buffer;
+            it = reg.buffers.erase(it);
+         } else {
+            ++it;
+         }
+      }
+   }
+   std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+
+   std::string out = "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+   bool first = true;
+   for (uint32_t tid : tids) {
+      char line[160];
+      std::snprintf(line, sizeof(line),
+         "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"mep thread %u\"}}",
+         first ? "" : ",", tid, tid);
+      out += line;
+      first = false;
+   }
+   for (const Event& e : events) write_event(out, e, first);
+   out += "\n]}\n";
+   return out;
+}
+
+bool MEP_EXPORTS write_chrome_trace(const std::string& path)
+{
+   std::ofstream out(path, std::ios::binary | std::ios::trunc);
+   out << chrome_trace();
+   return static_cast<bool>(out);
+}
+
+} // ns
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <mep/mep_export.h>
+
+namespace mep {
+
+/* Chrome trace (about://tracing, Perfetto) of the parse and evaluation activity
+ Built with MEP_TRACING defined (cmake -DMEP_TRACING=ON), the library records spans
+ for each parse, compile, batch chunk, registry reload and expression promotion
+ (see tiered.hpp) while tracing is started.
+ Otherwise MEP_TRACE_SPAN expands to nothing.
+
+    start_tracing();
+    ... batch job ...
+    stop_tracing();
+    write_chrome_trace("job.trace.json");
+
+ Each thread records in its own ring buffer (lock free, single writer) : when a
+ buffer is full the oldest spans are overwritten. write_chrome_trace() drains the
+ buffers of all the threads, exited ones included.
+ A span carries the thread (numbered in order of first span) and an expression id :
+    parse          hash of the source text
+    compile        id of the last parse on the same thread
+    batch chunk    hash of the program code
+    reload         registry version being replaced
+    promote        hash of the source text
+*/
+
+static constexpr size_t trace_buffer_spans = 16384; // per thread
+
+void MEP_EXPORTS start_tracing();
+void MEP_EXPORTS stop_tracing();
+bool MEP_EXPORTS tracing_enabled();
+
+// drains the recorded spans into a Chrome trace JSON file, false on write error
+bool MEP_EXPORTS write_chrome_trace(const std::string& path);
+// same, as a string
+std::string MEP_EXPORTS chrome_trace();
+
+// 64 bits FNV-1a, expression ids
+inline uint64_t trace_id(const void* data, size_t size)
+{
+   const unsigned char* p = static_cast<const unsigned char*>(data);
+   uint64_t h = 14695981039346656037ull;
+   for (size_t i = 0; i < size; ++i) {
+      h = (h ^ p[i]) * 1099511628211ull;
+   }
+   return h;
+}
+inline uint64_t trace_id(std::string_view text) { return trace_id(text.data(), text.size()); }
+
+// expression id of the last parse on this thread, the setter returns id
+uint64_t MEP_EXPORTS current_trace_id();
+uint64_t MEP_EXPORTS current_trace_id(uint64_t id);
+
+// name must be a string literal (kept by pointer)
+void MEP_EXPORTS record_span(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t id);
+uint64_t MEP_EXPORTS trace_clock_ns();
+
+class TraceSpan {
+   const char* m_name;
+   uint64_t m_id;
+   uint64_t m_start;
+public:
+   // name nullptr : tracing was not started, nothing is recorded
+   TraceSpan(const char* name, uint64_t id)
+      : m_name(name)
+      , m_id(id)
+      , m_start(name ? trace_clock_ns() : 0)
+   {}
+   ~TraceSpan()
+   {
+      if (m_name) record_span(m_name, m_start, trace_clock_ns(), m_id);
+   }
+   TraceSpan(const TraceSpan&) = delete;
+   TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#ifdef MEP_TRACING
+# define MEP_TRACE_CONCAT_IMPL(a, b) a##b
+# define MEP_TRACE_CONCAT(a, b) MEP_TRACE_CONCAT_IMPL(a, b)
+// id is only evaluated while tracing
+# define MEP_TRACE_SPAN(name, id) \
+   const bool MEP_TRACE_CONCAT(mep_tracing_, __LINE__) = ::mep::tracing_enabled(); \
+   ::mep::TraceSpan MEP_TRACE_CONCAT(mep_trace_span_, __LINE__)( \
+      MEP_TRACE_CONCAT(mep_tracing_, __LINE__) ? name : nullptr, \
+      MEP_TRACE_CONCAT(mep_tracing_, __LINE__) ? uint64_t(id) : 0)
+#else
+# define MEP_TRACE_SPAN(name, id) ((void)0)
+#endif
+
+} // ns
@@ -0,0 +1,108 @@
+#include <mep/validate.hpp>
+#include <mep/lexer.hpp>
+#include <mep/instrumentation.hpp>
+
+#include <unordered_set>
+
+
+namespace mep {
+
+namespace {
+
+Error make_error(ErrorKind kind, size_t offset)
+{
+   Error error;
+   error.kind = kind;
+   error.offset = offset;
+   return error;
+}
+
+// visit(lexer, lexeme) is called for every term accepted by the grammar
+template<class TermVisitor>
+Error scan(Lexer& lexer, TermVisitor& visit)
+{
+   size_t depth = 0;          // open parenthesis
+   bool expect_term = true;
+   while (true) {
+      Lexeme lex = lexer.next_lexeme();
+      if (lex.tag == TokenType::T_ERROR) {
+         return make_error(lexer.error(), lex.offset);
+      }
+      if (expect_term) {
+         switch (lex.tag) {
+         case TokenType::T_TERM:
+            visit(lexer, lex);
+            expect_term = false;
+            break;
+         case TokenType::T_LP:
+            ++depth;
+            break;
+         case TokenType::T_UNARY_OP:
+            if (!lex.op.is_sign()) { // function call
+               Lexeme lp = lexer.next_lexeme();
+               if (lp.tag == TokenType::T_ERROR) return make_error(lexer.error(), lp.offset);
+               if (lp.tag != TokenType::T_LP) return make_error(E_EXPECTED_LP, lp.offset);
+               ++depth;
+            }
+            break;
+         default:
+            return make_error(E_UNEXPECTED_TOKEN, lex.offset);
+         }
+      } else {
+         switch (lex.tag) {
+         case TokenType::T_BINARY_OP:
+            if (lex.op.m_operation == Operator::And || lex.op.m_operation == Operator::Or) {
+               return make_error(E_UNSUPPORTED_OPERATOR, lex.offset);
+            }
+            expect_term = true;
+            break;
+         case TokenType::T_RP:
+            if (depth == 0) return make_error(E_TRAILING_INPUT, lex.offset);
+            --depth;
+            break;
+         case TokenType::T_EOF:
+            if (depth != 0) return make_error(E_EXPECTED_RP, lex.offset);
+            return Error();
+         default:
+            return make_error(depth != 0 ? E_EXPECTED_RP : E_TRAILING_INPUT, lex.offset);
+         }
+      }
+   }
+}
+
+template<class TermVisitor>
+Error check_syntax(std::string_view input, TermVisitor&& visit)
+{
+   MEP_PHASE_SCOPE(PH_LEX);
+   Lexer lexer;
+   lexer.init(input);
+   Error error = scan(lexer, visit);
+   MEP_EVENT(EV_TOKENS, lexer.nb_tokens());
+   return error;
+}
+
+} // ns
+
+Error MEP_EXPORTS validate(std::string_view input)
+{
+   return check_syntax(input, [](const Lexer&, const Lexeme&) {});
+}
+
+Result<std::vector<std::string_view>> MEP_EXPORTS collect_variables(std::string_view input)
+{
+   std::vector<std::string_view> variables;
+   std::unordered_set<std::string_view> seen;
+   Error error = check_syntax(input, [&](const Lexer& lexer, const Lexeme& lex) {
+      if (lex.term_type != TermToken::Variable) return;
+      std::string_view name = lexer.text(lex);
+      if (seen.insert(name).second) {
+         variables.push_back(name);
+      }
+   });
+   if (error.kind != E_NONE) {
+      return error;
+   }
+   return variables;
+}
+
+} // ns
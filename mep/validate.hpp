@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/result.hpp>
+
+namespace mep {
+
+/* Syntax only fast path
+ Answers "is this formula valid" and "which variables does it use" without building
+ the AST : the lexemes are checked against the grammar (see parser.hpp)
+    E --> T {B T}
+    T --> v | "(" E ")" | U T | F "(" E ")"
+ with a two states automaton (expecting a term / expecting an operator) and a
+ parenthesis counter. Reports the same error kind and offset as Parser::try_parse,
+ but for the ParserLimits which are not checked (no tree, nothing to limit).
+*/
+
+// E_NONE when the input parses
+Error MEP_EXPORTS validate(std::string_view input);
+
+// Distinct variable names in order of first use, as views into input (which must
+// outlive the result), or the syntax error
+Result<std::vector<std::string_view>> MEP_EXPORTS collect_variables(std::string_view input);
+
+} // ns
@@ -0,0 +1,215 @@
+#include <mep/workbook.hpp>
+
+#include <algorithm>
+#include <cctype>
+
+
+namespace mep {
+
+static std::string trim(const std::string& str)
+{
+   size_t begin = str.find_first_not_of(" \t\r\n");
+   if (begin == std::string::npos) return "";
+   size_t end = str.find_last_not_of(" \t\r\n");
+   return str.substr(begin, end - begin + 1);
+}
+
+static bool is_identifier(const std::string& name)
+{
+   if (name.empty() || !::isalpha(name[0])) return false;
+   for (char c : name) {
+      if (!::isalnum(c)) return false;
+   }
+   return true;
+}
+
+Workbook::Workbook(size_t nb_threads)
+{
+   if (nb_threads != 1) {
+      m_pool = std::make_unique<ThreadPool>(nb_threads);
+   }
+}
+
+size_t Workbook::find(const std::string& name) const
+{
+   auto search = m_ids.find(name);
+   return (search != m_ids.end()) ? search->second : npos;
+}
+
+size_t Workbook::get_or_create(const std::string& name)
+{
+   size_t id = find(name);
+   if (id != npos) return id;
+   id = m_cells.size();
+   m_cells.emplace_back();
+   m_cells.back().name = name;
+   m_values.push_back(1);
+   m_ids[name] = id;
+   return id;
+}
+
+bool Workbook::is_formula(const std::string& name) const
+{
+   size_t id = find(name);
+   return id != npos && m_cells[id].is_formula;
+}
+
+number_t Workbook::value(const std::string& name) const
+{
+   size_t id = find(name);
+   if (id == npos)
+      throw WorkbookException("Unknown cell : " + name);
+   return m_values[id];
+}
+
+// true if target is reachable from cell following formula inputs
+bool Workbook::depends_on(size_t cell, size_t target) const
+{
+   std::vector<size_t> todo{ cell };
+   std::vector<bool> seen(m_cells.size(), false);
+   while (!todo.empty()) {
+      size_t id = todo.back(); todo.pop_back();
+      if (id == target) return true;
+      if (seen[id]) continue;
+      seen[id] = true;
+      for (size_t input : m_cells[id].inputs) {
+         todo.push_back(input);
+      }
+   }
+   return false;
+}
+
+void Workbook::define(const std::string& definition)
+{
+   size_t eq = definition.find('=');
+   if (eq == std::string::npos)
+      throw WorkbookException("Expected 'name = expression'");
+   define(trim(definition.substr(0, eq)), definition.substr(eq + 1));
+}
+
+void Workbook::define(const std::string& name, const std::string& expression)
+{
+   if (!is_identifier(name))
+      throw WorkbookException("Invalid cell name : " + name);
+
+   AST* ast = m_parser.parse(expression);
+   Program program;
+   try {
+      program = compile(ast);
+   } catch (...) {
+      delete ast;
+      throw;
+   }
+   delete ast;
+
+   // check for cycles before touching the workbook
+   size_t self = find(name);
+   if (self != npos) {
+      for (const std::string& var : program.m_variables) {
+         size_t input = find(var);
+         if (var == name || (input != npos && depends_on(input, self))) {
+            throw WorkbookException("Circular reference : " + name + " -> " + var);
+         }
+      }
+   } else if (program.slot(name) >= 0) {
+      throw WorkbookException("Circular reference : " + name + " -> " + name);
+   }
+
+   size_t id = get_or_create(name);
+   // unlink the previous definition
+   for (size_t input : m_cells[id].inputs) {
+      std::vector<size_t>& deps = m_cells[input].dependents;
+      deps.erase(std::remove(deps.begin(), deps.end(), id), deps.end());
+   }
+   std::vector<size_t> inputs;
+   for (const std::string& var : program.m_variables) {
+      inputs.push_back(get_or_create(var));
+   }
+   Cell& cell = m_cells[id]; // after get_or_create : m_cells may have grown
+   cell.is_formula = true;
+   cell.source = trim(expression);
+   cell.program = std::move(program);
+   cell.inputs = std::move(inputs);
+   for (size_t input : cell.inputs) {
+      std::vector<size_t>& deps = m_cells[input].dependents;
+      if (std::find(deps.begin(), deps.end(), id) == deps.end()) deps.push_back(id);
+   }
+   m_changed.push_back(id);
+}
+
+void Workbook::set(const std::string& name, number_t value)
+{
+   if (!is_identifier(name))
+      throw WorkbookException("Invalid cell name : " + name);
+   size_t id = get_or_create(name);
+   if (m_cells[id].is_formula)
+      throw WorkbookException("Cannot set formula cell : " + name);
+   m_values[id] = value;
+   m_changed.push_back(id);
+}
+
+void Workbook::evaluate_cell(size_t id, std::vector<number_t>& scratch)
+{
+   const Cell& cell = m_cells[id];
+   const size_t nb_vars = cell.inputs.size();
+   scratch.resize(nb_vars + cell.program.size());
+   for (size_t slot = 0; slot < nb_vars; ++slot) {
+      scratch[slot] = m_values[cell.inputs[slot]];
+   }
+   m_values[id] = cell.program.evaluate(scratch.data(), scratch.data() + nb_vars);
+}
+
+size_t Workbook::recalculate()
+{
+   // affected formulas : transitive dependents of the changed cells
+   std::vector<uint8_t> affected(m_cells.size(), 0);
+   std::vector<size_t> todo;
+   for (size_t id : m_changed) {
+      if (m_cells[id].is_formula) todo.push_back(id);
+      for (size_t dep : m_cells[id].dependents) todo.push_back(dep);
+   }
+   m_changed.clear();
+   std::vector<size_t> order;
+   while (!todo.empty()) {
+      size_t id = todo.back(); todo.pop_back();
+      if (affected[id]) continue;
+      affected[id] = 1;
+      order.push_back(id);
+      for (size_t dep : m_cells[id].dependents) todo.push_back(dep);
+   }
+
+   // Kahn's algorithm restricted to the affected formulas, wave by wave
+   std::vector<size_t> nb_pending(m_cells.size(), 0);
+   std::vector<size_t> wave;
+   for (size_t id : order) {
+      for (size_t input : m_cells[id].inputs) {
+         if (affected[input]) nb_pending[id]++;
+      }
+      if (nb_pending[id] == 0) wave.push_back(id);
+   }
+
+   size_t nb_evaluated = 0;
+   std::vector<number_t> scratch;
+   while (!wave.empty()) {
+      if (m_pool && wave.size() >= m_parallel_threshold) {
+         m_pool->parallel_for(wave.size(), [this, &wave](size_t begin, size_t end) {
+            std::vector<number_t> local;
+            for (size_t i = begin; i < end; ++i) evaluate_cell(wave[i], local);
+         }, 16);
+      } else {
+         for (size_t id : wave) evaluate_cell(id, scratch);
+      }
+      nb_evaluated += wave.size();
+
+      std::vector<size_t> next;
+      for (size_t id : wave) {
+         for (size_t dep : m_cells[id].dependents) {
+            if (affected[dep] && --nb_pending[dep] == 0) next.push_back(dep);
+         }
+      }
+      wave.swap(next);
+   }
+   return nb_evaluated;
+}
+
+} // ns
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <mep/mep_export.h>
+#include <mep/parser.hpp>
+#include <mep/program.hpp>
+#include <mep/thread_pool.hpp>
+
+namespace mep {
+
+class MEP_EXPORTS WorkbookException : public MepException {
+public:
+   WorkbookException(const std::string& message)
+      : MepException(message)
+   {}
+};
+
+/* Spreadsheet like set of named formulas
+   rate   = base + spread
+   price  = notional * exp(-rate * t)
+ Every name is a cell : either a formula or an input value. A variable referenced by
+ a formula and not defined as a formula is an input cell (defaulting to 1, as in
+ EvaluteVisitor). Formulas form a dependency DAG, cycles are rejected at definition.
+
+ recalculate() recomputes only the formulas affected by the changes since the last
+ call, in topological order. Formulas of the same wave (all their dependencies
+ already up to date) are independent and evaluated in parallel on the thread pool.
+
+ define()/set()/recalculate() must not be called concurrently.
+*/
+class MEP_EXPORTS Workbook {
+   static constexpr size_t npos = static_cast<size_t>(-1);
+
+   struct Cell {
+      std::string name;
+      bool is_formula{ false };
+      std::string source;
+      Program program;
+      std::vector<size_t> inputs;     // variable slot -> cell
+      std::vector<size_t> dependents; // formulas reading this cell
+   };
+   std::vector<Cell> m_cells;
+   std::vector<number_t> m_values;    // cell -> value (as of the last recalculate)
+   std::unordered_map<std::string, size_t> m_ids;
+   std::vector<size_t> m_changed;     // cells changed since the last recalculate
+   Parser m_parser;
+   std::unique_ptr<ThreadPool> m_pool;
+   size_t m_parallel_threshold{ 64 };
+
+   size_t find(const std::string& name) const;
+   size_t get_or_create(const std::string& name);
+   bool depends_on(size_t cell, size_t target) const;
+   void evaluate_cell(size_t cell, std::vector<number_t>& scratch);
+public:
+   // nb_threads == 0 : one worker per hardware thread, 1 : no worker, single threaded
+   explicit Workbook(size_t nb_threads = 0);
+
+   // "name = expression"
+   void define(const std::string& definition);
+   void define(const std::string& name, const std::string& expression);
+   // sets an input cell, throws if name is a formula
+   void set(const std::string& name, number_t value);
+
+   // waves smaller than this are evaluated on the calling thread only
+   void parallel_threshold(size_t nb_formulas) { m_parallel_threshold = nb_formulas; }
+
+   // recomputes the affected formulas, returns how many were evaluated
+   size_t recalculate();
+
+   bool contains(const std::string& name) const { return find(name) != npos; }
+   bool is_formula(const std::string& name) const;
+   number_t value(const std::string& name) const;
+   size_t size() const { return m_cells.size(); }
+};
+
+} // ns